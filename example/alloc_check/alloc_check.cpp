@@ -0,0 +1,146 @@
+/*
+ * Native check of the static allocation mode: a SesameServer in static storage, with its tables sized by
+ * LIBSESAME3BT_SERVER_MAX_CONNECTIONS (3 in this environment), does not allocate from the heap on the connect / login /
+ * command / notify path once it is started.
+ *
+ * The server runs on the NimBLE stand-in. Its allocations are counted inside every call into it (the NimBLE callbacks
+ * run by the loopback, update(), send_lock_status(), wait_event()); those of the centrals and the loopback are not.
+ * malloc / calloc / realloc are counted, not only operator new, and the server side includes libsesame3bt-core: a C
+ * allocation in the core (e.g. an mbedtls context set up at login) fails the check as well.
+ * Event queue, connection parameters, admission control, status coalescing and segment packing are enabled.
+ *
+ * One warm-up cycle (connect, login, commands, status, disconnect of every session) runs first, so lazily sized
+ * containers of the core reach their steady state. Exits with 1 if a later cycle allocates.
+ *
+ * pio run -e alloc_check && .pio/build/alloc_check/program [--cycles N] [--commands N]
+ */
+#include <cstdio>
+#include "../native_common/alloc_counter.h"
+#include "../native_common/args.h"
+#include "../native_common/loopback.h"
+
+using namespace loopback;
+using namespace libsesame3bt;
+
+namespace {
+
+constexpr size_t SESSIONS = LIBSESAME3BT_SERVER_MAX_CONNECTIONS;
+
+// Static storage, destroyed in reverse order: the link outlives the server
+Link link;
+SesameServer server{SESSIONS};
+Handler handler{link};
+server_event_t event;
+size_t events = 0;
+
+int64_t now_us = 0;
+
+void
+advance_ms(uint32_t ms) {
+	now_us += ms * 1000;
+	host_clock::set_us(now_us);
+}
+
+/// The application task: status update, periodic update() and the events of the server.
+void
+run_application(bool locked) {
+	link.account([&] {
+		server.send_lock_status(locked);
+		server.update();
+		while (server.wait_event(event, 0)) {
+			++events;
+		}
+	});
+}
+
+struct cycle_result_t {
+	bool ok;
+	size_t allocations;
+};
+
+cycle_result_t
+run_cycle(size_t n_commands) {
+	auto before = link.server_allocations;
+	auto secret = demo_secret();
+	std::vector<std::unique_ptr<LoopbackCentral>> centrals;
+	for (size_t i = 0; i < SESSIONS; i++) {
+		centrals.push_back(std::make_unique<LoopbackCentral>(link, static_cast<uint16_t>(i + 1)));
+		auto& c = *centrals.back();
+		if (!c.begin(Sesame::model_t::sesame_5, secret) ||
+		    c.connect(NimBLEDevice::getAddress(), 247) != NimBLEHost::connect_result_t::connected) {
+			return {false, 0};
+		}
+		link.pump();
+		run_application(false);
+	}
+	for (auto& c : centrals) {
+		if (!c->is_logged_in()) {
+			return {false, 0};
+		}
+	}
+	for (size_t i = 0; i < n_commands; i++) {
+		auto& c = *centrals[i % centrals.size()];
+		if (!((i & 1) ? c.unlock("alloc") : c.lock("alloc"))) {
+			return {false, 0};
+		}
+		link.pump();
+		advance_ms(10);
+		run_application(!(i & 1));
+		link.pump();
+	}
+	for (auto& c : centrals) {
+		c->disconnect(REASON_REMOTE_TERM);
+		run_application(false);
+	}
+	link.pump();
+	return {true, link.server_allocations - before};
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	size_t n_cycles = args::value(argc, argv, "--cycles", 10);
+	size_t n_commands = args::value(argc, argv, "--commands", 100);
+
+	host_clock::set_us(now_us);
+	server.set_handler(&handler);
+	server.enable_event_queue();
+	server.enable_connection_params();
+	server.enable_admission_control();
+	server.set_status_coalescing(20, 50);
+	server.enable_link_negotiation(247, 251, true);
+	if (!start_server(server, demo_secret())) {
+		std::fprintf(stderr, "server begin failed\n");
+		return 1;
+	}
+	// measurement buffers of the loopback are not part of the server
+	for (auto* recorder : {&link.write_to_command, &link.command_to_reply, &link.write_to_reply, &link.write_cost}) {
+		recorder->reserve((n_cycles + 1) * (n_commands + SESSIONS) * 8);
+	}
+	link.set_allocation_counter(alloc_counter::count);
+
+	std::printf("%-8s %12s\n", "cycle", "allocations");
+	size_t failures = 0;
+	for (size_t i = 0; i <= n_cycles; i++) {
+		auto result = run_cycle(n_commands);
+		if (!result.ok) {
+			std::fprintf(stderr, "cycle %zu failed\n", i);
+			return 1;
+		}
+		std::printf("%-8s %12zu\n", i == 0 ? "warm-up" : std::to_string(i).c_str(), result.allocations);
+		if (i > 0 && result.allocations) {
+			++failures;
+		}
+	}
+	server_stats_t stats;
+	server.get_stats(stats);
+	std::printf("commands=%zu events=%zu notifications=%zu logins=%u\n", handler.commands, events, link.notifications,
+	            stats.logins);
+	if (failures) {
+		std::printf("FAIL: %zu of %zu cycles allocated on the server side\n", failures, n_cycles);
+		return 1;
+	}
+	std::printf("OK: no server side allocation after warm-up\n");
+	return 0;
+}
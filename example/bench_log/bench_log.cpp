@@ -0,0 +1,100 @@
+/*
+ * Native micro-benchmark of library logging: cost on the calling (NimBLE host) task of the deferred log compared to
+ * formatting in place, and the time a synchronous Serial.printf would block at 115200 baud.
+ *
+ * pio run -e bench_log && .pio/build/bench_log/program [--lines N] [--burst N]
+ */
+#include <DeferredLog.h>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "../native_common/args.h"
+
+using namespace libsesame3bt;
+
+namespace {
+
+using log_t = DeferredLog<32>;
+
+constexpr double UART_BITS_PER_BYTE = 10;
+constexpr double UART_BAUD = 115200;
+
+uint64_t
+now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const std::string address = "f0:12:34:56:78:9a";
+const std::string manu = std::string("\x5a\x05\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d", 16);
+
+/// @brief The lines logged around a connection (connect, subscribe, connection parameters, advertising data).
+template <typename Log>
+size_t
+log_connection(Log&& log, unsigned handle) {
+	size_t n = 0;
+	n += log(log_level_t::debug, "Connected from = %s", address.c_str());
+	n += log(log_level_t::debug, "Subscribed from=%s, val=%u", address.c_str(), 1u);
+	n += log(log_level_t::debug, "Conn params %u: interval=%u latency=%u timeout=%u", handle, 12u, 0u, 400u);
+	n += log(log_level_t::debug, "new manu = %s", log_hex(manu));
+	return n;
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	size_t n_lines = args::value(argc, argv, "--lines", 100000);
+	size_t burst = args::value(argc, argv, "--burst", 100);
+
+	// deferred: record on the caller; the log task drains and formats between connection bursts (not timed)
+	static log_t log;
+	log_t::entry_t entry;
+	char line[192];
+	size_t written = 0;
+	size_t printed = 0;
+	uint64_t record_ns = 0;
+	for (size_t i = 0; written < n_lines; i++) {
+		auto started = now_ns();
+		for (size_t j = 0; j < log_t::capacity() / 4; j++) {
+			written += log_connection([](auto&&... args) { return static_cast<size_t>(log.write(args...)); }, (i + j) & 0xff);
+		}
+		record_ns += now_ns() - started;
+		while (log.pop(entry)) {
+			log_t::format(entry, line, sizeof(line));
+			++printed;
+		}
+	}
+	double deferred_ns = static_cast<double>(record_ns) / written;
+
+	// in place: format on the caller (Serial.printf additionally waits for the UART)
+	size_t formatted_bytes = 0;
+	auto started = now_ns();
+	for (size_t i = 0, n = 0; n < n_lines; i++) {
+		n += log_connection(
+		    [&](log_level_t level, const char* format, const auto&... args) {
+			    log_t::entry_t entry;
+			    log_t::encode(entry, level, format, args...);
+			    formatted_bytes += log_t::format(entry, line, sizeof(line)) + 2;
+			    return size_t{1};
+		    },
+		    i & 0xff);
+	}
+	double in_place_ns = static_cast<double>(now_ns() - started) / n_lines;
+	double avg_line = static_cast<double>(formatted_bytes) / n_lines;
+	double uart_us = avg_line * UART_BITS_PER_BYTE / UART_BAUD * 1e6;
+
+	// burst without consumer: everything beyond the buffer is dropped, not waited for
+	static log_t burst_log;
+	for (size_t i = 0; i < burst; i++) {
+		burst_log.write(log_level_t::debug, "burst %u", static_cast<unsigned>(i));
+	}
+
+	std::printf("%-28s %12s\n", "caller cost per line", "ns");
+	std::printf("%-28s %12.0f\n", "deferred (record)", deferred_ns);
+	std::printf("%-28s %12.0f\n", "in place (format only)", in_place_ns);
+	std::printf("%-28s %12.0f   (%.1f bytes/line at 115200 baud, once the TX buffer is full)\n", "in place (UART wait)",
+	            uart_us * 1000, avg_line);
+	std::printf("deferred: written=%zu printed=%zu dropped=%u\n", written, printed, log.get_dropped());
+	std::printf("burst of %zu into %zu lines: dropped=%u\n", burst, log_t::capacity(), burst_log.get_dropped());
+	return 0;
+}
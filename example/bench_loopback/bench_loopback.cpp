@@ -0,0 +1,53 @@
+/*
+ * Native loopback benchmark: commands/second and onWrite -> command handler -> notify reply latency of SesameServer.
+ *
+ * pio run -e bench_loopback && .pio/build/bench_loopback/program [--sessions N] [--commands N]
+ */
+#include <cstdio>
+#include "../native_common/args.h"
+#include "../native_common/loopback.h"
+
+using namespace loopback;
+
+int
+main(int argc, char** argv) {
+	size_t n_sessions = args::value(argc, argv, "--sessions", 3);
+	size_t n_commands = args::value(argc, argv, "--commands", 20000);
+
+	auto secret = demo_secret();
+	Link link;
+	libsesame3bt::SesameServer server{n_sessions};
+	Handler handler{link};
+	server.set_handler(&handler);
+	if (!start_server(server, secret)) {
+		std::fprintf(stderr, "server begin failed\n");
+		return 1;
+	}
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), n_sessions, secret);
+	if (centrals.empty()) {
+		return 1;
+	}
+
+	auto started = now_ns();
+	for (size_t i = 0; i < n_commands; i++) {
+		auto& c = *centrals[i % centrals.size()];
+		bool ok = (i & 1) ? c.unlock("bench") : c.lock("bench");
+		if (!ok) {
+			std::fprintf(stderr, "command %zu failed\n", i);
+			return 1;
+		}
+		link.pump();
+	}
+	auto elapsed = now_ns() - started;
+
+	libsesame3bt::server_stats_t stats;
+	server.get_stats(stats);
+	std::printf("sessions=%zu commands=%zu handled=%zu rejected_writes=%u\n", n_sessions, n_commands, handler.commands,
+	            stats.rejected_writes);
+	std::printf("throughput             %.0f commands/s\n", n_commands * 1e9 / elapsed);
+	link.write_to_command.print("onWrite->handler");
+	link.command_to_reply.print("handler->notify");
+	link.write_to_reply.print("onWrite->notify");
+	return handler.commands == n_commands && stats.rejected_writes == 0 ? 0 : 1;
+}
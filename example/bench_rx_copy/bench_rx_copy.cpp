@@ -0,0 +1,106 @@
+/*
+ * Native micro-benchmark of the RX path of SesameServer on the NimBLE stand-in: bytes copied, heap allocations and
+ * time per command.
+ *
+ *   onWrite     the former path: the central writes to a plain NimBLECharacteristic, whose default writeEvent()
+ *               stores the value into NimBLEAttValue and whose onWrite() takes it with getValue() and hands it on
+ *               (here to the server's RX, which adds one dispatch through the host to the time)
+ *   writeEvent  the current path: the central writes to the server's RX, RxCharacteristic::writeEvent() passes the
+ *               write buffer to the core
+ *
+ * Bytes copied are those into and out of NimBLEAttValue (NimBLEHost::get_value_bytes_copied()).
+ *
+ * pio run -e bench_rx_copy && .pio/build/bench_rx_copy/program [--commands N]
+ */
+#include <cstdio>
+#include "../native_common/alloc_counter.h"
+#include "../native_common/args.h"
+#include "../native_common/loopback.h"
+
+using namespace loopback;
+using namespace libsesame3bt;
+
+namespace {
+
+/// Plain characteristic callbacks as the server used them: copy the value out in onWrite().
+class OnWriteRelay : public NimBLECharacteristicCallbacks {
+ public:
+	uint16_t rx_handle = 0;
+
+	virtual void onWrite(NimBLECharacteristic* characteristic, NimBLEConnInfo& connInfo) override {
+		auto value = characteristic->getValue();
+		NimBLEHost::write(connInfo.getConnHandle(), rx_handle, value.data(), value.size());
+	}
+};
+
+struct result_t {
+	double allocs_per_command;
+	double copied_per_command;
+	double ns_per_command;
+};
+
+bool
+run(bool on_write, size_t n_commands, result_t& result) {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	OnWriteRelay relay;
+	NimBLECharacteristic* plain = nullptr;
+	if (on_write) {
+		// created before the server's service, the attribute table is built once by begin()
+		auto* svc = NimBLEDevice::createServer()->createService(NimBLEUUID{static_cast<uint32_t>(0xfefe0001)});
+		plain = svc->createCharacteristic(NimBLEUUID{static_cast<uint32_t>(0xfefe0002)},
+		                                  NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
+		plain->setCallbacks(&relay);
+		svc->start();
+	}
+	if (!start_server(server, secret)) {
+		std::fprintf(stderr, "server begin failed\n");
+		return false;
+	}
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	if (centrals.empty()) {
+		return false;
+	}
+	auto& central = *centrals.front();
+	if (plain) {
+		relay.rx_handle = discover_sesame_service(central.get_mtu()).rx;
+		central.set_rx_handle(plain->getHandle());
+	}
+	auto commands = handler.commands;
+	auto copied = NimBLEHost::get_value_bytes_copied();
+	auto allocs = alloc_counter::count();
+	auto started = now_ns();
+	for (size_t i = 0; i < n_commands; i++) {
+		if (!((i & 1) ? central.unlock("bench") : central.lock("bench"))) {
+			return false;
+		}
+		link.pump();
+	}
+	result.ns_per_command = static_cast<double>(now_ns() - started) / n_commands;
+	result.allocs_per_command = static_cast<double>(alloc_counter::count() - allocs) / n_commands;
+	result.copied_per_command = static_cast<double>(NimBLEHost::get_value_bytes_copied() - copied) / n_commands;
+	return handler.commands - commands == n_commands;
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	size_t n_commands = args::value(argc, argv, "--commands", 20000);
+
+	result_t before, after;
+	if (!run(true, n_commands, before) || !run(false, n_commands, after)) {
+		std::fprintf(stderr, "benchmark failed\n");
+		return 1;
+	}
+	// Allocation counts include the client side and the loopback link, which are the same in both runs.
+	std::printf("%-10s %14s %14s %12s\n", "rx path", "bytes copied", "allocations", "ns");
+	std::printf("%-10s %14.1f %14.2f %12.0f\n", "onWrite", before.copied_per_command, before.allocs_per_command,
+	            before.ns_per_command);
+	std::printf("%-10s %14.1f %14.2f %12.0f\n", "writeEvent", after.copied_per_command, after.allocs_per_command,
+	            after.ns_per_command);
+	return 0;
+}
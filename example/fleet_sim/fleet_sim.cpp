@@ -0,0 +1,401 @@
+/*
+ * Native fleet load simulator: virtual Remotes, Touches and Open Sensors against one SesameServer on the NimBLE
+ * stand-in, over the loopback.
+ *
+ * Every device is a SesameClientCore central that logs in with the shared secret and sends history-tagged lock /
+ * unlock commands (UUID tags for Remotes, text tags for Touches and Open Sensors). Time is virtual: devices arrive
+ * (wake up to operate the lock) at random with the given mean interval, connect, log in, send a command, stay connected
+ * for a while and leave. Whether a device gets a slot is up to the host and the server: the connection is refused when
+ * the host's connection pool is full or the server stopped advertising, and the server may refuse the session or, with
+ * admission control (--admission), evict an idle one for it. A refused device retries until it gives up, an evicted one
+ * loses its operation. Resident devices (e.g. a Hub) stay connected and send commands at the same rate.
+ *
+ * Not simulated: registration and the voltage reports of Open Sensors. SesameClientCore, the client side of the
+ * protocol the centrals run, has no registration procedure and sends lock / unlock with a literal tag only, so UUID
+ * tags arrive as text without a trigger type and no scaled voltage is sent. Producing those frames here would mean
+ * reimplementing the core's key agreement and encryption; the server is registered before the run instead.
+ *
+ * Scenarios run against each connection limit (the host's connection pool, CONFIG_BT_NIMBLE_MAX_CONNECTIONS; the server
+ * has as many sessions, one less with admission control so that a new peer can connect and be admitted):
+ *   burst   every device arrives within the first 100 ms, then at random
+ *   steady  arrivals at random from the start
+ * each with the GATT discovery a central does before subscribing (--gatt):
+ *   full    discovers the service, characteristics and descriptors on every connection
+ *   cached  reads the Database Hash and reuses the handles of its first connection (server built with
+ *           CONFIG_BT_NIMBLE_GATT_CACHING)
+ * Full discovery round trips are measured: those of the loopback central's ATT procedures against the server's
+ * attribute table at the connection's MTU. Cached discovery is modeled as one round trip for the Database Hash read,
+ * as the NimBLE stand-in does not serve the GATT service; login and command round trips are modeled too.
+ *
+ * Reported per run: arrivals, completed and abandoned operations, slot exhaustion (share of arrivals that were refused
+ * at least once, share of connection attempts refused by the host or the server, operations lost to evictions), mean
+ * discovery round trips per connection, operation latency from arrival to the command reply (virtual, includes waiting
+ * for a slot), median time from connection to the first command reply (virtual), throughput in virtual time, and the
+ * server CPU time per command write (real).
+ *
+ * pio run -e fleet_sim && .pio/build/fleet_sim/program [--remotes N] [--touches N] [--sensors N] [--resident N]
+ *     [--connections 3,6,9] [--seconds N] [--interval-ms N] [--retry-ms N] [--give-up-ms N] [--conn-interval-ms N]
+ *     [--gatt full|cached|both] [--admission] [--seed N]
+ */
+#include <cstdio>
+#include <queue>
+#include <random>
+#include <sstream>
+#include "../native_common/args.h"
+#include "../native_common/loopback.h"
+
+using namespace loopback;
+using namespace libsesame3bt;
+
+namespace {
+
+enum class kind_t : uint8_t { remote, touch, open_sensor, resident };
+
+struct profile_t {
+	const char* name;
+	uint32_t hold_ms;  ///< stays connected after the reply (waits for status, then disconnects)
+};
+
+constexpr profile_t profiles[] = {
+    {"remote", 1'500},
+    {"touch", 400},
+    {"open_sensor", 200},
+    {"resident", 0},
+};
+
+struct config_t {
+	size_t remotes;
+	size_t touches;
+	size_t sensors;
+	size_t resident;
+	uint32_t seconds;
+	uint32_t mean_interval_ms;  ///< mean time between operations of one device
+	uint32_t retry_ms;          ///< reconnect attempt interval while all slots are in use
+	uint32_t give_up_ms;        ///< abandon the operation after waiting this long for a slot
+	uint32_t conn_interval_ms;  ///< modeled connection interval, one round trip per interval
+	bool admission;             ///< admission control in the server
+	uint32_t seed;
+};
+
+/// Modeled round trips over the air, charged in virtual time: connect + subscribe + login, and command + reply.
+/// The GATT discovery in between is charged with the round trips the central measured.
+constexpr uint32_t LOGIN_ROUND_TRIPS = 4;
+constexpr uint32_t COMMAND_ROUND_TRIPS = 1;
+
+struct device_t {
+	kind_t kind;
+	std::string tag;
+	std::unique_ptr<LoopbackCentral> central;
+	uint32_t arrived_at = 0;
+	uint32_t connected_at = 0;
+	bool waiting = false;
+	bool lock_next = true;
+};
+
+struct event_t {
+	enum class type_t : uint8_t { arrive, retry, command, leave };
+	uint32_t time;
+	uint64_t order;
+	size_t device;
+	type_t type;
+	bool operator>(const event_t& other) const { return time != other.time ? time > other.time : order > other.order; }
+};
+
+struct result_t {
+	size_t arrivals = 0;
+	size_t completed = 0;
+	size_t abandoned = 0;
+	size_t blocked_arrivals = 0;
+	size_t attempts = 0;
+	size_t refused_attempts = 0;  ///< by the host (NimBLEHost::connect()) or the server (session refused)
+	size_t evicted = 0;           ///< operations whose session the server evicted before the command
+	size_t login_failures = 0;
+	size_t command_failures = 0;
+	size_t peak_connected = 0;
+	size_t connections = 0;
+	size_t discovery_round_trips = 0;
+	LatencyRecorder latency;  ///< virtual, stored as ms * 1e6 so percentile_us() / 1000 is ms
+	LatencyRecorder connect_to_command;  ///< first command of a connection, same unit as latency
+};
+
+class Simulation {
+ public:
+	Simulation(const config_t& config, size_t connections, bool burst, bool gatt_cache)
+	    : config(config),
+	      connections(connections),
+	      burst(burst),
+	      gatt_cache(gatt_cache),
+	      server(config.admission ? connections - 1 : connections),
+	      handler(link),
+	      rng(config.seed) {}
+
+	bool run(result_t& result) {
+		secret = demo_secret();
+		host_clock::set_us(0);
+		NimBLEHost::set_max_connections(connections);
+		server.set_handler(&handler);
+		if (config.admission) {
+			server.enable_admission_control();
+		}
+		if (!start_server(server, secret)) {
+			std::fprintf(stderr, "server begin failed\n");
+			return false;
+		}
+		add_devices(kind_t::remote, config.remotes);
+		add_devices(kind_t::touch, config.touches);
+		add_devices(kind_t::open_sensor, config.sensors);
+		add_devices(kind_t::resident, config.resident);
+		for (size_t i = 0; i < devices.size(); i++) {
+			uint32_t at = devices[i].kind == kind_t::resident ? 0 : burst ? uniform(100) : next_interval();
+			schedule(at, i, event_t::type_t::arrive);
+		}
+		auto end = config.seconds * 1000;
+		while (!events.empty() && events.top().time < end) {
+			auto event = events.top();
+			events.pop();
+			now = event.time;
+			host_clock::set_us(static_cast<int64_t>(now) * 1000);
+			handle(event, result);
+			server.update();
+		}
+		for (auto& device : devices) {
+			leave(device);
+		}
+		return true;
+	}
+
+	const SesameServer& get_server() const { return server; }
+	Link& get_link() { return link; }
+
+ private:
+	const config_t& config;
+	size_t connections;
+	bool burst;
+	bool gatt_cache;
+	Link link;
+	SesameServer server;
+	Handler handler;
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	std::mt19937 rng;
+	std::vector<device_t> devices;
+	std::priority_queue<event_t, std::vector<event_t>, std::greater<event_t>> events;
+	uint64_t order = 0;
+	uint32_t now = 0;
+
+	void add_devices(kind_t kind, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			// one connection per device at a time, so a handle per device is unique among the connections as the host's are
+			auto handle = static_cast<uint16_t>(devices.size() + 1);
+			device_t device{kind, make_tag(kind, devices.size()), std::make_unique<LoopbackCentral>(link, handle)};
+			device.central->begin(Sesame::model_t::sesame_5, secret);
+			device.central->set_gatt_cache(gatt_cache);
+			devices.push_back(std::move(device));
+		}
+	}
+	static std::string make_tag(kind_t kind, size_t index) {
+		if (kind == kind_t::remote || kind == kind_t::resident) {
+			// UUID history tag, 32 hex digits
+			char tag[33];
+			std::snprintf(tag, sizeof(tag), "5e5a3e00%08zx%016llx", index, index * 0x9e3779b97f4a7c15ull);
+			return tag;
+		}
+		return std::string(profiles[static_cast<size_t>(kind)].name) + "-" + std::to_string(index);
+	}
+	uint32_t uniform(uint32_t max) { return std::uniform_int_distribution<uint32_t>(0, max)(rng); }
+	uint32_t next_interval() {
+		return static_cast<uint32_t>(std::exponential_distribution<double>(1.0 / config.mean_interval_ms)(rng));
+	}
+	void schedule(uint32_t time, size_t device, event_t::type_t type) { events.push({time, order++, device, type}); }
+
+	void handle(const event_t& event, result_t& result) {
+		auto& device = devices[event.device];
+		switch (event.type) {
+			case event_t::type_t::arrive:
+				++result.arrivals;
+				device.arrived_at = now;
+				device.waiting = false;
+				try_connect(event.device, result);
+				break;
+			case event_t::type_t::retry:
+				try_connect(event.device, result);
+				break;
+			case event_t::type_t::command:
+				command(event.device, result);
+				break;
+			case event_t::type_t::leave:
+				leave(device);
+				schedule(now + next_interval(), event.device, event_t::type_t::arrive);
+				break;
+		}
+	}
+
+	void try_connect(size_t index, result_t& result) {
+		auto& device = devices[index];
+		++result.attempts;
+		auto& central = *device.central;
+		if (central.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected) {
+			link.pump();
+		}
+		// refused by the host, or the server ended the connection instead of starting a session
+		if (!central.is_connected()) {
+			++result.refused_attempts;
+			if (!device.waiting) {
+				device.waiting = true;
+				++result.blocked_arrivals;
+			}
+			if (now + config.retry_ms - device.arrived_at > config.give_up_ms) {
+				++result.abandoned;
+				schedule(now + next_interval(), index, event_t::type_t::arrive);
+			} else {
+				schedule(now + config.retry_ms, index, event_t::type_t::retry);
+			}
+			return;
+		}
+		if (!central.is_logged_in()) {
+			++result.login_failures;
+			leave(device);
+			schedule(now + next_interval(), index, event_t::type_t::arrive);
+			return;
+		}
+		result.peak_connected = std::max(result.peak_connected, NimBLEHost::get_connection_count());
+		++result.connections;
+		result.discovery_round_trips += central.get_discovery_round_trips();
+		device.connected_at = now;
+		auto round_trips = static_cast<uint32_t>(central.get_discovery_round_trips()) + LOGIN_ROUND_TRIPS;
+		schedule(now + round_trips * config.conn_interval_ms, index, event_t::type_t::command);
+	}
+
+	void command(size_t index, result_t& result) {
+		auto& device = devices[index];
+		if (!device.central->is_logged_in()) {
+			// evicted by the admission control, the device comes back for its next operation
+			++result.evicted;
+			schedule(now + next_interval(), index, event_t::type_t::arrive);
+			return;
+		}
+		auto handled = handler.commands;
+		bool sent = device.lock_next ? device.central->lock(device.tag) : device.central->unlock(device.tag);
+		device.lock_next = !device.lock_next;
+		link.pump();
+		auto done = now + COMMAND_ROUND_TRIPS * config.conn_interval_ms;
+		if (sent && handler.commands > handled) {
+			++result.completed;
+			result.latency.add(static_cast<uint64_t>(done - device.arrived_at) * 1'000'000);
+			if (device.connected_at != UINT32_MAX) {
+				result.connect_to_command.add(static_cast<uint64_t>(done - device.connected_at) * 1'000'000);
+				device.connected_at = UINT32_MAX;
+			}
+		} else {
+			++result.command_failures;
+		}
+		if (device.kind == kind_t::resident) {
+			device.arrived_at = done + next_interval();
+			schedule(device.arrived_at, index, event_t::type_t::command);
+		} else {
+			schedule(done + profiles[static_cast<size_t>(device.kind)].hold_ms, index, event_t::type_t::leave);
+		}
+	}
+
+	void leave(device_t& device) {
+		if (!device.central->is_connected()) {
+			return;
+		}
+		device.central->disconnect(REASON_REMOTE_TERM);
+		link.pump();
+	}
+};
+
+std::vector<size_t>
+parse_list(const std::string& text) {
+	std::vector<size_t> values;
+	std::stringstream ss{text};
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (!item.empty()) {
+			values.push_back(std::strtoul(item.c_str(), nullptr, 0));
+		}
+	}
+	return values;
+}
+
+double
+percent(size_t n, size_t total) {
+	return total ? 100.0 * n / total : 0;
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	config_t config{
+	    args::value(argc, argv, "--remotes", 6),
+	    args::value(argc, argv, "--touches", 4),
+	    args::value(argc, argv, "--sensors", 2),
+	    args::value(argc, argv, "--resident", 1),
+	    static_cast<uint32_t>(args::value(argc, argv, "--seconds", 600)),
+	    static_cast<uint32_t>(args::value(argc, argv, "--interval-ms", 20'000)),
+	    static_cast<uint32_t>(args::value(argc, argv, "--retry-ms", 200)),
+	    static_cast<uint32_t>(args::value(argc, argv, "--give-up-ms", 5'000)),
+	    static_cast<uint32_t>(args::value(argc, argv, "--conn-interval-ms", 30)),
+	    args::flag(argc, argv, "--admission"),
+	    static_cast<uint32_t>(args::value(argc, argv, "--seed", 1)),
+	};
+	auto connection_limits = parse_list(args::string(argc, argv, "--connections", "3,6,9"));
+	auto gatt = args::string(argc, argv, "--gatt", "both");
+	std::vector<std::pair<const char*, bool>> discovery_modes;
+	if (gatt == "full" || gatt == "both") {
+		discovery_modes.emplace_back("full", false);
+	}
+	if (gatt == "cached" || gatt == "both") {
+		discovery_modes.emplace_back("cached", true);
+	}
+	if (discovery_modes.empty()) {
+		std::fprintf(stderr, "--gatt must be full, cached or both\n");
+		return 1;
+	}
+	for (auto connections : connection_limits) {
+		if (connections < (config.admission ? 2 : 1) || connections > LIBSESAME3BT_SERVER_MAX_CONNECTIONS) {
+			std::fprintf(stderr, "--connections must be %d..%d\n", config.admission ? 2 : 1, LIBSESAME3BT_SERVER_MAX_CONNECTIONS);
+			return 1;
+		}
+	}
+
+	std::printf("devices: remotes=%zu touches=%zu open_sensors=%zu resident=%zu, %u s, mean interval %u ms, admission %s\n",
+	            config.remotes, config.touches, config.sensors, config.resident, static_cast<unsigned>(config.seconds),
+	            static_cast<unsigned>(config.mean_interval_ms), config.admission ? "on" : "off");
+	std::printf("not simulated: registration, Open Sensor voltage reports (no client core API for them)\n");
+	if (gatt == "cached" || gatt == "both") {
+		std::printf("disc rt of gatt cached: modeled as 1 round trip (Database Hash read) per reconnection, not measured\n");
+	}
+	std::printf("%-7s %-6s %5s %8s %8s %6s %8s %8s %7s %8s %7s %9s %9s %9s %12s %8s %10s\n", "scenario", "gatt", "conns",
+	            "arrivals", "done", "abandon", "blocked%", "refused%", "evicted", "peak", "disc rt", "p50 ms", "p99 ms", "max ms",
+	            "conn->cmd ms", "ops/s", "cpu p99 us");
+	bool ok = true;
+	for (bool burst : {true, false}) {
+		for (const auto& [gatt_name, gatt_cache] : discovery_modes) {
+			for (auto connections : connection_limits) {
+				result_t result;
+				Simulation sim{config, connections, burst, gatt_cache};
+				if (!sim.run(result)) {
+					return 1;
+				}
+				server_stats_t stats;
+				sim.get_server().get_stats(stats);
+				std::printf("%-7s %-6s %5zu %8zu %8zu %6zu %7.1f%% %7.1f%% %7zu %8zu %7.2f %9.1f %9.1f %9.1f %12.1f %8.2f %10.2f\n",
+				            burst ? "burst" : "steady", gatt_name, connections, result.arrivals, result.completed, result.abandoned,
+				            percent(result.blocked_arrivals, result.arrivals), percent(result.refused_attempts, result.attempts),
+				            result.evicted, result.peak_connected,
+				            result.connections ? static_cast<double>(result.discovery_round_trips) / result.connections : 0,
+				            result.latency.percentile_us(50) / 1000, result.latency.percentile_us(99) / 1000,
+				            result.latency.percentile_us(100) / 1000, result.connect_to_command.percentile_us(50) / 1000,
+				            result.completed / static_cast<double>(config.seconds), sim.get_link().write_to_reply.percentile_us(99));
+				if (result.login_failures || result.command_failures || stats.rejected_writes) {
+					std::printf("        login failures=%zu command failures=%zu rejected writes=%u\n", result.login_failures,
+					            result.command_failures, stats.rejected_writes);
+					ok = false;
+				}
+			}
+		}
+	}
+	return ok ? 0 : 1;
+}
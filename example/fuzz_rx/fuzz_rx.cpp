@@ -0,0 +1,155 @@
+/*
+ * Fuzz target for the server receive path (onWrite -> core.on_received -> command callback).
+ *
+ * SesameServer runs on the NimBLE stand-in with two loopback centrals: one logged in, one passive that stays in the
+ * login handshake. Each input is a sequence of operations: op (1 byte), length (1 byte), payload (length bytes).
+ *   op % 4 == 0  raw write of payload to the RX characteristic of the logged-in session (encrypted path)
+ *   op % 4 == 1  raw write of payload to the RX characteristic of the handshake session
+ *   op % 4 == 2  disconnect and reconnect the handshake session
+ *   op % 4 == 3  lock command with payload as tag from the logged-in central
+ * A session the server terminated (rejected write) is reconnected before its next operation.
+ * A capture (native_common/capture.h) is also accepted as input, its write records are fed as raw writes.
+ *
+ * With FUZZ_RX_SLOW_US=<n> in the environment, any single RX write taking longer than n microseconds aborts,
+ * so slow paths are reported like crashes.
+ *
+ * libFuzzer:  clang++ -std=gnu++17 -g -O1 -fsanitize=fuzzer,address -DLIBFUZZER -DCONFIG_BT_NIMBLE_MAX_CONNECTIONS=9 \
+ *               -Iexample/native_common/host -Ilib/libsesame3bt-server -I../libsesame3bt-core/src \
+ *               example/fuzz_rx/fuzz_rx.cpp <libsesame3bt-server sources> <libsesame3bt-core sources> -lmbedcrypto -pthread
+ *             ./a.out corpus/
+ * Standalone (runs the given inputs once, e.g. to reproduce a crash):
+ *             pio run -e fuzz_rx && .pio/build/fuzz_rx/program crash-...
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "../native_common/capture.h"
+#include "../native_common/loopback.h"
+
+using namespace loopback;
+using namespace libsesame3bt;
+
+namespace {
+
+constexpr uint16_t LOGGED_IN = 1;
+constexpr uint16_t HANDSHAKE = 2;
+
+uint64_t
+slow_limit_ns() {
+	static const uint64_t limit = [] {
+		auto* env = std::getenv("FUZZ_RX_SLOW_US");
+		return env ? std::strtoull(env, nullptr, 0) * 1000 : 0;
+	}();
+	return limit;
+}
+
+void
+check_slow(const Link& link, size_t& checked) {
+	auto limit = slow_limit_ns();
+	for (; checked < link.write_cost.count(); checked++) {
+		if (limit && link.write_cost.at(checked) > limit) {
+			std::fprintf(stderr, "slow RX write: %llu us\n", static_cast<unsigned long long>(link.write_cost.at(checked) / 1000));
+			std::abort();
+		}
+	}
+}
+
+/// Reconnect c if the server terminated it, and run the login sequence (if c is not passive).
+void
+ensure_connected(Link& link, LoopbackCentral& c) {
+	if (!c.is_connected()) {
+		c.connect(NimBLEDevice::getAddress());
+		link.pump();
+	}
+}
+
+}  // namespace
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	if (!start_server(server, secret)) {
+		return 0;
+	}
+	LoopbackCentral central{link, LOGGED_IN};
+	LoopbackCentral handshake{link, HANDSHAKE};
+	handshake.set_passive(true);
+	if (!central.begin(Sesame::model_t::sesame_5, secret) || !handshake.begin(Sesame::model_t::sesame_5, secret)) {
+		std::abort();
+	}
+	ensure_connected(link, central);
+	ensure_connected(link, handshake);
+	if (!central.is_logged_in() || !handshake.is_connected()) {
+		std::abort();
+	}
+	size_t checked = 0;
+
+	std::vector<capture::record_t> records;
+	if (capture::decode(data, size, records)) {
+		for (const auto& r : records) {
+			if (r.kind == capture::kind_t::write) {
+				auto& c = r.conn_handle == LOGGED_IN ? central : handshake;
+				ensure_connected(link, c);
+				c.write_raw(r.data.data(), r.data.size());
+				link.pump();
+			}
+		}
+		check_slow(link, checked);
+		return 0;
+	}
+
+	for (size_t pos = 0; pos + 2 <= size;) {
+		uint8_t op = data[pos];
+		size_t length = std::min<size_t>(data[pos + 1], size - pos - 2);
+		const uint8_t* payload = data + pos + 2;
+		pos += 2 + length;
+		switch (op % 4) {
+			case 0:
+				ensure_connected(link, central);
+				central.write_raw(payload, length);
+				break;
+			case 1:
+				ensure_connected(link, handshake);
+				handshake.write_raw(payload, length);
+				break;
+			case 2:
+				handshake.disconnect(REASON_REMOTE_TERM);
+				ensure_connected(link, handshake);
+				break;
+			case 3:
+				ensure_connected(link, central);
+				if (central.is_logged_in()) {
+					central.lock(std::string(reinterpret_cast<const char*>(payload), length));
+				}
+				break;
+		}
+		link.pump();
+		check_slow(link, checked);
+	}
+	return 0;
+}
+
+#ifndef LIBFUZZER
+int
+main(int argc, char** argv) {
+	for (int i = 1; i < argc; i++) {
+		auto* f = std::fopen(argv[i], "rb");
+		if (!f) {
+			std::fprintf(stderr, "cannot open %s\n", argv[i]);
+			return 1;
+		}
+		std::vector<uint8_t> input;
+		uint8_t buf[4096];
+		for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) {
+			input.insert(input.end(), buf, buf + n);
+		}
+		std::fclose(f);
+		LLVMFuzzerTestOneInput(input.data(), input.size());
+		std::printf("%s: ok\n", argv[i]);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,191 @@
+/*
+ * N SESAME identities on one MultiSesameServer, driven through loopback centrals on the NimBLE stand-in.
+ *
+ * Each identity has its own UUID, secret, handler and extended advertising set. Centrals of every identity connect to
+ * the address of their identity and log in, then send commands concurrently: every round all centrals write before the
+ * link is pumped, with fewer ACL buffers than centrals so that notifications are queued and retried. Checks that
+ *  - every set advertises its own address, and a connection is routed to the identity whose address was connected to,
+ *  - each identity's handler sees exactly the commands of its own centrals, and no queued notification is dropped,
+ *  - a central cannot log in to an identity with another identity's secret.
+ *
+ * pio run -e multi_identity && .pio/build/multi_identity/program [--identities N] [--centrals N] [--rounds N]
+ *     [--acl-buffers N]
+ */
+#include <MultiSesameServer.h>
+#include <cstdio>
+#include <set>
+#include "../native_common/args.h"
+#include "../native_common/loopback.h"
+
+using namespace libsesame3bt;
+using loopback::LoopbackCentral;
+
+namespace {
+
+struct identity_t {
+	identity_t(loopback::Link& link)
+	    : handler(link, [this](const command_event_t& event) {
+		      if (!addresses.count(event.address)) {
+			      ++foreign_commands;
+		      }
+		      return Sesame::result_code_t::success;
+	      }) {}
+
+	uint8_t uuid[16];
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	NimBLEAddress address;
+	MultiSesameServer::identity_id_t id;
+	loopback::Handler handler;
+	std::vector<std::unique_ptr<LoopbackCentral>> centrals;
+	std::set<NimBLEAddress> addresses;
+	size_t foreign_commands = 0;
+};
+
+/// Deliver everything in flight, retrying queued notifications from update() as the application loop does.
+void
+drain(loopback::Link& link, MultiSesameServer& server) {
+	while (link.pump()) {
+		server.update();
+	}
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	size_t n_identities = std::clamp<size_t>(args::value(argc, argv, "--identities", 4), 1, MultiSesameServer::MAX_IDENTITIES);
+	size_t n_centrals = std::max<size_t>(1, args::value(argc, argv, "--centrals", 2));
+	size_t n_rounds = args::value(argc, argv, "--rounds", 1000);
+	size_t acl_buffers = std::max<size_t>(1, args::value(argc, argv, "--acl-buffers", 3));
+	if (n_identities * n_centrals > LIBSESAME3BT_SERVER_MAX_CONNECTIONS) {
+		std::fprintf(stderr, "identities x centrals must not exceed %d\n", LIBSESAME3BT_SERVER_MAX_CONNECTIONS);
+		return 2;
+	}
+
+	loopback::Link link;
+	MultiSesameServer server{n_centrals};
+	std::vector<std::unique_ptr<identity_t>> identities;
+	for (size_t i = 0; i < n_identities; i++) {
+		auto& id = *identities.emplace_back(std::make_unique<identity_t>(link));
+		std::copy(std::begin(loopback::demo_uuid), std::end(loopback::demo_uuid), id.uuid);
+		id.uuid[15] ^= static_cast<uint8_t>(i);
+		id.secret = loopback::demo_secret();
+		id.secret[0] ^= static_cast<std::byte>(i);
+		auto uuid = loopback::to_nimble_uuid(id.uuid);
+		id.address = uuid_to_ble_address(uuid);
+		auto added = server.add_identity(Sesame::model_t::sesame_5, uuid, &id.handler);
+		if (!added) {
+			std::fprintf(stderr, "identity %zu add failed\n", i);
+			return 1;
+		}
+		id.id = *added;
+	}
+	if (!server.begin()) {
+		std::fprintf(stderr, "begin failed\n");
+		return 1;
+	}
+	for (const auto& id : identities) {
+		if (!server.set_registered(id->id, id->secret)) {
+			std::fprintf(stderr, "identity %u registration failed\n", id->id);
+			return 1;
+		}
+	}
+	if (!server.start_advertising()) {
+		std::fprintf(stderr, "start advertising failed\n");
+		return 1;
+	}
+
+	// one set per identity, connectable at the identity's address only
+	bool ok = true;
+	auto* adv = NimBLEDevice::getAdvertising();
+	size_t active_sets = 0;
+	for (const auto& id : identities) {
+		active_sets += adv->isActive(id->id);
+	}
+	uint8_t unknown_uuid[16];
+	std::copy(std::begin(loopback::demo_uuid), std::end(loopback::demo_uuid), unknown_uuid);
+	unknown_uuid[0] ^= 0xff;
+	LoopbackCentral stray{link, 0xff0};
+	auto stray_result = stray.connect(uuid_to_ble_address(loopback::to_nimble_uuid(unknown_uuid)));
+	std::printf("advertising sets active=%zu, connect to unknown address: %s\n", active_sets,
+	            stray_result == NimBLEHost::connect_result_t::not_advertising ? "refused" : "ACCEPTED");
+	ok = ok && active_sets == n_identities && stray_result == NimBLEHost::connect_result_t::not_advertising;
+
+	// a connection ends its set: the server restarts it for the next central of the identity
+	uint16_t next_handle = 1;
+	for (auto& id : identities) {
+		id->centrals = loopback::login_centrals(link, id->address, n_centrals, id->secret, Sesame::model_t::sesame_5, next_handle);
+		if (id->centrals.empty()) {
+			return 1;
+		}
+		next_handle += n_centrals;
+		for (const auto& c : id->centrals) {
+			id->addresses.insert(c->get_address());
+		}
+	}
+	size_t misrouted = 0;
+	for (const auto& id : identities) {
+		for (const auto& c : id->centrals) {
+			misrouted += server.get_identity(c->get_address()) != id->id;
+		}
+		ok = ok && server.get_session_count(id->id) == n_centrals && id->handler.logins == n_centrals;
+	}
+	std::printf("sessions=%zu misrouted=%zu\n", n_identities * n_centrals, misrouted);
+	ok = ok && misrouted == 0;
+
+	NimBLEHost::set_acl_buffers(acl_buffers);
+	auto started = loopback::now_ns();
+	for (size_t r = 0; r < n_rounds; r++) {
+		for (auto& id : identities) {
+			for (auto& c : id->centrals) {
+				if (!((r & 1) ? c->unlock("multi") : c->lock("multi"))) {
+					std::fprintf(stderr, "command failed on %u\n", c->get_conn_handle());
+					return 1;
+				}
+			}
+		}
+		drain(link, server);
+	}
+	auto elapsed = loopback::now_ns() - started;
+	NimBLEHost::set_acl_buffers(24);
+
+	size_t total = 0;
+	for (const auto& id : identities) {
+		size_t logged_in = std::count_if(id->centrals.begin(), id->centrals.end(), [](const auto& c) { return c->is_logged_in(); });
+		std::printf("identity %u: commands=%zu foreign=%zu logged_in=%zu\n", id->id, id->handler.commands, id->foreign_commands,
+		            logged_in);
+		ok = ok && id->handler.commands == n_centrals * n_rounds && id->foreign_commands == 0 && logged_in == n_centrals;
+		total += id->handler.commands;
+	}
+	auto tx = server.get_tx_queue_stats();
+	std::printf("acl_buffers=%zu notifications=%zu queued=%u retried=%u dropped=%u framing_errors=%zu\n", acl_buffers,
+	            link.notifications, tx.queued, tx.retried, tx.dropped, link.framing_errors);
+	std::printf("throughput %.0f commands/s over %zu identities\n", total * 1e9 / elapsed, n_identities);
+	ok = ok && tx.dropped == 0 && tx.retried == tx.queued && link.framing_errors == 0;
+	if (acl_buffers < n_identities * n_centrals) {
+		ok = ok && tx.queued > 0;
+	}
+
+	if (n_identities > 1) {
+		// secret of identity 0 against identity 1
+		auto& target = *identities[1];
+		target.centrals[0]->disconnect(loopback::REASON_REMOTE_TERM);
+		server.update();
+		LoopbackCentral intruder{link, next_handle};
+		size_t logins = target.handler.logins;
+		bool routed = false;
+		if (intruder.begin(Sesame::model_t::sesame_5, identities[0]->secret) &&
+		    intruder.connect(target.address) == NimBLEHost::connect_result_t::connected) {
+			// routed before the failed login ends the connection
+			routed = server.get_identity(intruder.get_address()) == target.id;
+			link.pump();
+		}
+		std::printf("cross-identity login: %s (routed to identity 1: %s)\n",
+		            intruder.is_logged_in() || target.handler.logins != logins ? "ACCEPTED" : "rejected", routed ? "yes" : "no");
+		ok = ok && !intruder.is_logged_in() && target.handler.logins == logins && routed;
+	}
+	if (!ok) {
+		std::printf("FAIL\n");
+	}
+	return ok ? 0 : 1;
+}
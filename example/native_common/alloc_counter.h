@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+ * Global allocation counter for native tools.
+ * Include this header from exactly one translation unit.
+ *
+ * With glibc, malloc / calloc / realloc / aligned_alloc / posix_memalign are replaced by functions that count and
+ * forward to glibc's allocator (__libc_*), so C allocations (e.g. mbedtls, which uses calloc) are counted as well as
+ * operator new, which allocates through malloc. Elsewhere only the global operator new is replaced.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+namespace alloc_counter {
+
+inline std::atomic<size_t> allocations{0};
+inline std::atomic<size_t> allocated_bytes{0};
+
+inline size_t
+count() {
+	return allocations.load(std::memory_order_relaxed);
+}
+
+inline void
+add(size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+}  // namespace alloc_counter
+
+#if defined(__GLIBC__)
+
+extern "C" {
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+void*
+malloc(size_t size) noexcept {
+	alloc_counter::add(size);
+	return __libc_malloc(size);
+}
+
+void*
+calloc(size_t n, size_t size) noexcept {
+	alloc_counter::add(n * size);
+	return __libc_calloc(n, size);
+}
+
+void*
+realloc(void* p, size_t size) noexcept {
+	// a new block unless it is a free
+	if (size) {
+		alloc_counter::add(size);
+	}
+	return __libc_realloc(p, size);
+}
+
+void*
+aligned_alloc(size_t alignment, size_t size) noexcept {
+	alloc_counter::add(size);
+	return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void** p, size_t alignment, size_t size) noexcept {
+	if (alignment < sizeof(void*) || (alignment & (alignment - 1))) {
+		return EINVAL;
+	}
+	alloc_counter::add(size);
+	*p = __libc_memalign(alignment, size);
+	return *p ? 0 : ENOMEM;
+}
+
+void
+free(void* p) noexcept {
+	__libc_free(p);
+}
+
+}  // extern "C"
+
+#else
+
+void*
+operator new(std::size_t size) {
+	alloc_counter::add(size);
+	if (void* p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc{};
+}
+
+void*
+operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void
+operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void
+operator delete[](void* p) noexcept {
+	std::free(p);
+}
+
+void
+operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void
+operator delete[](void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+#endif
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace args {
+
+/// @brief Value of "--name N", or def if not given.
+inline size_t
+value(int argc, char** argv, const char* name, size_t def) {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::strcmp(argv[i], name) == 0) {
+			return std::strtoul(argv[i + 1], nullptr, 0);
+		}
+	}
+	return def;
+}
+
+/// @brief Value of "--name S", or def if not given.
+inline std::string
+string(int argc, char** argv, const char* name, const char* def = "") {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::strcmp(argv[i], name) == 0) {
+			return argv[i + 1];
+		}
+	}
+	return def;
+}
+
+/// @brief Whether "--name" is given.
+inline bool
+flag(int argc, char** argv, const char* name) {
+	for (int i = 1; i < argc; i++) {
+		if (std::strcmp(argv[i], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+}  // namespace args
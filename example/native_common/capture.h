@@ -0,0 +1,133 @@
+#pragma once
+
+/*
+ * Capture of central -> peripheral traffic, per session, for the native replay and fuzz tools.
+ *
+ * File layout (little-endian):
+ *   header  "S3CP" | uint16 version (1) | uint16 reserved (0)
+ *   record  uint32 time_us | uint16 conn_handle | uint8 kind | uint8 reserved | uint16 length | length bytes
+ *
+ * time_us is relative to the start of the capture. Kinds:
+ *   connect, subscribe, disconnect  no data
+ *   write                           raw ATT write payload to the RX characteristic (as received by onWrite)
+ *   command                         item code (1 byte) followed by the tag, sent by a live central
+ *
+ * Writes after login are encrypted with keys derived from the session's random nonce, so raw writes only decode against
+ * the server instance they were recorded from. Replays of a session therefore use command records, re-encrypted by a
+ * loopback central, while write records are delivered as they are (handshake, malformed or fuzzed input).
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace capture {
+
+enum class kind_t : uint8_t { connect = 0, subscribe = 1, write = 2, command = 3, disconnect = 4 };
+
+struct record_t {
+	uint32_t time_us;
+	uint16_t conn_handle;
+	kind_t kind;
+	std::vector<uint8_t> data;
+};
+
+constexpr char MAGIC[4] = {'S', '3', 'C', 'P'};
+constexpr uint16_t VERSION = 1;
+constexpr size_t HEADER_SIZE = 8;
+constexpr size_t RECORD_HEADER_SIZE = 10;
+
+namespace detail {
+
+inline void
+put16(std::vector<uint8_t>& out, uint16_t v) {
+	out.push_back(v & 0xff);
+	out.push_back(v >> 8);
+}
+
+inline void
+put32(std::vector<uint8_t>& out, uint32_t v) {
+	put16(out, v & 0xffff);
+	put16(out, v >> 16);
+}
+
+inline uint16_t
+get16(const uint8_t* p) {
+	return p[0] | p[1] << 8;
+}
+
+inline uint32_t
+get32(const uint8_t* p) {
+	return get16(p) | static_cast<uint32_t>(get16(p + 2)) << 16;
+}
+
+}  // namespace detail
+
+inline std::vector<uint8_t>
+encode(const std::vector<record_t>& records) {
+	std::vector<uint8_t> out(std::begin(MAGIC), std::end(MAGIC));
+	detail::put16(out, VERSION);
+	detail::put16(out, 0);
+	for (const auto& r : records) {
+		detail::put32(out, r.time_us);
+		detail::put16(out, r.conn_handle);
+		out.push_back(static_cast<uint8_t>(r.kind));
+		out.push_back(0);
+		detail::put16(out, static_cast<uint16_t>(r.data.size()));
+		out.insert(out.end(), r.data.begin(), r.data.end());
+	}
+	return out;
+}
+
+/// @brief Parse a capture. @return false if the header is wrong or a record is truncated.
+inline bool
+decode(const uint8_t* data, size_t size, std::vector<record_t>& records) {
+	if (size < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0 || detail::get16(data + 4) != VERSION) {
+		return false;
+	}
+	size_t pos = HEADER_SIZE;
+	while (pos < size) {
+		if (size - pos < RECORD_HEADER_SIZE) {
+			return false;
+		}
+		const uint8_t* p = data + pos;
+		size_t length = detail::get16(p + 8);
+		if (size - pos - RECORD_HEADER_SIZE < length) {
+			return false;
+		}
+		records.push_back({detail::get32(p), detail::get16(p + 4), static_cast<kind_t>(p[6]),
+		                   {p + RECORD_HEADER_SIZE, p + RECORD_HEADER_SIZE + length}});
+		pos += RECORD_HEADER_SIZE + length;
+	}
+	return true;
+}
+
+inline bool
+save(const std::string& path, const std::vector<record_t>& records) {
+	auto bytes = encode(records);
+	auto* f = std::fopen(path.c_str(), "wb");
+	if (!f) {
+		return false;
+	}
+	bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+	return std::fclose(f) == 0 && ok;
+}
+
+inline bool
+load(const std::string& path, std::vector<record_t>& records) {
+	auto* f = std::fopen(path.c_str(), "rb");
+	if (!f) {
+		return false;
+	}
+	std::vector<uint8_t> bytes;
+	uint8_t buf[4096];
+	for (size_t n; (n = std::fread(buf, 1, sizeof(buf), f)) > 0;) {
+		bytes.insert(bytes.end(), buf, buf + n);
+	}
+	std::fclose(f);
+	return decode(bytes.data(), bytes.size(), records);
+}
+
+}  // namespace capture
@@ -0,0 +1,21 @@
+#pragma once
+
+/* Host stand-in for Arduino Serial (used by the library log), printing to stdout. */
+
+#include <cstdarg>
+#include <cstdio>
+
+class HardwareSerial {
+ public:
+	void begin(unsigned long) {}
+	size_t println(const char* line) { return std::printf("%s\n", line); }
+	__attribute__((format(printf, 2, 3))) int printf(const char* format, ...) {
+		va_list args;
+		va_start(args, format);
+		int n = std::vprintf(format, args);
+		va_end(args);
+		return n;
+	}
+};
+
+inline HardwareSerial Serial;
@@ -0,0 +1,1364 @@
+#pragma once
+
+/*
+ * Host (Linux) stand-in for the subset of NimBLE-Arduino 2.x used by libsesame3bt-server, so SesameServer and
+ * MultiSesameServer build and run natively without a radio.
+ *
+ * As seen from the server it behaves like the host stack:
+ * - a central can only connect to an advertised address, while a connection is free (CONFIG_BT_NIMBLE_MAX_CONNECTIONS)
+ *   and, with the connect filter on, if it is in the white list; the advertising (set) stops on connection
+ * - handles are assigned by NimBLEServer::start() in creation order, after the GAP and GATT services
+ * - ATT writes go through NimBLECharacteristic::writeEvent(): the default one stores the value into NimBLEAttValue and
+ *   calls onWrite(), getValue() returns a copy; writes to a CCCD call onSubscribe()
+ * - notify() takes an ACL buffer until the central has it, fails with BLE_HS_ENOMEM when they are used up, and reports
+ *   the result through onStatus() before it returns
+ * - NimBLEServer::disconnect() and updateConnParams() only start the procedure, onDisconnect() / onConnParamsUpdate()
+ *   follow when the central side completes it
+ *
+ * The central side (example/native_common/loopback.h) plays the controller through NimBLEHost and receives what the
+ * server sends through a NimBLEHost::Link. Callbacks run on the thread calling NimBLEHost, which stands for the NimBLE
+ * host task; notify() may be called from any thread.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define BLE_ADDR_PUBLIC 0
+#define BLE_ADDR_RANDOM 1
+#define BLE_OWN_ADDR_PUBLIC 0
+#define BLE_OWN_ADDR_RANDOM 1
+#define BLE_DEV_ADDR_LEN 6
+#define BLE_HS_CONN_HANDLE_NONE 0xffff
+#define BLE_HS_EALREADY 2
+#define BLE_HS_EINVAL 3
+#define BLE_HS_ENOMEM 6
+#define BLE_HS_ENOTCONN 7
+#define BLE_HS_ERR_HCI_BASE 0x200
+#define BLE_ERR_REM_USER_CONN_TERM 0x13
+#define BLE_ERR_RD_CONN_TERM_RESRCS 0x14
+#define BLE_ERR_CONN_TERM_LOCAL 0x16
+#define BLE_HS_ADV_F_DISC_GEN 0x02
+#define BLE_HS_ADV_F_BREDR_UNSUP 0x04
+#define BLE_HS_ADV_MAX_SZ 31
+#define BLE_ATT_MTU_DFLT 23
+#define BLE_ATT_MTU_MAX 527
+#define BLE_ATT_ATTR_MAX_LEN 512
+#define BLE_ATT_ERR_INVALID_HANDLE 0x01
+#define BLE_ATT_ERR_WRITE_NOT_PERMITTED 0x03
+#define BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN 0x0d
+
+#ifndef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#endif
+
+enum NIMBLE_PROPERTY : uint16_t {
+	READ = 0x0002,
+	WRITE_NR = 0x0004,
+	WRITE = 0x0008,
+	NOTIFY = 0x0010,
+	INDICATE = 0x0020,
+};
+
+struct ble_addr_t {
+	uint8_t type;
+	uint8_t val[6];
+};
+
+struct ble_gap_conn_desc {
+	ble_addr_t our_id_addr;
+	ble_addr_t peer_id_addr;
+	ble_addr_t our_ota_addr;
+	ble_addr_t peer_ota_addr;
+	uint16_t conn_handle;
+	uint16_t conn_itvl;
+	uint16_t conn_latency;
+	uint16_t supervision_timeout;
+	uint8_t role;
+};
+
+class NimBLEAddress : private ble_addr_t {
+ public:
+	NimBLEAddress() : ble_addr_t{} {}
+	NimBLEAddress(const ble_addr_t& address) : ble_addr_t{address} {}
+	NimBLEAddress(const uint8_t address[BLE_DEV_ADDR_LEN], uint8_t type) : ble_addr_t{} {
+		this->type = type;
+		std::memcpy(val, address, sizeof(val));
+	}
+	NimBLEAddress(uint64_t address, uint8_t type) : ble_addr_t{} {
+		this->type = type;
+		for (size_t i = 0; i < sizeof(val); i++) {
+			val[i] = static_cast<uint8_t>(address >> (8 * i));
+		}
+	}
+	/// "01:02:03:04:05:06", most significant byte first
+	NimBLEAddress(const std::string& address, uint8_t type) : ble_addr_t{} {
+		this->type = type;
+		unsigned v[6];
+		if (std::sscanf(address.c_str(), "%2x:%2x:%2x:%2x:%2x:%2x", &v[5], &v[4], &v[3], &v[2], &v[1], &v[0]) == 6) {
+			for (size_t i = 0; i < sizeof(val); i++) {
+				val[i] = static_cast<uint8_t>(v[i]);
+			}
+		}
+	}
+
+	bool isNull() const { return *this == NimBLEAddress{}; }
+	uint8_t getType() const { return type; }
+	const uint8_t* getVal() const { return val; }
+	const ble_addr_t* getBase() const { return this; }
+	std::string toString() const {
+		char s[18];
+		std::snprintf(s, sizeof(s), "%02x:%02x:%02x:%02x:%02x:%02x", val[5], val[4], val[3], val[2], val[1], val[0]);
+		return s;
+	}
+	operator std::string() const { return toString(); }
+	operator uint64_t() const {
+		uint64_t address = 0;
+		for (size_t i = 0; i < sizeof(val); i++) {
+			address |= static_cast<uint64_t>(val[i]) << (8 * i);
+		}
+		return address;
+	}
+	bool operator==(const NimBLEAddress& rhs) const { return type == rhs.type && std::memcmp(val, rhs.val, sizeof(val)) == 0; }
+	bool operator!=(const NimBLEAddress& rhs) const { return !(*this == rhs); }
+};
+
+/// UUID, the value is stored little-endian as in NimBLE.
+class NimBLEUUID {
+ public:
+	NimBLEUUID() = default;
+	NimBLEUUID(uint16_t uuid) : bits(16) {
+		value[0] = uuid & 0xff;
+		value[1] = uuid >> 8;
+	}
+	NimBLEUUID(uint32_t uuid) : bits(32) {
+		for (size_t i = 0; i < 4; i++) {
+			value[i] = static_cast<uint8_t>(uuid >> (8 * i));
+		}
+	}
+	NimBLEUUID(const uint8_t* data, size_t size) {
+		if (size == 2 || size == 4 || size == 16) {
+			bits = static_cast<uint8_t>(size * 8);
+			std::memcpy(value.data(), data, size);
+		}
+	}
+	/// "0x1234", "12345678" or "01234567-89ab-cdef-0123-456789abcdef"
+	NimBLEUUID(const std::string& uuid) {
+		std::string hex;
+		for (size_t i = uuid.compare(0, 2, "0x") == 0 ? 2 : 0; i < uuid.size(); i++) {
+			if (uuid[i] != '-') {
+				hex += uuid[i];
+			}
+		}
+		if (hex.size() != 4 && hex.size() != 8 && hex.size() != 32) {
+			return;
+		}
+		size_t n = hex.size() / 2;
+		for (size_t i = 0; i < n; i++) {
+			value[n - 1 - i] = static_cast<uint8_t>(std::stoul(hex.substr(i * 2, 2), nullptr, 16));
+		}
+		bits = static_cast<uint8_t>(n * 8);
+	}
+	NimBLEUUID(const char* uuid) : NimBLEUUID(std::string{uuid}) {}
+
+	uint8_t bitSize() const { return bits; }
+	const uint8_t* getValue() const { return value.data(); }
+	const NimBLEUUID& to128() {
+		if (bits == 16 || bits == 32) {
+			static constexpr uint8_t base[12] = {0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00, 0x00, 0x80, 0x00, 0x10, 0x00, 0x00};
+			std::array<uint8_t, 16> v{};
+			std::memcpy(v.data(), base, sizeof(base));
+			std::memcpy(v.data() + 12, value.data(), bits / 8);
+			value = v;
+			bits = 128;
+		}
+		return *this;
+	}
+	const NimBLEUUID& reverseByteOrder() {
+		std::reverse(value.begin(), value.begin() + bits / 8);
+		return *this;
+	}
+	std::string toString() const {
+		char s[37];
+		if (bits == 16) {
+			std::snprintf(s, sizeof(s), "0x%02x%02x", value[1], value[0]);
+		} else if (bits == 32) {
+			std::snprintf(s, sizeof(s), "0x%02x%02x%02x%02x", value[3], value[2], value[1], value[0]);
+		} else {
+			const auto& v = value;
+			std::snprintf(s, sizeof(s), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x", v[15], v[14], v[13],
+			              v[12], v[11], v[10], v[9], v[8], v[7], v[6], v[5], v[4], v[3], v[2], v[1], v[0]);
+		}
+		return s;
+	}
+	bool operator==(const NimBLEUUID& rhs) const {
+		if (bits == rhs.bits) {
+			return std::memcmp(value.data(), rhs.value.data(), bits / 8) == 0;
+		}
+		NimBLEUUID a{*this};
+		NimBLEUUID b{rhs};
+		return a.to128().value == b.to128().value;
+	}
+	bool operator!=(const NimBLEUUID& rhs) const { return !(*this == rhs); }
+
+ private:
+	std::array<uint8_t, 16> value{};
+	uint8_t bits = 0;
+};
+
+namespace nimble_host {
+
+/// Bytes copied into / out of NimBLEAttValue, for the receive path benchmark.
+inline std::atomic<size_t> value_bytes_copied{0};
+
+}  // namespace nimble_host
+
+/**
+ * @brief Attribute value: a heap buffer grown on demand and deep-copied with the object, as NimBLE's.
+ * Allocated with new[] (NimBLE uses realloc) so that the native allocation counter sees it.
+ */
+class NimBLEAttValue {
+ public:
+	NimBLEAttValue(uint16_t init_len = 20, uint16_t max_len = BLE_ATT_ATTR_MAX_LEN)
+	    : buffer(new uint8_t[init_len + 1]{}), capacity(init_len), max_len(max_len) {}
+	NimBLEAttValue(const NimBLEAttValue& source) { copy(source); }
+	NimBLEAttValue& operator=(const NimBLEAttValue& source) {
+		if (this != &source) {
+			delete[] buffer;
+			copy(source);
+		}
+		return *this;
+	}
+	~NimBLEAttValue() { delete[] buffer; }
+
+	bool setValue(const uint8_t* value, uint16_t len) {
+		if (len > max_len) {
+			return false;
+		}
+		if (len > capacity) {
+			auto* grown = new uint8_t[len + 1];
+			delete[] buffer;
+			buffer = grown;
+			capacity = len;
+		}
+		std::memcpy(buffer, value, len);
+		buffer[len] = 0;
+		length_ = len;
+		nimble_host::value_bytes_copied.fetch_add(len, std::memory_order_relaxed);
+		return true;
+	}
+	const uint8_t* data() const { return buffer; }
+	uint16_t size() const { return length_; }
+	uint16_t length() const { return length_; }
+	uint16_t getCapacity() const { return capacity; }
+
+ private:
+	uint8_t* buffer = nullptr;
+	uint16_t capacity = 0;
+	uint16_t max_len = BLE_ATT_ATTR_MAX_LEN;
+	uint16_t length_ = 0;
+
+	void copy(const NimBLEAttValue& source) {
+		buffer = new uint8_t[source.capacity + 1];
+		capacity = source.capacity;
+		max_len = source.max_len;
+		length_ = source.length_;
+		std::memcpy(buffer, source.buffer, source.capacity + 1);
+		nimble_host::value_bytes_copied.fetch_add(length_, std::memory_order_relaxed);
+	}
+};
+
+class NimBLEConnInfo {
+ public:
+	NimBLEConnInfo() : desc{} {}
+	NimBLEAddress getAddress() const { return NimBLEAddress{desc.peer_ota_addr}; }
+	NimBLEAddress getIdAddress() const { return NimBLEAddress{desc.peer_id_addr}; }
+	uint16_t getConnHandle() const { return desc.conn_handle; }
+	uint16_t getConnInterval() const { return desc.conn_itvl; }
+	uint16_t getConnLatency() const { return desc.conn_latency; }
+	uint16_t getConnTimeout() const { return desc.supervision_timeout; }
+	uint16_t getMTU() const { return mtu; }
+
+ private:
+	friend class NimBLEHost;
+	friend int ble_gap_conn_find(uint16_t handle, ble_gap_conn_desc* out_desc);
+	ble_gap_conn_desc desc;
+	uint16_t mtu = BLE_ATT_MTU_DFLT;
+};
+
+class NimBLEServer;
+class NimBLEService;
+class NimBLECharacteristic;
+
+class NimBLEServerCallbacks {
+ public:
+	virtual ~NimBLEServerCallbacks() {}
+	virtual void onConnect(NimBLEServer*, NimBLEConnInfo&) {}
+	virtual void onDisconnect(NimBLEServer*, NimBLEConnInfo&, int) {}
+	virtual void onMTUChange(uint16_t, NimBLEConnInfo&) {}
+	virtual void onConnParamsUpdate(NimBLEConnInfo&) {}
+};
+
+class NimBLECharacteristicCallbacks {
+ public:
+	virtual ~NimBLECharacteristicCallbacks() {}
+	virtual void onRead(NimBLECharacteristic*, NimBLEConnInfo&) {}
+	virtual void onWrite(NimBLECharacteristic*, NimBLEConnInfo&) {}
+	virtual void onStatus(NimBLECharacteristic*, int) {}
+	virtual void onSubscribe(NimBLECharacteristic*, NimBLEConnInfo&, uint16_t) {}
+};
+
+class NimBLECharacteristic {
+ public:
+	NimBLECharacteristic(const NimBLEUUID& uuid,
+	                     uint16_t properties = NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE,
+	                     uint16_t max_len = BLE_ATT_ATTR_MAX_LEN,
+	                     NimBLEService* service = nullptr)
+	    : uuid(uuid), properties(properties), service(service), value(20, max_len) {}
+	virtual ~NimBLECharacteristic() {}
+
+	void setCallbacks(NimBLECharacteristicCallbacks* callbacks) { this->callbacks = callbacks ? callbacks : &default_callbacks; }
+	NimBLECharacteristicCallbacks* getCallbacks() const { return callbacks; }
+	const NimBLEUUID& getUUID() const { return uuid; }
+	uint16_t getProperties() const { return properties; }
+	/// Handle of the value (the declaration is the one before it)
+	uint16_t getHandle() const { return handle; }
+	NimBLEService* getService() const { return service; }
+	NimBLEAttValue getValue() const {
+		std::lock_guard<std::mutex> guard{value_lock};
+		return value;
+	}
+	void setValue(const uint8_t* data, size_t length) {
+		std::lock_guard<std::mutex> guard{value_lock};
+		value.setValue(data, static_cast<uint16_t>(length));
+	}
+	bool notify(const uint8_t* data, size_t length, uint16_t connHandle = BLE_HS_CONN_HANDLE_NONE) const;
+
+ private:
+	friend class NimBLEHost;
+	friend class NimBLEService;
+
+	static inline NimBLECharacteristicCallbacks default_callbacks;
+	NimBLEUUID uuid;
+	uint16_t properties;
+	uint16_t handle = 0;
+	NimBLEService* service;
+	NimBLECharacteristicCallbacks* callbacks = &default_callbacks;
+	mutable std::mutex value_lock;
+	NimBLEAttValue value;
+
+	virtual void readEvent(NimBLEConnInfo& connInfo) { callbacks->onRead(this, connInfo); }
+	virtual void writeEvent(const uint8_t* val, uint16_t len, NimBLEConnInfo& connInfo) {
+		setValue(val, len);
+		callbacks->onWrite(this, connInfo);
+	}
+};
+
+class NimBLEService {
+ public:
+	NimBLEService(const NimBLEUUID& uuid) : uuid(uuid) {}
+	NimBLEService(const NimBLEService&) = delete;
+	~NimBLEService() {
+		for (auto* c : characteristics) {
+			delete c;
+		}
+	}
+
+	NimBLECharacteristic* createCharacteristic(const NimBLEUUID& uuid,
+	                                           uint32_t properties = NIMBLE_PROPERTY::READ | NIMBLE_PROPERTY::WRITE,
+	                                           uint16_t max_len = BLE_ATT_ATTR_MAX_LEN) {
+		auto* c = new NimBLECharacteristic(uuid, static_cast<uint16_t>(properties), max_len, this);
+		characteristics.push_back(c);
+		return c;
+	}
+	/// Takes ownership of the characteristic.
+	void addCharacteristic(NimBLECharacteristic* c) {
+		c->service = this;
+		characteristics.push_back(c);
+	}
+	NimBLECharacteristic* getCharacteristic(const NimBLEUUID& uuid) const {
+		for (auto* c : characteristics) {
+			if (c->getUUID() == uuid) {
+				return c;
+			}
+		}
+		return nullptr;
+	}
+	const std::vector<NimBLECharacteristic*>& getCharacteristics() const { return characteristics; }
+	const NimBLEUUID& getUUID() const { return uuid; }
+	uint16_t getHandle() const { return handle; }
+	bool start() {
+		started = true;
+		return true;
+	}
+	bool isStarted() const { return started; }
+
+ private:
+	friend class NimBLEHost;
+	NimBLEUUID uuid;
+	std::vector<NimBLECharacteristic*> characteristics;
+	uint16_t handle = 0;
+	uint16_t end_handle = 0;
+	bool started = false;
+};
+
+class NimBLEAdvertisementData {
+ public:
+	bool setFlags(uint8_t flags) { return addData(0x01, &flags, 1); }
+	bool addServiceUUID(const NimBLEUUID& uuid) {
+		uint8_t type = uuid.bitSize() == 16 ? 0x03 : uuid.bitSize() == 32 ? 0x05 : 0x07;
+		return addData(type, uuid.getValue(), uuid.bitSize() / 8);
+	}
+	bool setManufacturerData(const std::string& data) {
+		return addData(0xff, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+	}
+	bool setName(const std::string& name, bool complete = true) {
+		return addData(complete ? 0x09 : 0x08, reinterpret_cast<const uint8_t*>(name.data()), name.size());
+	}
+	bool addData(uint8_t type, const uint8_t* data, size_t size) {
+		if (payload.size() + 2 + size > BLE_HS_ADV_MAX_SZ) {
+			return false;
+		}
+		payload.push_back(static_cast<uint8_t>(size + 1));
+		payload.push_back(type);
+		payload.insert(payload.end(), data, data + size);
+		return true;
+	}
+	const std::vector<uint8_t>& getPayload() const { return payload; }
+	void clearData() { payload.clear(); }
+
+ private:
+	std::vector<uint8_t> payload;
+};
+
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+
+#ifndef CONFIG_BT_NIMBLE_MAX_EXT_ADV_INSTANCES
+#define CONFIG_BT_NIMBLE_MAX_EXT_ADV_INSTANCES 4
+#endif
+
+class NimBLEExtAdvertisement : public NimBLEAdvertisementData {
+ public:
+	void setLegacyAdvertising(bool enable) { legacy = enable; }
+	void setConnectable(bool enable) { connectable = enable; }
+	void setScannable(bool enable) { scannable = enable; }
+	void setAddress(const NimBLEAddress& address) { this->address = address; }
+
+ private:
+	friend class NimBLEHost;
+	friend class NimBLEExtAdvertising;
+	bool legacy = false;
+	bool connectable = false;
+	bool scannable = false;
+	NimBLEAddress address;
+};
+
+class NimBLEExtAdvertising {
+ public:
+	bool setInstanceData(uint8_t inst_id, NimBLEExtAdvertisement& adv);
+	bool setScanResponseData(uint8_t inst_id, NimBLEExtAdvertisement& data);
+	bool start(uint8_t inst_id, int duration = 0, int max_events = 0);
+	bool stop(uint8_t inst_id);
+	bool stop();
+	bool isActive(uint8_t inst_id);
+	bool isAdvertising();
+
+ private:
+	friend class NimBLEHost;
+	struct instance_t {
+		NimBLEExtAdvertisement data;
+		NimBLEExtAdvertisement scan_response;
+		bool configured = false;
+		bool active = false;
+	};
+	std::array<instance_t, CONFIG_BT_NIMBLE_MAX_EXT_ADV_INSTANCES> instances;
+};
+
+#else
+
+class NimBLEAdvertising {
+ public:
+	bool start(uint32_t duration = 0, const NimBLEAddress* dirAddr = nullptr);
+	bool stop();
+	bool isAdvertising();
+	void setMinInterval(uint16_t interval);
+	void setMaxInterval(uint16_t interval);
+	bool setAdvertisementData(const NimBLEAdvertisementData& data);
+	bool setScanResponseData(const NimBLEAdvertisementData& data);
+	bool refreshAdvertisingData();
+	void setScanFilter(bool scanRequestWhitelistOnly, bool connectWhitelistOnly);
+	const NimBLEAdvertisementData& getAdvertisementData() const { return data; }
+	const NimBLEAdvertisementData& getScanResponseData() const { return scan_response; }
+
+ private:
+	friend class NimBLEHost;
+	NimBLEAdvertisementData data;
+	NimBLEAdvertisementData scan_response;
+	bool active = false;
+	bool connect_filter = false;
+	uint16_t min_interval = 32;
+	uint16_t max_interval = 32;
+};
+
+#endif
+
+class NimBLEServer {
+ public:
+	NimBLEServer(const NimBLEServer&) = delete;
+	~NimBLEServer() {
+		for (auto* s : services) {
+			delete s;
+		}
+		if (delete_callbacks && callbacks != &default_callbacks) {
+			delete callbacks;
+		}
+	}
+
+	void setCallbacks(NimBLEServerCallbacks* callbacks, bool deleteCallbacks = true) {
+		this->callbacks = callbacks ? callbacks : &default_callbacks;
+		delete_callbacks = callbacks && deleteCallbacks;
+	}
+	NimBLEService* createService(const NimBLEUUID& uuid) {
+		auto* s = new NimBLEService(uuid);
+		services.push_back(s);
+		return s;
+	}
+	NimBLEService* getServiceByUUID(const NimBLEUUID& uuid) const {
+		for (auto* s : services) {
+			if (s->getUUID() == uuid) {
+				return s;
+			}
+		}
+		return nullptr;
+	}
+	bool start();
+	bool disconnect(uint16_t connHandle, uint8_t reason = BLE_ERR_REM_USER_CONN_TERM) const;
+	bool disconnect(const NimBLEConnInfo& connInfo, uint8_t reason = BLE_ERR_REM_USER_CONN_TERM) const {
+		return disconnect(connInfo.getConnHandle(), reason);
+	}
+	NimBLEConnInfo getPeerInfoByHandle(uint16_t connHandle) const;
+	size_t getConnectedCount() const;
+	void advertiseOnDisconnect(bool enable) { advertise_on_disconnect = enable; }
+	bool updateConnParams(uint16_t connHandle, uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout) const;
+	void setDataLen(uint16_t connHandle, uint16_t tx_octets) const;
+
+ private:
+	friend class NimBLEHost;
+	friend class NimBLEDevice;
+	NimBLEServer() = default;
+
+	static inline NimBLEServerCallbacks default_callbacks;
+	NimBLEServerCallbacks* callbacks = &default_callbacks;
+	bool delete_callbacks = false;
+	bool advertise_on_disconnect = true;
+	bool started = false;
+	std::vector<NimBLEService*> services;
+};
+
+class NimBLEDevice {
+ public:
+	static bool init(const std::string& deviceName);
+	/// @param clearAll Also delete the server and the advertising (the stand-in always forgets the connections).
+	static bool deinit(bool clearAll = false);
+	static bool isInitialized();
+	static bool setOwnAddrType(uint8_t type);
+	static bool setOwnAddr(const NimBLEAddress& addr);
+	static NimBLEAddress getAddress();
+	static NimBLEServer* createServer();
+	static NimBLEServer* getServer();
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+	static NimBLEExtAdvertising* getAdvertising();
+#else
+	static NimBLEAdvertising* getAdvertising();
+#endif
+	static bool setMTU(uint16_t mtu);
+	static uint16_t getMTU();
+	static bool whiteListAdd(const NimBLEAddress& address);
+	static bool whiteListRemove(const NimBLEAddress& address);
+	static bool onWhiteList(const NimBLEAddress& address);
+	static size_t getWhiteListCount();
+};
+
+/**
+ * @brief Controller side of the stand-in: the loopback plays the air and the centrals through it.
+ *
+ * Not part of NimBLE.
+ */
+class NimBLEHost {
+ public:
+	/// @brief Receives what the server sends to the centrals, from any thread with the host lock held: only queue it.
+	class Link {
+	 public:
+		virtual ~Link() {}
+		virtual void on_notify(uint16_t conn_handle, const uint8_t* data, size_t size) = 0;
+		/// The server requested the termination: complete it with disconnected().
+		virtual void on_terminate(uint16_t conn_handle, uint8_t reason) = 0;
+		/// The server requested new parameters: complete it with conn_params_updated().
+		virtual void on_conn_params(uint16_t conn_handle, uint16_t interval, uint16_t latency, uint16_t timeout) = 0;
+	};
+
+	enum class connect_result_t : uint8_t { connected, not_advertising, filtered, no_resources, handle_in_use };
+
+	/// GATT database entry as the server's ATT layer holds it.
+	struct attribute_t {
+		uint16_t handle;
+		uint16_t type;       ///< 0x2800 primary service, 0x2803 characteristic, 0x2902 CCCD, 0 characteristic value
+		NimBLEUUID uuid;     ///< service / characteristic UUID, or the 16-bit type of a value attribute
+		uint16_t end_handle;  ///< primary service: last handle of the service
+		uint16_t properties;  ///< characteristic
+	};
+
+	struct stats_t {
+		size_t notifications;
+		size_t notify_failures;  ///< out of ACL buffers
+		size_t writes;
+		size_t connects;
+		size_t refused_connects;
+		size_t terminations;  ///< requested by the server
+	};
+
+	static void set_link(Link* link) {
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		state().link = link;
+	}
+	/// @brief Connections the controller accepts (default CONFIG_BT_NIMBLE_MAX_CONNECTIONS, at most MAX_CONNECTIONS).
+	static void set_max_connections(size_t n) {
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		state().max_connections = std::min(n, MAX_CONNECTIONS);
+	}
+	/// @brief Notifications in flight over all connections before notify() fails with BLE_HS_ENOMEM.
+	static void set_acl_buffers(size_t n) {
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		state().acl_buffers = n;
+	}
+
+	/**
+	 * @brief A central connects to target (the device address, or the address of an advertising set).
+	 * onConnect() is called on success.
+	 *
+	 * @param interval Connection interval in 1.25 ms units.
+	 */
+	static connect_result_t connect(uint16_t conn_handle, const NimBLEAddress& peer, const NimBLEAddress& target, uint16_t interval = 24);
+	/// @brief The connection is gone (peer terminated, or the termination the server requested completed).
+	static void disconnected(uint16_t conn_handle, int reason);
+	/// @brief ATT MTU exchange started by the central. @return Negotiated MTU, 0 if not connected.
+	static uint16_t exchange_mtu(uint16_t conn_handle, uint16_t mtu);
+	/// @brief ATT write (request or command) to an attribute handle. @return 0 or the ATT error.
+	static uint8_t write(uint16_t conn_handle, uint16_t handle, const uint8_t* data, size_t size);
+	/// @brief The central has a notification: its ACL buffer is free again.
+	static void delivered(uint16_t conn_handle);
+	/// @brief The connection parameter update the server requested is complete.
+	static void conn_params_updated(uint16_t conn_handle, uint16_t interval, uint16_t latency, uint16_t timeout);
+
+	static std::vector<attribute_t> get_attributes() {
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		return state().attributes;
+	}
+	static size_t get_connection_count() {
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		return std::count_if(state().connections.begin(), state().connections.end(), [](const auto& c) { return c.used; });
+	}
+	static stats_t get_stats() {
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		return state().stats;
+	}
+	static size_t get_value_bytes_copied() { return nimble_host::value_bytes_copied.load(std::memory_order_relaxed); }
+
+ private:
+	friend class NimBLEDevice;
+	friend class NimBLEServer;
+	friend class NimBLECharacteristic;
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+	friend class NimBLEExtAdvertising;
+#else
+	friend class NimBLEAdvertising;
+#endif
+	friend int ble_gap_conn_find(uint16_t handle, ble_gap_conn_desc* out_desc);
+
+	/// Connection table size (fixed so that connecting and notifying do not allocate)
+	static constexpr size_t MAX_CONNECTIONS = 32;
+	/// First handle after the GAP (0x1800) and GATT (0x1801, with Service Changed and Database Hash) services.
+	static constexpr uint16_t FIRST_HANDLE = 14;
+
+	struct connection_t {
+		bool used = false;
+		bool terminating = false;
+		size_t in_flight = 0;
+		NimBLEConnInfo info;
+	};
+
+	struct state_t {
+		bool initialized = false;
+		NimBLEAddress address;
+		uint8_t own_addr_type = BLE_OWN_ADDR_PUBLIC;
+		uint16_t mtu = 255;
+		NimBLEServer* server = nullptr;
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+		NimBLEExtAdvertising* advertising = nullptr;
+#else
+		NimBLEAdvertising* advertising = nullptr;
+#endif
+		std::vector<NimBLEAddress> white_list;
+		std::array<connection_t, MAX_CONNECTIONS> connections;
+		std::vector<attribute_t> attributes;
+		Link* link = nullptr;
+		size_t max_connections = CONFIG_BT_NIMBLE_MAX_CONNECTIONS;
+		size_t acl_buffers = 24;  // CONFIG_BT_NIMBLE_ACL_BUF_COUNT
+		size_t in_flight = 0;
+		stats_t stats{};
+	};
+
+	static std::recursive_mutex& lock() {
+		static std::recursive_mutex m;
+		return m;
+	}
+	static state_t& state() {
+		static state_t s;
+		return s;
+	}
+	static connection_t* find(uint16_t conn_handle) {
+		for (auto& conn : state().connections) {
+			if (conn.used && conn.info.desc.conn_handle == conn_handle) {
+				return &conn;
+			}
+		}
+		return nullptr;
+	}
+	static NimBLEServerCallbacks* server_callbacks() { return state().server ? state().server->callbacks : nullptr; }
+	static NimBLECharacteristic* find_characteristic(uint16_t handle, bool& cccd) {
+		if (!state().server) {
+			return nullptr;
+		}
+		for (auto* s : state().server->services) {
+			for (auto* c : s->characteristics) {
+				if (c->handle == handle) {
+					cccd = false;
+					return c;
+				}
+				if ((c->properties & (NIMBLE_PROPERTY::NOTIFY | NIMBLE_PROPERTY::INDICATE)) && c->handle + 1 == handle) {
+					cccd = true;
+					return c;
+				}
+			}
+		}
+		return nullptr;
+	}
+	static bool can_connect() { return get_connection_count() < state().max_connections; }
+
+	static void build_attributes();
+	static bool notify(const NimBLECharacteristic& c, const uint8_t* data, size_t size, uint16_t conn_handle);
+	static bool terminate(uint16_t conn_handle, uint8_t reason);
+	static bool request_conn_params(uint16_t conn_handle, uint16_t max_interval, uint16_t latency, uint16_t timeout);
+};
+
+inline int
+ble_gap_conn_find(uint16_t handle, ble_gap_conn_desc* out_desc) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto* conn = NimBLEHost::find(handle);
+	if (!conn) {
+		return BLE_HS_ENOTCONN;
+	}
+	if (out_desc) {
+		*out_desc = conn->info.desc;
+	}
+	return 0;
+}
+
+// NimBLEDevice
+
+inline bool
+NimBLEDevice::init(const std::string&) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	NimBLEHost::state().initialized = true;
+	return true;
+}
+
+inline bool
+NimBLEDevice::deinit(bool clearAll) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& s = NimBLEHost::state();
+	if (clearAll) {
+		delete s.server;
+		s.server = nullptr;
+		delete s.advertising;
+		s.advertising = nullptr;
+		s.white_list.clear();
+		s.attributes.clear();
+		s.mtu = 255;
+	}
+	s.connections = {};
+	s.in_flight = 0;
+	s.initialized = false;
+	return true;
+}
+
+inline bool
+NimBLEDevice::isInitialized() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return NimBLEHost::state().initialized;
+}
+
+inline bool
+NimBLEDevice::setOwnAddrType(uint8_t type) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	NimBLEHost::state().own_addr_type = type;
+	return true;
+}
+
+inline bool
+NimBLEDevice::setOwnAddr(const NimBLEAddress& addr) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	// a random static address has the two most significant bits set
+	if (addr.getType() == BLE_ADDR_RANDOM && (addr.getVal()[5] & 0xc0) != 0xc0) {
+		return false;
+	}
+	NimBLEHost::state().address = addr;
+	return true;
+}
+
+inline NimBLEAddress
+NimBLEDevice::getAddress() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return NimBLEHost::state().address;
+}
+
+inline NimBLEServer*
+NimBLEDevice::createServer() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& s = NimBLEHost::state();
+	if (!s.server) {
+		s.server = new NimBLEServer();
+	}
+	return s.server;
+}
+
+inline NimBLEServer*
+NimBLEDevice::getServer() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return NimBLEHost::state().server;
+}
+
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+inline NimBLEExtAdvertising*
+NimBLEDevice::getAdvertising() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& s = NimBLEHost::state();
+	if (!s.advertising) {
+		s.advertising = new NimBLEExtAdvertising();
+	}
+	return s.advertising;
+}
+#else
+inline NimBLEAdvertising*
+NimBLEDevice::getAdvertising() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& s = NimBLEHost::state();
+	if (!s.advertising) {
+		s.advertising = new NimBLEAdvertising();
+	}
+	return s.advertising;
+}
+#endif
+
+inline bool
+NimBLEDevice::setMTU(uint16_t mtu) {
+	if (mtu < BLE_ATT_MTU_DFLT || mtu > BLE_ATT_MTU_MAX) {
+		return false;
+	}
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	NimBLEHost::state().mtu = mtu;
+	return true;
+}
+
+inline uint16_t
+NimBLEDevice::getMTU() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return NimBLEHost::state().mtu;
+}
+
+inline bool
+NimBLEDevice::whiteListAdd(const NimBLEAddress& address) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& list = NimBLEHost::state().white_list;
+	if (std::find(list.begin(), list.end(), address) == list.end()) {
+		list.push_back(address);
+	}
+	return true;
+}
+
+inline bool
+NimBLEDevice::whiteListRemove(const NimBLEAddress& address) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& list = NimBLEHost::state().white_list;
+	list.erase(std::remove(list.begin(), list.end(), address), list.end());
+	return true;
+}
+
+inline bool
+NimBLEDevice::onWhiteList(const NimBLEAddress& address) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto& list = NimBLEHost::state().white_list;
+	return std::find(list.begin(), list.end(), address) != list.end();
+}
+
+inline size_t
+NimBLEDevice::getWhiteListCount() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return NimBLEHost::state().white_list.size();
+}
+
+// NimBLEServer
+
+inline bool
+NimBLEServer::start() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	if (!started) {
+		started = true;
+		NimBLEHost::build_attributes();
+	}
+	return true;
+}
+
+inline bool
+NimBLEServer::disconnect(uint16_t connHandle, uint8_t reason) const {
+	return NimBLEHost::terminate(connHandle, reason);
+}
+
+inline NimBLEConnInfo
+NimBLEServer::getPeerInfoByHandle(uint16_t connHandle) const {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	auto* conn = NimBLEHost::find(connHandle);
+	return conn ? conn->info : NimBLEConnInfo{};
+}
+
+inline size_t
+NimBLEServer::getConnectedCount() const {
+	return NimBLEHost::get_connection_count();
+}
+
+inline bool
+NimBLEServer::updateConnParams(uint16_t connHandle, uint16_t, uint16_t maxInterval, uint16_t latency, uint16_t timeout) const {
+	return NimBLEHost::request_conn_params(connHandle, maxInterval, latency, timeout);
+}
+
+inline void
+NimBLEServer::setDataLen(uint16_t, uint16_t) const {}
+
+// NimBLECharacteristic
+
+inline bool
+NimBLECharacteristic::notify(const uint8_t* data, size_t length, uint16_t connHandle) const {
+	return NimBLEHost::notify(*this, data, length, connHandle);
+}
+
+// advertising
+
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+
+inline bool
+NimBLEExtAdvertising::setInstanceData(uint8_t inst_id, NimBLEExtAdvertisement& adv) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	if (inst_id >= instances.size() || instances[inst_id].active) {
+		return false;
+	}
+	instances[inst_id].data = adv;
+	instances[inst_id].configured = true;
+	return true;
+}
+
+inline bool
+NimBLEExtAdvertising::setScanResponseData(uint8_t inst_id, NimBLEExtAdvertisement& data) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	if (inst_id >= instances.size()) {
+		return false;
+	}
+	instances[inst_id].scan_response = data;
+	return true;
+}
+
+inline bool
+NimBLEExtAdvertising::start(uint8_t inst_id, int, int) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	if (inst_id >= instances.size() || !instances[inst_id].configured) {
+		return false;
+	}
+	// connectable advertising needs a free connection
+	if (instances[inst_id].data.connectable && !NimBLEHost::can_connect()) {
+		return false;
+	}
+	instances[inst_id].active = true;
+	return true;
+}
+
+inline bool
+NimBLEExtAdvertising::stop(uint8_t inst_id) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	if (inst_id >= instances.size()) {
+		return false;
+	}
+	instances[inst_id].active = false;
+	return true;
+}
+
+inline bool
+NimBLEExtAdvertising::stop() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	for (auto& instance : instances) {
+		instance.active = false;
+	}
+	return true;
+}
+
+inline bool
+NimBLEExtAdvertising::isActive(uint8_t inst_id) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return inst_id < instances.size() && instances[inst_id].active;
+}
+
+inline bool
+NimBLEExtAdvertising::isAdvertising() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return std::any_of(instances.begin(), instances.end(), [](const auto& instance) { return instance.active; });
+}
+
+#else
+
+inline bool
+NimBLEAdvertising::start(uint32_t, const NimBLEAddress*) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	if (!NimBLEHost::state().initialized) {
+		return false;
+	}
+	if (NimBLEHost::state().server) {
+		NimBLEHost::state().server->start();
+	}
+	// connectable advertising needs a free connection
+	if (!NimBLEHost::can_connect()) {
+		return false;
+	}
+	active = true;
+	return true;
+}
+
+inline bool
+NimBLEAdvertising::stop() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	active = false;
+	return true;
+}
+
+inline bool
+NimBLEAdvertising::isAdvertising() {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	return active;
+}
+
+inline void
+NimBLEAdvertising::setMinInterval(uint16_t interval) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	min_interval = interval;
+}
+
+inline void
+NimBLEAdvertising::setMaxInterval(uint16_t interval) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	max_interval = interval;
+}
+
+inline bool
+NimBLEAdvertising::setAdvertisementData(const NimBLEAdvertisementData& data) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	this->data = data;
+	return true;
+}
+
+inline bool
+NimBLEAdvertising::setScanResponseData(const NimBLEAdvertisementData& data) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	scan_response = data;
+	return true;
+}
+
+inline bool
+NimBLEAdvertising::refreshAdvertisingData() {
+	return true;
+}
+
+inline void
+NimBLEAdvertising::setScanFilter(bool, bool connectWhitelistOnly) {
+	std::lock_guard<std::recursive_mutex> guard{NimBLEHost::lock()};
+	connect_filter = connectWhitelistOnly;
+}
+
+#endif
+
+// NimBLEHost
+
+inline void
+NimBLEHost::build_attributes() {
+	auto& s = state();
+	s.attributes.clear();
+	uint16_t handle = FIRST_HANDLE;
+	for (auto* svc : s.server->services) {
+		svc->handle = handle++;
+		size_t index = s.attributes.size();
+		s.attributes.push_back({svc->handle, 0x2800, svc->uuid, 0, 0});
+		for (auto* c : svc->characteristics) {
+			s.attributes.push_back({handle++, 0x2803, c->uuid, 0, c->properties});
+			c->handle = handle++;
+			s.attributes.push_back({c->handle, 0, c->uuid, 0, c->properties});
+			if (c->properties & (NIMBLE_PROPERTY::NOTIFY | NIMBLE_PROPERTY::INDICATE)) {
+				s.attributes.push_back({handle++, 0x2902, NimBLEUUID{static_cast<uint16_t>(0x2902)}, 0, 0});
+			}
+		}
+		svc->end_handle = handle - 1;
+		s.attributes[index].end_handle = svc->end_handle;
+	}
+	// the group of the last service extends to the end of the handle range
+	for (auto it = s.attributes.rbegin(); it != s.attributes.rend(); ++it) {
+		if (it->type == 0x2800) {
+			it->end_handle = 0xffff;
+			break;
+		}
+	}
+}
+
+inline NimBLEHost::connect_result_t
+NimBLEHost::connect(uint16_t conn_handle, const NimBLEAddress& peer, const NimBLEAddress& target, uint16_t interval) {
+	NimBLEConnInfo info;
+	NimBLEServerCallbacks* callbacks;
+	{
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		auto& s = state();
+		if (find(conn_handle)) {
+			return connect_result_t::handle_in_use;
+		}
+		if (!can_connect()) {
+			++s.stats.refused_connects;
+			return connect_result_t::no_resources;
+		}
+		bool filter = false;
+		bool advertised = false;
+		NimBLEAddress ours = s.address;
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+		if (s.advertising) {
+			for (auto& instance : s.advertising->instances) {
+				auto address = instance.data.address.isNull() ? s.address : instance.data.address;
+				if (instance.active && instance.data.connectable && address == target) {
+					// a connection ends the advertising set
+					instance.active = false;
+					advertised = true;
+					ours = address;
+					break;
+				}
+			}
+		}
+#else
+		if (s.advertising && s.advertising->active && target == s.address) {
+			advertised = true;
+			filter = s.advertising->connect_filter;
+		}
+#endif
+		if (!advertised) {
+			++s.stats.refused_connects;
+			return connect_result_t::not_advertising;
+		}
+		if (filter && std::find(s.white_list.begin(), s.white_list.end(), peer) == s.white_list.end()) {
+			++s.stats.refused_connects;
+			return connect_result_t::filtered;
+		}
+#if !(defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV)
+		s.advertising->active = false;
+#endif
+		auto& conn = *std::find_if(s.connections.begin(), s.connections.end(), [](const auto& c) { return !c.used; });
+		conn = connection_t{};
+		conn.used = true;
+		auto& desc = conn.info.desc;
+		desc.conn_handle = conn_handle;
+		desc.our_id_addr = desc.our_ota_addr = *ours.getBase();
+		desc.peer_id_addr = desc.peer_ota_addr = *peer.getBase();
+		desc.conn_itvl = interval;
+		desc.conn_latency = 0;
+		desc.supervision_timeout = 400;
+		desc.role = 1;  // peripheral
+		++s.stats.connects;
+		info = conn.info;
+		callbacks = server_callbacks();
+	}
+	if (callbacks) {
+		callbacks->onConnect(state().server, info);
+	}
+	return connect_result_t::connected;
+}
+
+inline void
+NimBLEHost::disconnected(uint16_t conn_handle, int reason) {
+	NimBLEConnInfo info;
+	NimBLEServerCallbacks* callbacks;
+	{
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		auto* conn = find(conn_handle);
+		if (!conn) {
+			return;
+		}
+		info = conn->info;
+		state().in_flight -= conn->in_flight;
+		conn->used = false;
+		callbacks = server_callbacks();
+	}
+	if (callbacks) {
+		callbacks->onDisconnect(state().server, info, reason);
+	}
+}
+
+inline uint16_t
+NimBLEHost::exchange_mtu(uint16_t conn_handle, uint16_t mtu) {
+	NimBLEConnInfo info;
+	NimBLEServerCallbacks* callbacks;
+	{
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		auto* conn = find(conn_handle);
+		if (!conn) {
+			return 0;
+		}
+		conn->info.mtu = std::max<uint16_t>(BLE_ATT_MTU_DFLT, std::min(mtu, state().mtu));
+		info = conn->info;
+		callbacks = server_callbacks();
+	}
+	if (callbacks) {
+		callbacks->onMTUChange(info.getMTU(), info);
+	}
+	return info.getMTU();
+}
+
+inline uint8_t
+NimBLEHost::write(uint16_t conn_handle, uint16_t handle, const uint8_t* data, size_t size) {
+	NimBLEConnInfo info;
+	NimBLECharacteristic* c;
+	bool cccd = false;
+	{
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		auto* conn = find(conn_handle);
+		if (!conn) {
+			return BLE_ATT_ERR_INVALID_HANDLE;
+		}
+		c = find_characteristic(handle, cccd);
+		if (!c) {
+			return BLE_ATT_ERR_INVALID_HANDLE;
+		}
+		if (size > static_cast<size_t>(conn->info.mtu - 3) && !cccd) {
+			return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+		}
+		if (cccd) {
+			if (size != 2) {
+				return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+			}
+		} else if (!(c->properties & (NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR))) {
+			return BLE_ATT_ERR_WRITE_NOT_PERMITTED;
+		}
+		++state().stats.writes;
+		info = conn->info;
+	}
+	if (cccd) {
+		c->callbacks->onSubscribe(c, info, static_cast<uint16_t>(data[0] | data[1] << 8));
+	} else {
+		c->writeEvent(data, static_cast<uint16_t>(size), info);
+	}
+	return 0;
+}
+
+inline void
+NimBLEHost::delivered(uint16_t conn_handle) {
+	std::lock_guard<std::recursive_mutex> guard{lock()};
+	if (auto* conn = find(conn_handle); conn && conn->in_flight) {
+		--conn->in_flight;
+		--state().in_flight;
+	}
+}
+
+inline void
+NimBLEHost::conn_params_updated(uint16_t conn_handle, uint16_t interval, uint16_t latency, uint16_t timeout) {
+	NimBLEConnInfo info;
+	NimBLEServerCallbacks* callbacks;
+	{
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		auto* conn = find(conn_handle);
+		if (!conn) {
+			return;
+		}
+		conn->info.desc.conn_itvl = interval;
+		conn->info.desc.conn_latency = latency;
+		conn->info.desc.supervision_timeout = timeout;
+		info = conn->info;
+		callbacks = server_callbacks();
+	}
+	if (callbacks) {
+		callbacks->onConnParamsUpdate(info);
+	}
+}
+
+inline bool
+NimBLEHost::notify(const NimBLECharacteristic& c, const uint8_t* data, size_t size, uint16_t conn_handle) {
+	// as NimBLE: a given handle that is not connected is skipped without error, subscriptions are not checked
+	int rc = 0;
+	bool sent = false;
+	{
+		std::lock_guard<std::recursive_mutex> guard{lock()};
+		auto& s = state();
+		for (auto& conn : s.connections) {
+			if (!conn.used || (conn_handle != BLE_HS_CONN_HANDLE_NONE && conn.info.desc.conn_handle != conn_handle)) {
+				continue;
+			}
+			if (s.in_flight >= s.acl_buffers) {
+				++s.stats.notify_failures;
+				rc = BLE_HS_ENOMEM;
+				continue;
+			}
+			++conn.in_flight;
+			++s.in_flight;
+			++s.stats.notifications;
+			sent = true;
+			if (s.link) {
+				s.link->on_notify(conn.info.desc.conn_handle, data, size);
+			}
+		}
+	}
+	if (sent || rc) {
+		c.callbacks->onStatus(const_cast<NimBLECharacteristic*>(&c), rc);
+	}
+	return rc == 0;
+}
+
+inline bool
+NimBLEHost::terminate(uint16_t conn_handle, uint8_t reason) {
+	std::lock_guard<std::recursive_mutex> guard{lock()};
+	auto* conn = find(conn_handle);
+	if (!conn || conn->terminating) {
+		// BLE_HS_ENOTCONN / BLE_HS_EALREADY are not errors to NimBLEServer::disconnect()
+		return true;
+	}
+	conn->terminating = true;
+	++state().stats.terminations;
+	if (state().link) {
+		state().link->on_terminate(conn_handle, reason);
+	}
+	return true;
+}
+
+inline bool
+NimBLEHost::request_conn_params(uint16_t conn_handle, uint16_t max_interval, uint16_t latency, uint16_t timeout) {
+	std::lock_guard<std::recursive_mutex> guard{lock()};
+	if (!find(conn_handle)) {
+		return false;
+	}
+	if (state().link) {
+		state().link->on_conn_params(conn_handle, max_interval, latency, timeout);
+	}
+	return true;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+/*
+ * Host stand-in for esp_timer_get_time(), also the tick source of the FreeRTOS stand-in.
+ *
+ * Runs on the monotonic clock from the first call. A simulation can switch to virtual time with host_clock::set_us(),
+ * then the clock only moves when it is set again.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace host_clock {
+
+inline std::atomic<int64_t> virtual_us{-1};
+
+inline int64_t
+real_us() {
+	static const auto started = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+}
+
+/// @brief Use virtual time, starting at us.
+inline void
+set_us(int64_t us) {
+	virtual_us.store(us, std::memory_order_relaxed);
+}
+
+/// @brief Back to the monotonic clock.
+inline void
+use_real_time() {
+	virtual_us.store(-1, std::memory_order_relaxed);
+}
+
+inline int64_t
+now_us() {
+	auto v = virtual_us.load(std::memory_order_relaxed);
+	return v >= 0 ? v : real_us();
+}
+
+}  // namespace host_clock
+
+inline int64_t
+esp_timer_get_time() {
+	return host_clock::now_us();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * Host stand-in for the FreeRTOS types used by libsesame3bt-server: ticks are milliseconds of esp_timer_get_time(),
+ * tasks are std::threads and semaphores are built on std::mutex / std::condition_variable.
+ */
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include "../esp_timer.h"
+
+using BaseType_t = int;
+using UBaseType_t = unsigned int;
+using TickType_t = uint32_t;
+using StackType_t = uint8_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portMAX_DELAY static_cast<TickType_t>(0xffffffffu)
+#define configTICK_RATE_HZ 1000
+#define pdMS_TO_TICKS(ms) static_cast<TickType_t>(ms)
+#define tskIDLE_PRIORITY 0u
+
+/// Task control block, the handle of a thread (created or not by xTaskCreateStatic()).
+struct StaticTask_t {
+	const char* name = nullptr;
+};
+using TaskHandle_t = StaticTask_t*;
+using TaskFunction_t = void (*)(void*);
+
+/// Mutex, recursive mutex or binary semaphore.
+struct StaticSemaphore_t {
+	std::mutex lock;
+	std::condition_variable available;
+	UBaseType_t count = 0;
+	UBaseType_t max_count = 1;
+	TaskHandle_t holder = nullptr;
+	UBaseType_t depth = 0;
+	bool is_mutex = false;
+	bool is_recursive = false;
+};
+using SemaphoreHandle_t = StaticSemaphore_t*;
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include "FreeRTOS.h"
+#include "task.h"
+
+namespace freertos_host {
+
+inline SemaphoreHandle_t
+create(StaticSemaphore_t* buffer, UBaseType_t count, bool is_mutex, bool is_recursive) {
+	std::lock_guard<std::mutex> guard{buffer->lock};
+	buffer->count = count;
+	buffer->max_count = 1;
+	buffer->holder = nullptr;
+	buffer->depth = 0;
+	buffer->is_mutex = is_mutex;
+	buffer->is_recursive = is_recursive;
+	return buffer;
+}
+
+inline BaseType_t
+take(SemaphoreHandle_t sem, TickType_t ticks) {
+	auto self = xTaskGetCurrentTaskHandle();
+	std::unique_lock<std::mutex> guard{sem->lock};
+	if (sem->is_recursive && sem->holder == self) {
+		++sem->depth;
+		return pdTRUE;
+	}
+	auto ready = [sem] { return sem->count > 0; };
+	if (ticks == portMAX_DELAY) {
+		sem->available.wait(guard, ready);
+	} else if (!sem->available.wait_for(guard, std::chrono::milliseconds(ticks), ready)) {
+		return pdFALSE;
+	}
+	--sem->count;
+	if (sem->is_mutex) {
+		sem->holder = self;
+		sem->depth = 1;
+	}
+	return pdTRUE;
+}
+
+inline BaseType_t
+give(SemaphoreHandle_t sem) {
+	std::lock_guard<std::mutex> guard{sem->lock};
+	if (sem->is_mutex) {
+		if (sem->holder != xTaskGetCurrentTaskHandle()) {
+			return pdFALSE;
+		}
+		if (--sem->depth > 0) {
+			return pdTRUE;
+		}
+		sem->holder = nullptr;
+	} else if (sem->count >= sem->max_count) {
+		return pdFALSE;
+	}
+	++sem->count;
+	sem->available.notify_one();
+	return pdTRUE;
+}
+
+}  // namespace freertos_host
+
+inline SemaphoreHandle_t
+xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer) {
+	return freertos_host::create(buffer, 1, true, false);
+}
+
+inline SemaphoreHandle_t
+xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* buffer) {
+	return freertos_host::create(buffer, 1, true, true);
+}
+
+inline SemaphoreHandle_t
+xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer) {
+	return freertos_host::create(buffer, 0, false, false);
+}
+
+inline BaseType_t
+xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+	return freertos_host::take(sem, ticks);
+}
+
+inline BaseType_t
+xSemaphoreGive(SemaphoreHandle_t sem) {
+	return freertos_host::give(sem);
+}
+
+inline BaseType_t
+xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks) {
+	return freertos_host::take(sem, ticks);
+}
+
+inline BaseType_t
+xSemaphoreGiveRecursive(SemaphoreHandle_t sem) {
+	return freertos_host::give(sem);
+}
+
+inline TaskHandle_t
+xSemaphoreGetMutexHolder(SemaphoreHandle_t sem) {
+	std::lock_guard<std::mutex> guard{sem->lock};
+	return sem->holder;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include "FreeRTOS.h"
+
+inline TaskHandle_t
+xTaskGetCurrentTaskHandle() {
+	thread_local StaticTask_t current;
+	return &current;
+}
+
+inline TickType_t
+xTaskGetTickCount() {
+	return static_cast<TickType_t>(esp_timer_get_time() / 1000);
+}
+
+inline void
+vTaskDelay(TickType_t ticks) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+/// The task runs on a detached thread; stack and priority are ignored, the handle is the given buffer.
+inline TaskHandle_t
+xTaskCreateStatic(TaskFunction_t task,
+                  const char* name,
+                  uint32_t /* stack_depth */,
+                  void* param,
+                  UBaseType_t /* priority */,
+                  StackType_t* /* stack */,
+                  StaticTask_t* buffer) {
+	buffer->name = name;
+	std::thread{task, param}.detach();
+	return buffer;
+}
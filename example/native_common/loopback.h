@@ -0,0 +1,595 @@
+#pragma once
+
+/*
+ * In-process loopback between SesameServer / MultiSesameServer and SesameClientCore based centrals.
+ *
+ * The servers run unchanged on the NimBLE host stand-in in native_common/host: Link plays the air and the controller,
+ * LoopbackCentral a Remote / Touch that connects, discovers the service, subscribes and writes through NimBLEHost, so
+ * the server's own callbacks (onConnect / onSubscribe / RX writeEvent / onStatus / onDisconnect) handle everything.
+ * Delivery is deferred to Link::pump() so that neither side is re-entered from inside its own callbacks.
+ */
+
+#include <NimBLEDevice.h>
+#include <SesameServer.h>
+#include <esp_timer.h>
+#include <libsesame3bt/BLEBackend.h>
+#include <libsesame3bt/ClientCore.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace loopback {
+
+using libsesame3bt::Sesame;
+namespace core = libsesame3bt::core;
+using clock = std::chrono::steady_clock;
+
+// Disconnect reasons as NimBLE reports them (BLE_HS_ERR_HCI_BASE + HCI error code)
+constexpr int REASON_REMOTE_TERM = BLE_HS_ERR_HCI_BASE + BLE_ERR_REM_USER_CONN_TERM;
+constexpr int REASON_LOCAL_TERM = BLE_HS_ERR_HCI_BASE + BLE_ERR_CONN_TERM_LOCAL;
+
+// Identity used by the native tools (string order, as printed on the device)
+constexpr uint8_t demo_uuid[16] = {0x4a, 0x7d, 0x2f, 0x10, 0x93, 0x6e, 0x4b, 0x1c, 0x8d, 0x5a, 0x21, 0x33, 0xc4, 0x07, 0x9e, 0x61};
+
+inline std::array<std::byte, Sesame::SECRET_SIZE>
+demo_secret() {
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	for (size_t i = 0; i < secret.size(); i++) {
+		secret[i] = static_cast<std::byte>(0xa0 + i);
+	}
+	return secret;
+}
+
+/// @brief NimBLEUUID (little-endian) of a UUID in string order.
+inline NimBLEUUID
+to_nimble_uuid(const uint8_t (&uuid)[16]) {
+	NimBLEUUID r{uuid, sizeof(uuid)};
+	r.reverseByteOrder();
+	return r;
+}
+
+inline uint64_t
+now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+}
+
+/// @brief Latency samples in nanoseconds with percentile summary.
+class LatencyRecorder {
+ public:
+	void add(uint64_t ns) { samples.push_back(ns); }
+	void reserve(size_t n) { samples.reserve(n); }
+	size_t count() const { return samples.size(); }
+	uint64_t at(size_t i) const { return samples[i]; }
+	uint64_t total_ns() const {
+		uint64_t total = 0;
+		for (auto s : samples) {
+			total += s;
+		}
+		return total;
+	}
+	void clear() { samples.clear(); }
+	double percentile_us(double p) {
+		if (samples.empty()) {
+			return 0;
+		}
+		std::sort(samples.begin(), samples.end());
+		size_t idx = std::min(samples.size() - 1, static_cast<size_t>(p / 100.0 * samples.size()));
+		return samples[idx] / 1000.0;
+	}
+	void print(const char* name) {
+		std::printf("%-22s n=%-8zu p50=%9.2fus p99=%9.2fus max=%9.2fus\n", name, count(), percentile_us(50), percentile_us(99),
+		            percentile_us(100));
+	}
+
+ private:
+	std::vector<uint64_t> samples;
+};
+
+/**
+ * @brief Handles and round trips of a GATT discovery of the SESAME service.
+ *
+ * Walks the server's attribute table with the ATT procedures a central uses (Find By Type Value, Read By Type,
+ * Find Information), one request per response packed at the ATT MTU.
+ */
+struct gatt_discovery_t {
+	uint16_t rx = 0;       ///< value handle written by the central (Sesame::TxUUID)
+	uint16_t tx_cccd = 0;  ///< CCCD of the notified characteristic (Sesame::RxUUID)
+	size_t round_trips = 0;
+};
+
+inline gatt_discovery_t
+discover_sesame_service(uint16_t mtu = BLE_ATT_MTU_DFLT) {
+	auto attrs = NimBLEHost::get_attributes();
+	gatt_discovery_t result;
+	NimBLEUUID service_uuid{Sesame::SESAME3_SRV_UUID};
+	// Discover Primary Service by UUID: (start, end) pairs of 4 bytes, until the group ending at 0xffff or none left
+	uint16_t start = 0;
+	uint16_t end = 0;
+	for (uint32_t from = 1; from <= 0xffff;) {
+		++result.round_trips;
+		size_t found = 0;
+		uint16_t last_end = 0;
+		for (const auto& a : attrs) {
+			if (a.handle < from || a.type != 0x2800 || a.uuid != service_uuid) {
+				continue;
+			}
+			if (found == static_cast<size_t>(mtu - 1) / 4) {
+				break;
+			}
+			if (!start) {
+				start = a.handle;
+				end = a.end_handle;
+			}
+			++found;
+			last_end = a.end_handle;
+		}
+		if (!found || last_end == 0xffff) {
+			break;
+		}
+		from = last_end + 1;
+	}
+	if (!start) {
+		return result;
+	}
+	// Discover All Characteristics: Read By Type of the declarations, entries of one length per response
+	struct characteristic_t {
+		uint16_t decl;
+		NimBLEUUID uuid;
+	};
+	std::vector<characteristic_t> characteristics;
+	for (uint32_t from = start; from <= end;) {
+		++result.round_trips;
+		size_t found = 0;
+		size_t length = 0;
+		uint16_t last = 0;
+		for (const auto& a : attrs) {
+			if (a.handle < from || a.handle > end || a.type != 0x2803) {
+				continue;
+			}
+			size_t l = 2 + 3 + (a.uuid.bitSize() == 16 ? 2 : 16);
+			if ((found && l != length) || found == (mtu - 2) / l) {
+				break;
+			}
+			length = l;
+			++found;
+			last = a.handle;
+			characteristics.push_back({a.handle, a.uuid});
+		}
+		if (!found) {
+			break;
+		}
+		from = last + 1;
+	}
+	// Discover descriptors of the notified characteristic: Find Information, 4 byte entries
+	for (size_t i = 0; i < characteristics.size(); i++) {
+		uint16_t value = characteristics[i].decl + 1;
+		if (characteristics[i].uuid == NimBLEUUID{Sesame::TxUUID}) {
+			result.rx = value;
+		}
+		if (characteristics[i].uuid != NimBLEUUID{Sesame::RxUUID}) {
+			continue;
+		}
+		uint16_t range_end = i + 1 < characteristics.size() ? characteristics[i + 1].decl - 1 : end;
+		for (uint32_t from = value + 1; from <= range_end;) {
+			++result.round_trips;
+			size_t found = 0;
+			uint16_t last = 0;
+			for (const auto& a : attrs) {
+				if (a.handle < from || a.handle > range_end) {
+					continue;
+				}
+				if (found == static_cast<size_t>(mtu - 2) / 4) {
+					break;
+				}
+				if (a.type == 0x2902) {
+					result.tx_cccd = a.handle;
+				}
+				++found;
+				last = a.handle;
+			}
+			if (!found || last == range_end) {
+				break;
+			}
+			from = last + 1;
+		}
+	}
+	return result;
+}
+
+class LoopbackCentral;
+
+/**
+ * @brief The air between the server and the centrals: queues what either side sends until pump().
+ *
+ * Construct before the server's begin() and destroy after the server: the destructor resets the NimBLE stand-in.
+ * The server may notify from any task, pump() runs on the thread playing the NimBLE host task.
+ */
+class Link : public NimBLEHost::Link {
+ public:
+	Link() { NimBLEHost::set_link(this); }
+	Link(const Link&) = delete;
+	~Link() {
+		NimBLEHost::set_link(nullptr);
+		NimBLEDevice::deinit(true);
+	}
+
+	void attach(uint16_t conn_handle, LoopbackCentral* central) {
+		std::lock_guard<std::mutex> guard{lock};
+		if (central) {
+			centrals[conn_handle] = central;
+		} else {
+			centrals.erase(conn_handle);
+		}
+	}
+	/// Central writes to an attribute of the server.
+	void write(uint16_t conn_handle, uint16_t handle, const uint8_t* data, size_t size) {
+		push({kind_t::write, conn_handle, handle, {data, data + size}, 0, 0, 0});
+	}
+	/// Central terminates the connection.
+	void terminate(uint16_t conn_handle) { push({kind_t::remote_terminate, conn_handle, 0, {}, 0, 0, 0}); }
+	size_t pump();
+
+	/// @brief Count heap allocations of the server side (not the link or the centrals) in server_allocations.
+	void set_allocation_counter(size_t (*counter)()) { alloc_count = counter; }
+	/// @brief Run f (a call into the server) and add its heap allocations to server_allocations.
+	template <typename F>
+	void account(F&& f) {
+		if (!alloc_count) {
+			f();
+			return;
+		}
+		auto before = alloc_count();
+		auto excluded = link_allocations;
+		f();
+		server_allocations += alloc_count() - before - (link_allocations - excluded);
+	}
+	/// @brief Called by the application handler when the server passes it a command.
+	void on_command() {
+		if (auto started = write_started.load()) {
+			auto now = now_ns();
+			command_seen = now;
+			link_side([&] { write_to_command.add(now - started); });
+		}
+	}
+
+	LatencyRecorder write_to_command;
+	LatencyRecorder command_to_reply;
+	LatencyRecorder write_to_reply;
+	/// time the server spends in an RX write (decode, decrypt, command handling, reply)
+	LatencyRecorder write_cost;
+	size_t writes = 0;
+	size_t rx_bytes = 0;
+	size_t notifications = 0;
+	/// segments of different frames interleaved on a connection, or continuations without a frame
+	size_t framing_errors = 0;
+	/// heap allocations by the server side, see set_allocation_counter()
+	size_t server_allocations = 0;
+
+ private:
+	enum class kind_t : uint8_t { write, notify, local_terminate, remote_terminate, conn_params };
+	struct packet_t {
+		kind_t kind;
+		uint16_t conn_handle;
+		uint16_t handle;
+		std::vector<uint8_t> data;
+		uint16_t interval;
+		uint16_t latency;
+		uint16_t timeout;
+	};
+
+	std::mutex lock;
+	std::deque<packet_t> queue;
+	std::map<uint16_t, LoopbackCentral*> centrals;
+	std::map<uint16_t, bool> frame_open;
+	size_t (*alloc_count)() = nullptr;
+	size_t link_allocations = 0;
+	// set by pump() and on_command() on the host side, read by on_notify() from any task
+	std::atomic<uint16_t> writing{BLE_HS_CONN_HANDLE_NONE};
+	std::atomic<uint64_t> write_started{0};
+	std::atomic<uint64_t> command_seen{0};
+
+	void push(packet_t&& pkt) {
+		std::lock_guard<std::mutex> guard{lock};
+		link_side([&] { queue.push_back(std::move(pkt)); });
+	}
+	bool pop(packet_t& pkt) {
+		std::lock_guard<std::mutex> guard{lock};
+		if (queue.empty()) {
+			return false;
+		}
+		pkt = std::move(queue.front());
+		queue.pop_front();
+		return true;
+	}
+	LoopbackCentral* find(uint16_t conn_handle) {
+		std::lock_guard<std::mutex> guard{lock};
+		auto it = centrals.find(conn_handle);
+		return it != centrals.end() ? it->second : nullptr;
+	}
+	void check_framing(uint16_t conn_handle, const uint8_t* data, size_t size) {
+		if (!size) {
+			return;
+		}
+		bool start = data[0] & 1;
+		bool last = (data[0] >> 1) != 0;
+		auto& open = frame_open[conn_handle];
+		if (start == open) {
+			++framing_errors;
+		}
+		open = !last;
+	}
+
+	/// Run f on the link side: its heap allocations are not the server's.
+	template <typename F>
+	void link_side(F&& f) {
+		auto before = alloc_count ? alloc_count() : 0;
+		f();
+		if (alloc_count) {
+			link_allocations += alloc_count() - before;
+		}
+	}
+
+	// NimBLEHost::Link, called with the host lock held
+	virtual void on_notify(uint16_t conn_handle, const uint8_t* data, size_t size) override {
+		std::lock_guard<std::mutex> guard{lock};
+		link_side([&] {
+			check_framing(conn_handle, data, size);
+			queue.push_back({kind_t::notify, conn_handle, 0, {data, data + size}, 0, 0, 0});
+			auto seen = command_seen.load();
+			if (seen && conn_handle == writing) {
+				auto now = now_ns();
+				command_to_reply.add(now - seen);
+				write_to_reply.add(now - write_started);
+				command_seen = 0;
+			}
+		});
+	}
+	virtual void on_terminate(uint16_t conn_handle, uint8_t) override {
+		std::lock_guard<std::mutex> guard{lock};
+		link_side([&] { queue.push_back({kind_t::local_terminate, conn_handle, 0, {}, 0, 0, 0}); });
+	}
+	virtual void on_conn_params(uint16_t conn_handle, uint16_t interval, uint16_t latency, uint16_t timeout) override {
+		std::lock_guard<std::mutex> guard{lock};
+		link_side([&] { queue.push_back({kind_t::conn_params, conn_handle, 0, {}, interval, latency, timeout}); });
+	}
+};
+
+/// @brief A virtual Remote / Touch: SesameClientCore talking to the server through the link.
+class LoopbackCentral : private core::SesameBLEBackend {
+ public:
+	/// @param address Own address, derived from conn_handle if null.
+	LoopbackCentral(Link& link, uint16_t conn_handle, const NimBLEAddress& address = {})
+	    : link(link),
+	      conn_handle(conn_handle),
+	      address(address.isNull() ? NimBLEAddress{0xc0de00000000ULL | conn_handle, BLE_ADDR_RANDOM} : address),
+	      core(*this) {}
+	LoopbackCentral(const LoopbackCentral&) = delete;
+	~LoopbackCentral() { link.attach(conn_handle, nullptr); }
+
+	bool begin(Sesame::model_t model, const std::array<std::byte, Sesame::SECRET_SIZE>& secret) {
+		return core.begin(model) && core.set_keys(std::array<std::byte, Sesame::PK_SIZE>{}, secret);
+	}
+	/**
+	 * @brief Connect to target, exchange the MTU (if mtu is given), discover the service (or check the cached
+	 * database, see set_gatt_cache()) and subscribe. The server then starts the login sequence.
+	 */
+	NimBLEHost::connect_result_t connect(const NimBLEAddress& target, uint16_t mtu = 0) {
+		link.attach(conn_handle, this);
+		auto result = NimBLEHost::connect_result_t::connected;
+		link.account([&] { result = NimBLEHost::connect(conn_handle, address, target); });
+		if (result != NimBLEHost::connect_result_t::connected) {
+			link.attach(conn_handle, nullptr);
+			return result;
+		}
+		connected = true;
+		if (mtu) {
+			link.account([&] { this->mtu = NimBLEHost::exchange_mtu(conn_handle, mtu); });
+		}
+		if (gatt_cache && gatt.rx) {
+			// modeled: one Read Using Characteristic UUID of the Database Hash (the stand-in has no GATT service to read)
+			last_discovery_round_trips = 1;
+		} else {
+			gatt = discover_sesame_service(this->mtu);
+			last_discovery_round_trips = gatt.round_trips;
+		}
+		if (!gatt.rx || !gatt.tx_cccd) {
+			std::fprintf(stderr, "SESAME service not found\n");
+			disconnect(REASON_REMOTE_TERM);
+			return result;
+		}
+		static constexpr uint8_t enable[2] = {1, 0};
+		link.account([&] { NimBLEHost::write(conn_handle, gatt.tx_cccd, enable, sizeof(enable)); });
+		return result;
+	}
+	/// @brief Terminate the connection now (the server's onDisconnect() runs before this returns).
+	void disconnect(int reason) {
+		if (!connected) {
+			return;
+		}
+		link.account([&] { NimBLEHost::disconnected(conn_handle, reason); });
+		on_disconnected();
+	}
+	/// @brief Keep the discovered handles across connections. A reconnection counts one round trip for the Database Hash
+	/// read, which is modeled: the hash is not read or compared.
+	void set_gatt_cache(bool enable) { gatt_cache = enable; }
+	/// @brief Count notifications without passing them to the client core, e.g. to keep the session in the login handshake.
+	void set_passive(bool enable) { passive = enable; }
+	/// @brief Send the following writes of the client core to another characteristic than the discovered RX.
+	void set_rx_handle(uint16_t handle) { gatt.rx = handle; }
+	/// @brief Write raw bytes to the RX characteristic (the core's framing is bypassed).
+	void write_raw(const uint8_t* data, size_t size) { link.write(conn_handle, gatt.rx, data, size); }
+	bool lock(std::string_view tag) { return core.lock(tag); }
+	bool unlock(std::string_view tag) { return core.unlock(tag); }
+	bool is_logged_in() const { return connected && core.is_session_active(); }
+	bool is_connected() const { return connected; }
+	uint16_t get_conn_handle() const { return conn_handle; }
+	const NimBLEAddress& get_address() const { return address; }
+	size_t get_received() const { return received; }
+	uint16_t get_mtu() const { return mtu; }
+	/// ATT round trips of the discovery (or cache check) of the last connection
+	size_t get_discovery_round_trips() const { return last_discovery_round_trips; }
+
+	void on_notify(const uint8_t* data, size_t size) {
+		++received;
+		if (passive) {
+			return;
+		}
+		core.on_received(reinterpret_cast<const std::byte*>(data), size);
+	}
+	void on_disconnected() {
+		connected = false;
+		mtu = BLE_ATT_MTU_DFLT;
+		link.attach(conn_handle, nullptr);
+		core.on_disconnected();
+	}
+
+ private:
+	Link& link;
+	uint16_t conn_handle;
+	NimBLEAddress address;
+	core::SesameClientCore core;
+	gatt_discovery_t gatt;
+	bool gatt_cache = false;
+	bool passive = false;
+	bool connected = false;
+	uint16_t mtu = BLE_ATT_MTU_DFLT;
+	size_t received = 0;
+	size_t last_discovery_round_trips = 0;
+
+	virtual bool write_to_tx(const uint8_t* data, size_t size) override {
+		link.write(conn_handle, gatt.rx, data, size);
+		return true;
+	}
+	virtual void disconnect() override { link.terminate(conn_handle); }
+};
+
+inline size_t
+Link::pump() {
+	size_t delivered = 0;
+	packet_t pkt;
+	while (pop(pkt)) {
+		++delivered;
+		auto* central = find(pkt.conn_handle);
+		switch (pkt.kind) {
+			case kind_t::write:
+				if (central) {
+					writing = pkt.conn_handle;
+					command_seen = 0;
+					write_started = now_ns();
+					account([&] { NimBLEHost::write(pkt.conn_handle, pkt.handle, pkt.data.data(), pkt.data.size()); });
+					write_cost.add(now_ns() - write_started.load());
+					writing = BLE_HS_CONN_HANDLE_NONE;
+					write_started = 0;
+					++writes;
+					rx_bytes += pkt.data.size();
+				}
+				break;
+			case kind_t::notify:
+				++notifications;
+				NimBLEHost::delivered(pkt.conn_handle);
+				if (central) {
+					central->on_notify(pkt.data.data(), pkt.data.size());
+				}
+				break;
+			case kind_t::local_terminate:
+			case kind_t::remote_terminate:
+				if (central) {
+					account([&] {
+						NimBLEHost::disconnected(pkt.conn_handle,
+						                         pkt.kind == kind_t::local_terminate ? REASON_LOCAL_TERM : REASON_REMOTE_TERM);
+					});
+					central->on_disconnected();
+				}
+				{
+					std::lock_guard<std::mutex> guard{lock};
+					frame_open.erase(pkt.conn_handle);
+				}
+				break;
+			case kind_t::conn_params:
+				account([&] { NimBLEHost::conn_params_updated(pkt.conn_handle, pkt.interval, pkt.latency, pkt.timeout); });
+				break;
+		}
+	}
+	return delivered;
+}
+
+/// @brief Application side of the server: counts logins and commands, answers commands with the command function.
+class Handler : public libsesame3bt::SesameServerHandler {
+ public:
+	using command_function_t = std::function<Sesame::result_code_t(const libsesame3bt::command_event_t& event)>;
+
+	Handler(Link& link, command_function_t command = nullptr) : link(link), command(command) {}
+
+	virtual void on_login(const NimBLEAddress&) override { ++logins; }
+	virtual void on_registration(const NimBLEAddress&, const std::array<std::byte, Sesame::SECRET_SIZE>&) override {
+		++registrations;
+	}
+	virtual Sesame::result_code_t on_command(const libsesame3bt::command_event_t& event) override {
+		++commands;
+		link.on_command();
+		return command ? command(event) : Sesame::result_code_t::success;
+	}
+
+	size_t logins = 0;
+	size_t registrations = 0;
+	size_t commands = 0;
+
+ private:
+	Link& link;
+	command_function_t command;
+};
+
+#if !LIBSESAME3BT_SERVER_EXT_ADV
+/// @brief Register the server with secret, begin() with the UUID and start advertising, as example/peripheral does.
+inline bool
+start_server(libsesame3bt::SesameServer& server,
+             const std::array<std::byte, Sesame::SECRET_SIZE>& secret,
+             const uint8_t (&uuid)[16] = demo_uuid,
+             Sesame::model_t model = Sesame::model_t::sesame_5) {
+	if (!server.set_registered(secret) || !server.begin(model, to_nimble_uuid(uuid))) {
+		return false;
+	}
+	return server.start_advertising();
+}
+#endif
+
+/// @brief Connect n centrals (conn handles first_handle..first_handle+n-1) to target and run the login sequence.
+/// @return Connected centrals, empty if any of them failed to connect or login.
+inline std::vector<std::unique_ptr<LoopbackCentral>>
+login_centrals(Link& link,
+               const NimBLEAddress& target,
+               size_t n,
+               const std::array<std::byte, Sesame::SECRET_SIZE>& secret,
+               Sesame::model_t model = Sesame::model_t::sesame_5,
+               uint16_t first_handle = 1) {
+	std::vector<std::unique_ptr<LoopbackCentral>> centrals;
+	for (size_t i = 0; i < n; i++) {
+		auto c = std::make_unique<LoopbackCentral>(link, static_cast<uint16_t>(first_handle + i));
+		if (!c->begin(model, secret) || c->connect(target) != NimBLEHost::connect_result_t::connected) {
+			std::fprintf(stderr, "central %zu failed to connect\n", i);
+			return {};
+		}
+		link.pump();
+		centrals.push_back(std::move(c));
+	}
+	for (const auto& c : centrals) {
+		if (!c->is_logged_in()) {
+			std::fprintf(stderr, "central %u failed to login\n", c->get_conn_handle());
+			return {};
+		}
+	}
+	return centrals;
+}
+
+}  // namespace loopback
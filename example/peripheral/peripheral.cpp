@@ -5,7 +5,7 @@
 #include <SesameServer.h>
 #include <libsesame3bt/ClientCore.h>
 #include <libsesame3bt/util.h>
-#include <mutex>
+#include <atomic>
 #if __has_include("mysesame-config.h")
 #include "mysesame-config.h"
 #endif
@@ -51,10 +51,6 @@ SesameServer server{SESAME_SERVER_MAX_SESSIONS};
 
 bool initialized;
 
-std::mutex status_mutex;
-bool status_updated;
-bool status;
-
 namespace {
 
 constexpr size_t UUID_SIZE = 16;
@@ -63,11 +59,39 @@ constexpr size_t UUID_SIZE = 16;
 constexpr const char prefs_name[] = "sesameserver";
 constexpr const char prefs_uuid[] = "uuid";
 constexpr const char prefs_secret[] = "secret";
+// begin()で導出した状態 (アドレス、共有鍵、アドバタイズデータ) の保存先
+constexpr const char prefs_snapshot[] = "snapshot";
+// ログインしたことのあるデバイスのアドレス (接続を受け付けるデバイスのリスト)
+constexpr const char prefs_peers[] = "peers";
+constexpr size_t PEER_RECORD_SIZE = 7;  // アドレス6バイト + アドレスタイプ
+// シリアルから 'e' を受信した際に未知のデバイスからの接続を受け付ける時間
+constexpr uint32_t enrollment_window_ms = 60'000;
 // 起動時にこのPINに接続されているボタンの状態を検査し、押下されていたら未登録状態に初期化する
 constexpr uint8_t reset_button_pin = 41;
 
 }  // namespace
 
+/*
+ * SESAME_SERVER_UUIDが未設定の場合はNVSに書き込まれたUUIDを使う
+ * (example/provision で量産用に作成したNVSイメージを書き込んだ場合)
+ */
+bool
+load_provisioned_uuid() {
+	if (my_uuid.bitSize() == 128) {
+		return true;
+	}
+	Preferences prefs{};
+	if (!prefs.begin(prefs_name, true)) {
+		return false;
+	}
+	uint8_t stored[UUID_SIZE];
+	if (prefs.getBytes(prefs_uuid, stored, sizeof(stored)) != UUID_SIZE) {
+		return false;
+	}
+	my_uuid = NimBLEUUID{stored, sizeof(stored)};
+	return true;
+}
+
 /*
  * NVSに保存してある共有鍵をロードする
  * 共有鍵がない場合は未登録デバイスとしてふるまう
@@ -102,6 +126,22 @@ prepare_secret() {
 #endif
 }
 
+/*
+ * 次回起動時にbegin_from_snapshot()で使う状態を保存する
+ */
+void
+save_snapshot() {
+	libsesame3bt::server_snapshot_t snapshot;
+	if (!server.make_snapshot(snapshot)) {
+		Serial.println("Failed to make snapshot");
+		return;
+	}
+	Preferences prefs{};
+	if (!prefs.begin(prefs_name) || prefs.putBytes(prefs_snapshot, &snapshot, sizeof(snapshot)) != sizeof(snapshot)) {
+		Serial.println("Failed to store snapshot");
+	}
+}
+
 /*
  * スマホで登録処理が完了した際のコールバック
  */
@@ -122,45 +162,99 @@ on_registration(const NimBLEAddress& addr, const std::array<std::byte, Sesame::S
 		return;
 	}
 	Serial.println("Secret stored");
+	// 以前の登録でログインしたデバイスは新しい共有鍵ではログインできない
+	prefs.remove(prefs_peers);
+	save_snapshot();
+}
+
+// 受付リストの変更があり、NVSへの保存が必要
+std::atomic<bool> known_peers_changed;
+
+/*
+ * 接続を受け付けるデバイスのリストが変化した際のコールバック
+ * BLEタスクから呼ばれるため、NVSへの書き込みはloop()で行う
+ */
+void
+on_known_peers_changed(const NimBLEAddress& addr, bool added) {
+	Serial.printf("%s %s\n", added ? "learned" : "forgot", addr.toString().c_str());
+	known_peers_changed = true;
+}
+
+/*
+ * 接続を受け付けるデバイスのリスト全体をNVSに保存する
+ */
+void
+save_known_peers() {
+	NimBLEAddress peers[LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE];
+	uint8_t records[LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE][PEER_RECORD_SIZE];
+	size_t count = server.get_known_peers(peers, LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE);
+	for (size_t i = 0; i < count; i++) {
+		std::copy(peers[i].getVal(), peers[i].getVal() + 6, records[i]);
+		records[i][6] = peers[i].getType();
+	}
+	Preferences prefs{};
+	if (!prefs.begin(prefs_name) || prefs.putBytes(prefs_peers, records, count * PEER_RECORD_SIZE) != count * PEER_RECORD_SIZE) {
+		Serial.println("Failed to store known peers");
+	}
+}
+
+/*
+ * 登録済みの場合、ログインしたことのあるデバイスからの接続のみを受け付ける
+ * 新しいRemote / Touchを追加する場合やスマホから接続する場合は、シリアルから 'e' を送信して受付期間を開く
+ */
+void
+enable_accept_list() {
+	if (!server.enable_accept_list(on_known_peers_changed)) {
+		Serial.println("Failed to enable accept list");
+		return;
+	}
+	if (!server.is_registered()) {
+		return;
+	}
+	Preferences prefs{};
+	if (!prefs.begin(prefs_name, true)) {
+		return;
+	}
+	uint8_t records[LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE][PEER_RECORD_SIZE];
+	size_t count = prefs.getBytes(prefs_peers, records, sizeof(records)) / PEER_RECORD_SIZE;
+	for (size_t i = 0; i < count; i++) {
+		server.add_known_peer(NimBLEAddress{records[i], records[i][6]});
+	}
+	Serial.printf("%u known peers restored\n", static_cast<unsigned>(count));
 }
 
 /*
- * Remote / Remote nano / Open Sensorからのコマンド受信時コールバック
+ * Remote / Remote nano / Open Sensorからのコマンド受信時の処理
+ * BLEタスクではなくloop()から呼ばれる (コマンドへの応答は送信済み)
  */
-Sesame::result_code_t
-on_command(NimBLEAddress addr,
-           Sesame::item_code_t cmd,
-           const std::string& tag,
-           std::optional<libsesame3bt::history_tag_type_t> trigger_type,
-           float scaled_voltage) {
+void
+on_command(const libsesame3bt::server_event_t& event) {
+	auto cmd = event.cmd;
+	auto scaled_voltage = event.scaled_voltage;
+	std::string tag{event.tag()};
 	Serial.printf(
 	    "receive command = %u (%s: %s) from %s, svolt=%s, pct=%s, pct(opensensor)=%s\n", static_cast<uint8_t>(cmd),
-	    trigger_type.has_value() ? std::to_string(static_cast<uint8_t>(*trigger_type)).c_str() : "str", tag.c_str(),
-	    addr.toString().c_str(), isnan(scaled_voltage) ? "N/A" : String(scaled_voltage, 2).c_str(),
+	    event.trigger_type.has_value() ? std::to_string(static_cast<uint8_t>(*event.trigger_type)).c_str() : "str", tag.c_str(),
+	    event.address.toString().c_str(), isnan(scaled_voltage) ? "N/A" : String(scaled_voltage, 2).c_str(),
 	    isnan(scaled_voltage) ? "N/A" : String(Status::scaled_voltage_to_pct(scaled_voltage, Sesame::model_t::sesame_5), 2).c_str(),
 	    isnan(scaled_voltage) ? "N/A"
 	                          : String(Status::scaled_voltage_to_pct(scaled_voltage, Sesame::model_t::open_sensor_1), 2).c_str());
 	if (cmd == Sesame::item_code_t::lock || cmd == Sesame::item_code_t::unlock) {
-		std::lock_guard<std::mutex> lock(status_mutex);
-		status = cmd == Sesame::item_code_t::lock;
-		status_updated = true;
+		server.send_lock_status(cmd == Sesame::item_code_t::lock);
 	}
-	return Sesame::result_code_t::success;
 }
 
-void
-setup() {
-	delay(5000);
-	Serial.begin(115200);
-
-	if (!prepare_secret()) {
-		return;
-	}
-	Serial.printf("my uuid = %s\n", my_uuid.toString().c_str());
-	if (!server.is_registered()) {
-		server.set_on_registration_callback(on_registration);
+/*
+ * begin() / begin_from_snapshot() の前に行う設定
+ */
+bool
+configure_server() {
+	server.set_on_registration_callback(on_registration);
+	// コマンドはイベントキュー経由でloop()で受け取る (コマンドコールバック未設定時はsuccessを応答する)
+	if (!server.enable_event_queue()) {
+		Serial.println("Failed to enable event queue");
+		return false;
 	}
-	server.set_on_command_callback(on_command);
 	// ログイン完了時にmecha_statusを送信するコールバックを設定
 	server.set_on_login_callback([](const NimBLEAddress& addr) {
 		Serial.printf("login from: %s, sending mecha_status\n", addr.toString().c_str());
@@ -170,18 +264,79 @@ setup() {
 	});
 	// 上記のon_loginコールバックでmecha_statusを送信するため、mecha_statusの自動送信は無効にする
 	server.set_auto_send_flags(libsesame3bt::auto_send::flags::mecha_setting);
-	if (!server.begin(Sesame::model_t::sesame_5, my_uuid)) {
-		Serial.println("initialization failed");
+	// 短時間に連続した状態変化は50ms単位でまとめ、同一セッションへの送信は200ms以上の間隔をあける
+	server.set_status_coalescing(50, 200);
+	return true;
+}
+
+/*
+ * スナップショットから起動する (UUIDとBLEアドレスの計算、アドバタイズデータの生成、NVSの個別読み出しを省略)
+ * 初期化ボタンが押されている場合はスナップショットを削除して通常の起動を行う
+ */
+bool
+boot_from_snapshot() {
+#ifdef SESAME_SERVER_SECRET
+	return false;
+#else
+	Preferences prefs{};
+	if (!prefs.begin(prefs_name)) {
+		return false;
+	}
+	if (digitalRead(reset_button_pin) == LOW) {
+		prefs.remove(prefs_snapshot);
+		return false;
+	}
+	libsesame3bt::server_snapshot_t snapshot;
+	if (prefs.getBytes(prefs_snapshot, &snapshot, sizeof(snapshot)) != sizeof(snapshot) ||
+	    !(NimBLEUUID{snapshot.uuid, sizeof(snapshot.uuid)} == my_uuid)) {
+		return false;
+	}
+	prefs.end();
+	return configure_server() && server.begin_from_snapshot(snapshot);
+#endif
+}
+
+void
+setup() {
+	bool provisioned = load_provisioned_uuid();
+	// 保存済みのスナップショットがあれば、シリアルの準備を待たずにアドバタイズを開始する
+	bool fast_boot = provisioned && boot_from_snapshot();
+	delay(5000);
+	Serial.begin(115200);
+	if (!provisioned) {
+		Serial.println("UUID not configured");
 		return;
 	}
+	Serial.printf("my uuid = %s\n", my_uuid.toString().c_str());
+
+	if (!fast_boot) {
+		if (!prepare_secret() || !configure_server()) {
+			return;
+		}
+		if (!server.begin(Sesame::model_t::sesame_5, my_uuid)) {
+			Serial.println("initialization failed");
+			return;
+		}
+		if (!server.start_advertising()) {
+			Serial.println("Start advertisement failed");
+			return;
+		}
+		save_snapshot();
+	}
+	// ATT MTUとLE Data Lengthの拡大を要求する (セグメントの詰め直しはセントラルの対応が確認できないため行わない)
+	if (!server.enable_link_negotiation()) {
+		Serial.println("Failed to enable link negotiation");
+	}
+	enable_accept_list();
 	auto addr = NimBLEDevice::getAddress();
 	Serial.printf("my address = %s(%u)\n", addr.toString().c_str(), addr.getType());
-	if (!server.start_advertising()) {
-		Serial.println("Start advertisement failed");
-		return;
-	}
 	initialized = true;
 	Serial.printf("Advertisement started in %s state\n", server.is_registered() ? "Registered" : "NOT Registered");
+	const auto& timing = server.get_boot_timing();
+	Serial.printf("boot%s: begin=%uus BLE=%uus core=%uus GATT=%uus first advertising=%uus\n", timing.from_snapshot ? " from snapshot" : "",
+	              static_cast<unsigned>(timing.begin_us), static_cast<unsigned>(timing.ble_ready_us),
+	              static_cast<unsigned>(timing.core_ready_us), static_cast<unsigned>(timing.gatt_ready_us),
+	              static_cast<unsigned>(timing.first_advertising_us));
 }
 
 uint32_t last_reported;
@@ -197,16 +352,61 @@ loop() {
 			Serial.println("NOT Registered");
 		} else {
 			Serial.printf("session count = %u\n", server.get_session_count());
+			// BLEタスクが更新するセッション表のコピーを取得する
+			SesameServer::peer_t peers[SESAME_SERVER_MAX_SESSIONS];
+			size_t count = server.get_logged_in_peers(peers, SESAME_SERVER_MAX_SESSIONS);
+			for (size_t i = 0; i < count; i++) {
+				const auto& peer = peers[i];
+				Serial.printf("  %s (handle=%u, mtu=%u)\n", peer.address.toString().c_str(), peer.conn_handle, peer.mtu);
+				if (auto link = server.get_link_stats(peer.address)) {
+					Serial.printf("    frames=%u segments=%u notifications=%u\n", static_cast<unsigned>(link->frames),
+					              static_cast<unsigned>(link->segments), static_cast<unsigned>(link->notifications));
+				}
+			}
+#if LIBSESAME3BT_SERVER_STATS
+			static libsesame3bt::server_stats_t stats;
+			server.get_stats(stats);
+			Serial.printf("connects=%u logins=%u rejected writes=%u notify failures=%u max connect->command=%ums\n",
+			              static_cast<unsigned>(stats.connects), static_cast<unsigned>(stats.logins),
+			              static_cast<unsigned>(stats.rejected_writes), static_cast<unsigned>(stats.notify_failures),
+			              static_cast<unsigned>(stats.connect_to_first_command_ms.max));
+#endif
 		}
 		last_reported = millis();
 	}
+	if (known_peers_changed.exchange(false)) {
+		save_known_peers();
+	}
+	int key = Serial.available() ? Serial.read() : -1;
+	if (key == 'e') {
+		server.open_enrollment(enrollment_window_ms);
+		Serial.printf("Accepting any device for %us\n", static_cast<unsigned>(enrollment_window_ms / 1000));
+	}
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+	// シリアルから 't' でトレースをダンプ (tools/decode_trace.py で解析)
+	if (key == 't') {
+		Serial.println("TRACE BEGIN");
+		size_t column = 0;
+		server.dump_trace([&column](const uint8_t* data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				Serial.printf("%02x", data[i]);
+				if (++column == 32) {
+					Serial.println();
+					column = 0;
+				}
+			}
+		});
+		Serial.println();
+		Serial.println("TRACE END");
+	}
+#endif
 	server.update();
-	{
-		std::lock_guard<std::mutex> lock(status_mutex);
-		if (status_updated) {
-			status_updated = false;
-			server.send_lock_status(status);
+	// イベント到着で即座に起床する (ポーリング不要)
+	libsesame3bt::server_event_t event;
+	while (server.wait_event(event, 50)) {
+		if (event.type == libsesame3bt::server_event_t::type_t::command) {
+			on_command(event);
 		}
+		server.update();
 	}
-	delay(100);
 }
@@ -0,0 +1,173 @@
+#pragma once
+
+/*
+ * Minimal writer of ESP-IDF NVS partition images (format version 2, as nvs_partition_gen.py writes them) holding one
+ * namespace of blobs. Enough for the few small keys a device is provisioned with.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace nvs_image {
+
+constexpr size_t PAGE_SIZE = 4096;
+constexpr size_t ENTRY_SIZE = 32;
+constexpr size_t ENTRIES_PER_PAGE = 126;
+constexpr size_t ENTRIES_OFFSET = 64;
+constexpr size_t MAX_KEY = 15;
+
+/// CRC-32 as NVS computes it (zlib.crc32(data, 0xFFFFFFFF) in nvs_partition_gen.py).
+inline uint32_t
+crc32(const uint8_t* data, size_t size) {
+	uint32_t crc = 0;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+class Writer {
+ public:
+	/// @param size Partition size, a multiple of the page size and at least 3 pages (one stays free for NVS).
+	explicit Writer(size_t size) : image(size, 0xff) {}
+
+	bool begin_namespace(const std::string& name) {
+		uint8_t value = ++namespace_count;
+		current_namespace = value;
+		return write_entry(0, TYPE_U8, 1, CHUNK_ANY, name, &value, 1);
+	}
+
+	bool put_blob(const std::string& key, const void* data, size_t size) {
+		if (current_namespace == 0) {
+			return false;
+		}
+		auto* bytes = static_cast<const uint8_t*>(data);
+		size_t chunk_entries = (size + ENTRY_SIZE - 1) / ENTRY_SIZE;
+		if (chunk_entries + 1 > ENTRIES_PER_PAGE) {
+			return false;
+		}
+		if (entry + chunk_entries + 1 > ENTRIES_PER_PAGE) {
+			next_page();
+		}
+		uint8_t header[8];
+		put16(header, static_cast<uint16_t>(size));
+		put16(header + 2, 0xffff);
+		put32(header + 4, crc32(bytes, size));
+		std::vector<uint8_t> padded(chunk_entries * ENTRY_SIZE, 0xff);
+		std::memcpy(padded.data(), bytes, size);
+		if (!write_entry(current_namespace, TYPE_BLOB_DATA, static_cast<uint8_t>(chunk_entries + 1), 0, key, header,
+		                 sizeof(header), padded.data(), chunk_entries)) {
+			return false;
+		}
+		uint8_t index[8];
+		put32(index, static_cast<uint32_t>(size));
+		index[4] = 1;  // chunk count
+		index[5] = 0;  // first chunk index
+		index[6] = index[7] = 0xff;
+		return write_entry(current_namespace, TYPE_BLOB_IDX, 1, CHUNK_ANY, key, index, sizeof(index));
+	}
+
+	/// @return The image, or empty if it did not fit.
+	std::vector<uint8_t> finish() {
+		if (failed) {
+			return {};
+		}
+		seal_page();
+		return image;
+	}
+
+ private:
+	enum : uint8_t { TYPE_U8 = 0x01, TYPE_BLOB_DATA = 0x42, TYPE_BLOB_IDX = 0x48, CHUNK_ANY = 0xff };
+	static constexpr uint32_t PAGE_ACTIVE = 0xfffffffe;
+	static constexpr uint32_t PAGE_FULL = 0xfffffffc;
+	static constexpr uint8_t VERSION2 = 0xfe;
+
+	std::vector<uint8_t> image;
+	size_t page = 0;
+	size_t entry = 0;
+	uint8_t namespace_count = 0;
+	uint8_t current_namespace = 0;
+	bool failed = false;
+
+	static void put16(uint8_t* p, uint16_t v) {
+		p[0] = static_cast<uint8_t>(v);
+		p[1] = static_cast<uint8_t>(v >> 8);
+	}
+	static void put32(uint8_t* p, uint32_t v) {
+		for (int i = 0; i < 4; i++) {
+			p[i] = static_cast<uint8_t>(v >> (8 * i));
+		}
+	}
+	uint8_t* page_at(size_t n) { return image.data() + n * PAGE_SIZE; }
+
+	void seal_page(uint32_t state = PAGE_ACTIVE) {
+		auto* p = page_at(page);
+		put32(p, state);
+		put32(p + 4, static_cast<uint32_t>(page));
+		p[8] = VERSION2;
+		put32(p + 28, crc32(p + 4, 24));
+	}
+	void next_page() {
+		seal_page(PAGE_FULL);
+		++page;
+		entry = 0;
+		// the last page stays free for NVS garbage collection
+		if ((page + 2) * PAGE_SIZE > image.size()) {
+			failed = true;
+			page = 0;
+		}
+	}
+	void mark_written(size_t index) {
+		auto bit = index * 2;
+		page_at(page)[32 + bit / 8] &= static_cast<uint8_t>(~(1u << (bit % 8)));
+	}
+
+	bool write_entry(uint8_t ns,
+	                 uint8_t type,
+	                 uint8_t span,
+	                 uint8_t chunk_index,
+	                 const std::string& key,
+	                 const uint8_t* data,
+	                 size_t data_size,
+	                 const uint8_t* extra = nullptr,
+	                 size_t extra_entries = 0) {
+		if (failed || key.size() > MAX_KEY || data_size > 8) {
+			return false;
+		}
+		if (entry + span > ENTRIES_PER_PAGE) {
+			next_page();
+			if (failed) {
+				return false;
+			}
+		}
+		auto* e = page_at(page) + ENTRIES_OFFSET + entry * ENTRY_SIZE;
+		std::memset(e, 0xff, ENTRY_SIZE);
+		e[0] = ns;
+		e[1] = type;
+		e[2] = span;
+		e[3] = chunk_index;
+		std::memset(e + 8, 0, 16);
+		std::memcpy(e + 8, key.data(), key.size());
+		std::memcpy(e + 24, data, data_size);
+		uint8_t crc_data[ENTRY_SIZE - 4];
+		std::memcpy(crc_data, e, 4);
+		std::memcpy(crc_data + 4, e + 8, ENTRY_SIZE - 8);
+		put32(e + 4, crc32(crc_data, sizeof(crc_data)));
+		mark_written(entry++);
+		if (extra_entries) {
+			std::memcpy(e + ENTRY_SIZE, extra, extra_entries * ENTRY_SIZE);
+			for (size_t i = 0; i < extra_entries; i++) {
+				mark_written(entry++);
+			}
+		}
+		return true;
+	}
+};
+
+}  // namespace nvs_image
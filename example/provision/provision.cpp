@@ -0,0 +1,415 @@
+/*
+ * Native batch provisioning: generate or read SESAME UUIDs, derive their BLE addresses in parallel
+ * (SesameServerCore::uuid_to_ble_address(), as SesameServer::begin() does), reject address collisions within the batch
+ * and against an inventory of existing locks, and write the results.
+ *
+ * Outputs:
+ *   --out FILE         manifest CSV: uuid,address[,secret]
+ *   --headers DIR      <uuid>.h per device for mysesame-config.h (SESAME_SERVER_UUID, SESAME_SERVER_ADDRESS[, SECRET])
+ *   --nvs-csv DIR      <uuid>.csv per device for nvs_partition_gen.py
+ *   --nvs-bin DIR      <uuid>.bin per device, NVS partition image (--nvs-size, default 0x5000) to flash at the nvs offset
+ * The NVS outputs hold namespace "sesameserver" with "uuid" (NimBLEUUID byte order) and, with --secrets, "secret",
+ * as example/peripheral reads them.
+ *
+ * Input is --count N random (version 4) UUIDs, or --input FILE with one UUID per line. --inventory FILE lists existing
+ * locks, one UUID or BLE address per line. --secrets generates a shared secret per device (pre-registered devices).
+ *
+ * pio run -e provision && .pio/build/provision/program --count 1000000 --inventory locks.txt --out batch.csv
+ */
+#include <libsesame3bt/ServerCore.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "../native_common/args.h"
+#include "nvs_image.h"
+
+using libsesame3bt::core::SesameServerCore;
+
+namespace {
+
+using uuid_t = std::array<uint8_t, 16>;  // string (big-endian) order
+using secret_t = std::array<uint8_t, libsesame3bt::Sesame::SECRET_SIZE>;
+
+struct device_t {
+	uuid_t uuid;
+	uint64_t address;  ///< 48 bit, most significant byte first as printed
+};
+
+uint64_t
+now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t
+derive_address(const uuid_t& uuid) {
+	auto addr = SesameServerCore::uuid_to_ble_address(*reinterpret_cast<const std::byte(*)[16]>(uuid.data()));
+	// NimBLE byte order: least significant byte first
+	uint64_t value = 0;
+	for (size_t i = 0; i < addr.size(); i++) {
+		value |= static_cast<uint64_t>(addr[i]) << (8 * i);
+	}
+	return value;
+}
+
+int
+hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/// 32 hex digits, dashes ignored.
+bool
+parse_uuid(const std::string& text, uuid_t& uuid) {
+	size_t n = 0;
+	for (char c : text) {
+		if (c == '-') {
+			continue;
+		}
+		int v = hex_value(c);
+		if (v < 0 || n >= uuid.size() * 2) {
+			return false;
+		}
+		uuid[n / 2] = static_cast<uint8_t>((n & 1) ? (uuid[n / 2] | v) : v << 4);
+		n++;
+	}
+	return n == uuid.size() * 2;
+}
+
+/// 12 hex digits, colons ignored.
+bool
+parse_address(const std::string& text, uint64_t& address) {
+	size_t n = 0;
+	address = 0;
+	for (char c : text) {
+		if (c == ':') {
+			continue;
+		}
+		int v = hex_value(c);
+		if (v < 0 || n >= 12) {
+			return false;
+		}
+		address = address << 4 | v;
+		n++;
+	}
+	return n == 12;
+}
+
+std::string
+format_uuid(const uuid_t& uuid) {
+	char text[37];
+	std::snprintf(text, sizeof(text), "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x", uuid[0], uuid[1],
+	              uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7], uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13],
+	              uuid[14], uuid[15]);
+	return text;
+}
+
+std::string
+format_address(uint64_t address) {
+	char text[18];
+	std::snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", static_cast<unsigned>(address >> 40 & 0xff),
+	              static_cast<unsigned>(address >> 32 & 0xff), static_cast<unsigned>(address >> 24 & 0xff),
+	              static_cast<unsigned>(address >> 16 & 0xff), static_cast<unsigned>(address >> 8 & 0xff),
+	              static_cast<unsigned>(address & 0xff));
+	return text;
+}
+
+template <size_t N>
+std::string
+to_hex(const std::array<uint8_t, N>& bytes) {
+	std::string text;
+	char b[3];
+	for (auto v : bytes) {
+		std::snprintf(b, sizeof(b), "%02x", v);
+		text += b;
+	}
+	return text;
+}
+
+template <typename Rng>
+void
+random_uuid(Rng& rng, uuid_t& uuid) {
+	for (size_t i = 0; i < uuid.size(); i += 8) {
+		auto v = rng();
+		for (size_t j = 0; j < 8; j++) {
+			uuid[i + j] = static_cast<uint8_t>(v >> (8 * j));
+		}
+	}
+	uuid[6] = (uuid[6] & 0x0f) | 0x40;  // version 4
+	uuid[8] = (uuid[8] & 0x3f) | 0x80;  // RFC 4122 variant
+}
+
+/// Run f(begin, end) over [0, n) split across threads.
+template <typename F>
+void
+parallel_for(size_t n, size_t threads, F&& f) {
+	std::vector<std::thread> workers;
+	size_t chunk = (n + threads - 1) / threads;
+	for (size_t begin = 0; begin < n; begin += chunk) {
+		workers.emplace_back([&f, begin, end = std::min(n, begin + chunk)] { f(begin, end); });
+	}
+	for (auto& w : workers) {
+		w.join();
+	}
+}
+
+bool
+load_inventory(const std::string& path, std::unordered_set<uint64_t>& addresses, size_t& count) {
+	std::ifstream in{path};
+	if (!in) {
+		std::fprintf(stderr, "cannot open %s\n", path.c_str());
+		return false;
+	}
+	std::string line;
+	size_t line_no = 0;
+	while (std::getline(in, line)) {
+		++line_no;
+		while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+			line.pop_back();
+		}
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		uuid_t uuid;
+		uint64_t address;
+		if (parse_uuid(line, uuid)) {
+			address = derive_address(uuid);
+		} else if (!parse_address(line, address)) {
+			std::fprintf(stderr, "%s:%zu: neither UUID nor address: %s\n", path.c_str(), line_no, line.c_str());
+			return false;
+		}
+		addresses.insert(address);
+		++count;
+	}
+	return true;
+}
+
+bool
+write_file(const std::string& path, const void* data, size_t size) {
+	std::ofstream out{path, std::ios::binary};
+	out.write(static_cast<const char*>(data), size);
+	return static_cast<bool>(out);
+}
+
+bool
+write_outputs(const device_t& device, const secret_t* secret, const std::string& headers, const std::string& nvs_csv,
+              const std::string& nvs_bin, size_t nvs_size) {
+	auto uuid = format_uuid(device.uuid);
+	// NimBLEUUID stores 128 bit UUIDs least significant byte first
+	uuid_t nimble_uuid;
+	std::copy(device.uuid.rbegin(), device.uuid.rend(), nimble_uuid.begin());
+	if (!headers.empty()) {
+		std::string text = "#pragma once\n#define SESAME_SERVER_UUID \"" + uuid + "\"\n#define SESAME_SERVER_ADDRESS \"" +
+		                   format_address(device.address) + "\"\n";
+		if (secret) {
+			text += "#define SESAME_SERVER_SECRET \"" + to_hex(*secret) + "\"\n";
+		}
+		if (!write_file(headers + "/" + uuid + ".h", text.data(), text.size())) {
+			return false;
+		}
+	}
+	if (!nvs_csv.empty()) {
+		std::string text = "key,type,encoding,value\nsesameserver,namespace,,\nuuid,data,hex2bin," + to_hex(nimble_uuid) + "\n";
+		if (secret) {
+			text += "secret,data,hex2bin," + to_hex(*secret) + "\n";
+		}
+		if (!write_file(nvs_csv + "/" + uuid + ".csv", text.data(), text.size())) {
+			return false;
+		}
+	}
+	if (!nvs_bin.empty()) {
+		nvs_image::Writer writer{nvs_size};
+		if (!writer.begin_namespace("sesameserver") || !writer.put_blob("uuid", nimble_uuid.data(), nimble_uuid.size()) ||
+		    (secret && !writer.put_blob("secret", secret->data(), secret->size()))) {
+			return false;
+		}
+		auto image = writer.finish();
+		if (image.empty() || !write_file(nvs_bin + "/" + uuid + ".bin", image.data(), image.size())) {
+			return false;
+		}
+	}
+	return true;
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	size_t count = args::value(argc, argv, "--count", 0);
+	auto input = args::string(argc, argv, "--input");
+	auto inventory_path = args::string(argc, argv, "--inventory");
+	auto out_path = args::string(argc, argv, "--out");
+	auto headers = args::string(argc, argv, "--headers");
+	auto nvs_csv = args::string(argc, argv, "--nvs-csv");
+	auto nvs_bin = args::string(argc, argv, "--nvs-bin");
+	size_t nvs_size = args::value(argc, argv, "--nvs-size", 0x5000);
+	bool with_secrets = args::flag(argc, argv, "--secrets");
+	size_t threads = args::value(argc, argv, "--threads", std::max(1u, std::thread::hardware_concurrency()));
+	if (count == 0 && input.empty()) {
+		std::fprintf(stderr, "usage: %s (--count N | --input FILE) [--inventory FILE] [--out FILE] [--headers DIR]\n"
+		             "       [--nvs-csv DIR] [--nvs-bin DIR] [--nvs-size N] [--secrets] [--threads N]\n", argv[0]);
+		return 2;
+	}
+	if (nvs_size % nvs_image::PAGE_SIZE || nvs_size < 3 * nvs_image::PAGE_SIZE) {
+		std::fprintf(stderr, "--nvs-size must be a multiple of 4096 and at least 3 pages\n");
+		return 2;
+	}
+
+	std::unordered_set<uint64_t> inventory;
+	size_t inventory_count = 0;
+	if (!inventory_path.empty() && !load_inventory(inventory_path, inventory, inventory_count)) {
+		return 1;
+	}
+
+	std::vector<device_t> devices;
+	if (!input.empty()) {
+		std::ifstream in{input};
+		if (!in) {
+			std::fprintf(stderr, "cannot open %s\n", input.c_str());
+			return 1;
+		}
+		std::string line;
+		while (std::getline(in, line)) {
+			while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+				line.pop_back();
+			}
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			device_t device{};
+			if (!parse_uuid(line, device.uuid)) {
+				std::fprintf(stderr, "%s: invalid UUID: %s\n", input.c_str(), line.c_str());
+				return 1;
+			}
+			devices.push_back(device);
+		}
+	} else {
+		devices.resize(count);
+		std::random_device seed;
+		std::vector<uint64_t> seeds(threads);
+		for (auto& s : seeds) {
+			s = static_cast<uint64_t>(seed()) << 32 | seed();
+		}
+		std::atomic<size_t> next_seed{0};
+		parallel_for(devices.size(), threads, [&](size_t begin, size_t end) {
+			std::mt19937_64 rng{seeds[next_seed++ % seeds.size()]};
+			for (size_t i = begin; i < end; i++) {
+				random_uuid(rng, devices[i].uuid);
+			}
+		});
+	}
+
+	auto started = now_ns();
+	parallel_for(devices.size(), threads, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			devices[i].address = derive_address(devices[i].uuid);
+		}
+	});
+	auto derived = now_ns();
+
+	// collisions: generated UUIDs are replaced, given ones are reported and left out
+	size_t against_inventory = 0;
+	size_t within_batch = 0;
+	size_t replaced = 0;
+	std::mt19937_64 rng{std::random_device{}()};
+	std::unordered_set<uint64_t> batch;
+	batch.reserve(devices.size());
+	std::vector<device_t> accepted;
+	accepted.reserve(devices.size());
+	for (auto& device : devices) {
+		bool rejected = false;
+		for (;;) {
+			bool existing = inventory.count(device.address) != 0;
+			if (!existing && batch.insert(device.address).second) {
+				break;
+			}
+			++(existing ? against_inventory : within_batch);
+			if (!input.empty()) {
+				std::printf("collision (%s) %s %s\n", existing ? "inventory" : "batch", format_uuid(device.uuid).c_str(),
+				            format_address(device.address).c_str());
+				rejected = true;
+				break;
+			}
+			random_uuid(rng, device.uuid);
+			device.address = derive_address(device.uuid);
+			++replaced;
+		}
+		if (!rejected) {
+			accepted.push_back(device);
+		}
+	}
+	auto checked = now_ns();
+
+	std::vector<secret_t> secrets;
+	if (with_secrets) {
+		std::random_device random;
+		secrets.resize(accepted.size());
+		for (auto& secret : secrets) {
+			for (size_t i = 0; i < secret.size(); i += 4) {
+				auto v = random();
+				for (size_t j = 0; j < 4; j++) {
+					secret[i + j] = static_cast<uint8_t>(v >> (8 * j));
+				}
+			}
+		}
+	}
+
+	if (!out_path.empty()) {
+		std::FILE* out = std::fopen(out_path.c_str(), "w");
+		if (!out) {
+			std::fprintf(stderr, "cannot open %s\n", out_path.c_str());
+			return 1;
+		}
+		std::fprintf(out, with_secrets ? "uuid,address,secret\n" : "uuid,address\n");
+		for (size_t i = 0; i < accepted.size(); i++) {
+			std::fprintf(out, "%s,%s", format_uuid(accepted[i].uuid).c_str(), format_address(accepted[i].address).c_str());
+			std::fprintf(out, with_secrets ? ",%s\n" : "\n", with_secrets ? to_hex(secrets[i]).c_str() : "");
+		}
+		std::fclose(out);
+	}
+	std::atomic<size_t> write_failures{0};
+	for (const auto* dir : {&headers, &nvs_csv, &nvs_bin}) {
+		std::error_code ec;
+		if (!dir->empty() && !std::filesystem::create_directories(*dir, ec) && ec) {
+			std::fprintf(stderr, "cannot create %s: %s\n", dir->c_str(), ec.message().c_str());
+			return 1;
+		}
+	}
+	if (!headers.empty() || !nvs_csv.empty() || !nvs_bin.empty()) {
+		parallel_for(accepted.size(), threads, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				if (!write_outputs(accepted[i], with_secrets ? &secrets[i] : nullptr, headers, nvs_csv, nvs_bin, nvs_size)) {
+					++write_failures;
+				}
+			}
+		});
+	}
+	auto written = now_ns();
+
+	std::printf("devices=%zu inventory=%zu (%zu addresses) threads=%zu\n", accepted.size(), inventory_count, inventory.size(),
+	            threads);
+	std::printf("collisions: inventory=%zu batch=%zu replaced=%zu\n", against_inventory, within_batch, replaced);
+	std::printf("derive   %10.3f s %12.0f addresses/s\n", (derived - started) / 1e9, devices.size() * 1e9 / (derived - started + 1));
+	std::printf("check    %10.3f s\n", (checked - derived) / 1e9);
+	std::printf("write    %10.3f s\n", (written - checked) / 1e9);
+	if (write_failures) {
+		std::fprintf(stderr, "%zu devices could not be written\n", write_failures.load());
+		return 1;
+	}
+	return accepted.size() == devices.size() ? 0 : 1;
+}
@@ -0,0 +1,180 @@
+/*
+ * Replay captured central traffic through the server receive path (onWrite -> core.on_received -> command callback).
+ * SesameServer runs on the NimBLE stand-in, each session of the capture is a loopback central writing to the RX
+ * characteristic.
+ *
+ * Capture format: see native_common/capture.h.
+ *
+ * pio run -e replay
+ * .pio/build/replay/program --generate FILE [--sessions N] [--commands N] [--interval-ms N]   write a synthetic capture
+ * .pio/build/replay/program --capture FILE [--timing] [--loops N]                               replay a capture
+ *
+ * Without --timing records are fed as fast as possible; with it the original inter-record timing is kept.
+ * Reports per-frame cost of the RX write and decode/decrypt throughput in frames and bytes per second of server time.
+ */
+#include <cstdio>
+#include <map>
+#include <set>
+#include <thread>
+#include "../native_common/args.h"
+#include "../native_common/capture.h"
+#include "../native_common/loopback.h"
+
+using namespace loopback;
+using namespace libsesame3bt;
+
+namespace {
+
+std::vector<capture::record_t>
+generate(size_t n_sessions, size_t n_commands, uint32_t interval_ms) {
+	std::vector<capture::record_t> records;
+	for (size_t i = 0; i < n_sessions; i++) {
+		auto handle = static_cast<uint16_t>(i + 1);
+		records.push_back({0, handle, capture::kind_t::connect, {}});
+		records.push_back({0, handle, capture::kind_t::subscribe, {}});
+	}
+	uint32_t t = 0;
+	for (size_t i = 0; i < n_commands; i++) {
+		t += interval_ms * 1000;
+		auto cmd = (i & 1) ? Sesame::item_code_t::unlock : Sesame::item_code_t::lock;
+		std::vector<uint8_t> data{static_cast<uint8_t>(cmd)};
+		const std::string tag = "replay";
+		data.insert(data.end(), tag.begin(), tag.end());
+		records.push_back({t, static_cast<uint16_t>(i % n_sessions + 1), capture::kind_t::command, data});
+	}
+	for (size_t i = 0; i < n_sessions; i++) {
+		records.push_back({t, static_cast<uint16_t>(i + 1), capture::kind_t::disconnect, {}});
+	}
+	return records;
+}
+
+struct replay_stats_t {
+	size_t commands_sent = 0;
+	size_t commands_skipped = 0;
+	size_t raw_writes = 0;
+	size_t writes_skipped = 0;
+};
+
+void
+replay(const std::vector<capture::record_t>& records, Link& link, bool timing, replay_stats_t& stats) {
+	auto secret = demo_secret();
+	std::map<uint16_t, std::unique_ptr<LoopbackCentral>> centrals;
+	auto started = clock::now();
+	for (const auto& r : records) {
+		if (timing) {
+			std::this_thread::sleep_until(started + std::chrono::microseconds(r.time_us));
+		}
+		auto it = centrals.find(r.conn_handle);
+		switch (r.kind) {
+			case capture::kind_t::connect:
+				if (it == centrals.end()) {
+					auto c = std::make_unique<LoopbackCentral>(link, r.conn_handle);
+					if (c->begin(Sesame::model_t::sesame_5, secret)) {
+						centrals[r.conn_handle] = std::move(c);
+					}
+				}
+				break;
+			case capture::kind_t::subscribe:
+				if (it != centrals.end() && !it->second->is_connected()) {
+					it->second->connect(NimBLEDevice::getAddress());
+				}
+				break;
+			case capture::kind_t::write:
+				// the server may have terminated the session after an earlier rejected write
+				if (it != centrals.end() && it->second->is_connected()) {
+					++stats.raw_writes;
+					it->second->write_raw(r.data.data(), r.data.size());
+				} else {
+					++stats.writes_skipped;
+				}
+				break;
+			case capture::kind_t::command: {
+				bool sent = false;
+				if (it != centrals.end() && it->second->is_logged_in() && !r.data.empty()) {
+					std::string tag(r.data.begin() + 1, r.data.end());
+					auto cmd = static_cast<Sesame::item_code_t>(r.data[0]);
+					if (cmd == Sesame::item_code_t::lock) {
+						sent = it->second->lock(tag);
+					} else if (cmd == Sesame::item_code_t::unlock) {
+						sent = it->second->unlock(tag);
+					}
+				}
+				++(sent ? stats.commands_sent : stats.commands_skipped);
+				break;
+			}
+			case capture::kind_t::disconnect:
+				if (it != centrals.end()) {
+					it->second->disconnect(REASON_REMOTE_TERM);
+					centrals.erase(it);
+				}
+				break;
+		}
+		link.pump();
+	}
+	for (auto& [handle, c] : centrals) {
+		c->disconnect(REASON_REMOTE_TERM);
+	}
+	link.pump();
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	auto generate_path = args::string(argc, argv, "--generate");
+	if (!generate_path.empty()) {
+		auto records = generate(args::value(argc, argv, "--sessions", 3), args::value(argc, argv, "--commands", 10000),
+		                        args::value(argc, argv, "--interval-ms", 100));
+		if (!capture::save(generate_path, records)) {
+			std::fprintf(stderr, "cannot write %s\n", generate_path.c_str());
+			return 1;
+		}
+		std::printf("%zu records written to %s\n", records.size(), generate_path.c_str());
+		return 0;
+	}
+
+	auto path = args::string(argc, argv, "--capture");
+	std::vector<capture::record_t> records;
+	if (path.empty() || !capture::load(path, records)) {
+		std::fprintf(stderr, "usage: %s --capture FILE [--timing] [--loops N] | --generate FILE\n", argv[0]);
+		return 1;
+	}
+	bool timing = args::flag(argc, argv, "--timing");
+	size_t loops = args::value(argc, argv, "--loops", 1);
+
+	std::set<uint16_t> handles;
+	for (const auto& r : records) {
+		handles.insert(r.conn_handle);
+	}
+	Link link;
+	SesameServer server{handles.size()};
+	Handler handler{link};
+	server.set_handler(&handler);
+	if (!start_server(server, demo_secret())) {
+		std::fprintf(stderr, "server begin failed\n");
+		return 1;
+	}
+
+	replay_stats_t stats;
+	auto started = now_ns();
+	for (size_t i = 0; i < loops; i++) {
+		replay(records, link, timing, stats);
+	}
+	auto elapsed = now_ns() - started;
+
+	server_stats_t server_stats;
+	server.get_stats(server_stats);
+	std::printf("records=%zu loops=%zu sessions=%zu logins=%u\n", records.size(), loops, handles.size(), server_stats.logins);
+	std::printf("commands sent=%zu skipped=%zu handled=%zu raw_writes=%zu skipped=%zu rejected_writes=%u\n",
+	            stats.commands_sent, stats.commands_skipped, handler.commands, stats.raw_writes, stats.writes_skipped,
+	            server_stats.rejected_writes);
+	double server_s = link.write_cost.total_ns() / 1e9;
+	std::printf("frames=%zu bytes=%zu wall=%.3fs server=%.3fs\n", link.write_cost.count(), link.rx_bytes, elapsed / 1e9, server_s);
+	if (server_s > 0) {
+		std::printf("throughput             %.0f frames/s %.2f MB/s (server time)\n", link.write_cost.count() / server_s,
+		            link.rx_bytes / server_s / 1e6);
+	}
+	link.write_cost.print("RX write cost");
+	link.write_to_command.print("onWrite->callback");
+	return server_stats.rejected_writes == 0 || stats.raw_writes ? 0 : 1;
+}
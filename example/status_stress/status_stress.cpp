@@ -0,0 +1,258 @@
+/*
+ * Native multi-threaded stress test of status publication, in two parts.
+ *
+ * PublishedState / Seqlock: the application task publishes mecha_status and mecha_setting while the NimBLE host task
+ * applies them to the core and other tasks read them. Every published value is derived from one counter, so a value
+ * mixing two publications (torn) is detected. With a single writer the counter seen by each reader must also never go
+ * backwards.
+ *
+ * SesameServer on the loopback: the application task calls send_lock_status(), send_mecha_status(), update() and the
+ * session queries while the NimBLE host task handles lock / unlock commands of the logged-in centrals. Admission control,
+ * connection parameters and status coalescing are enabled, so update() walks the per-session state the host task resets.
+ * Frames from both tasks must reach each central whole (no interleaved segments), every command must be answered and
+ * every session must stay logged in (and be seen by the queries).
+ *
+ * Exits with 1 on any violation.
+ *
+ * pio run -e status_stress && .pio/build/status_stress/program [--ms N] [--readers N] [--writers N] [--sessions N]
+ * Add -fsanitize=thread to build_flags to check for data races as well.
+ */
+#include <PublishedState.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "../native_common/args.h"
+#include "../native_common/loopback.h"
+
+using namespace libsesame3bt;
+
+namespace {
+
+enum class flags_t : uint8_t { none = 0, mecha_setting = 1, mecha_status = 2 };
+
+Sesame::mecha_status_5_t
+make_status(uint32_t n) {
+	Sesame::mecha_status_5_t status{};
+	status.battery = static_cast<int16_t>(n);
+	status.target = static_cast<int16_t>(n >> 16);
+	status.position = static_cast<int16_t>((n ^ (n >> 16)) ^ 0x5a5a);
+	status.in_lock = n & 1;
+	status.in_unlock = !(n & 1);
+	return status;
+}
+
+uint32_t
+counter_of(const Sesame::mecha_status_5_t& status) {
+	return static_cast<uint16_t>(status.battery) | static_cast<uint32_t>(static_cast<uint16_t>(status.target)) << 16;
+}
+
+bool
+is_consistent(const Sesame::mecha_status_5_t& status) {
+	auto n = counter_of(status);
+	return status.position == static_cast<int16_t>((n ^ (n >> 16)) ^ 0x5a5a) && status.in_lock == static_cast<bool>(n & 1) &&
+	       status.in_unlock == !(n & 1);
+}
+
+Sesame::mecha_setting_5_t
+make_setting(uint32_t n) {
+	return {static_cast<int16_t>(n), static_cast<int16_t>(~n), static_cast<int16_t>(n ^ 0x3c3c)};
+}
+
+bool
+is_consistent(const Sesame::mecha_setting_5_t& setting) {
+	auto n = static_cast<uint16_t>(setting.lock);
+	return setting.unlock == static_cast<int16_t>(~n) && setting.auto_lock_sec == static_cast<int16_t>(n ^ 0x3c3c);
+}
+
+struct counters_t {
+	std::atomic<uint64_t> reads{0};
+	std::atomic<uint64_t> retries{0};  ///< reads that met a store in progress
+	std::atomic<uint64_t> torn{0};
+	std::atomic<uint64_t> backwards{0};
+};
+
+/// @brief Core stand-in for PublishedState::apply(), checks what the host task would hand to SesameServerCore.
+struct checking_core_t {
+	counters_t& counters;
+	uint64_t statuses = 0;
+	uint64_t settings = 0;
+
+	void set_mecha_status(const Sesame::mecha_status_5_t& status) {
+		++statuses;
+		if (!is_consistent(status)) {
+			counters.torn.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	void set_mecha_setting(const Sesame::mecha_setting_5_t& setting) {
+		++settings;
+		if (!is_consistent(setting)) {
+			counters.torn.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	void set_auto_send_flags(flags_t) {}
+};
+
+bool
+stress_published_state(std::chrono::milliseconds duration, size_t n_readers, size_t n_writers) {
+	PublishedState<flags_t> state;
+	counters_t counters;
+	std::atomic<bool> stop{false};
+	std::atomic<uint64_t> published{0};
+	checking_core_t core{counters};
+
+	std::vector<std::thread> threads;
+	// application task(s)
+	for (size_t w = 0; w < n_writers; w++) {
+		threads.emplace_back([&, w] {
+			for (uint32_t n = static_cast<uint32_t>(w) << 20; !stop.load(std::memory_order_relaxed); n++) {
+				state.set_mecha_status(make_status(n));
+				state.set_mecha_setting(make_setting(n));
+				if ((n & 0xff) == 0) {
+					state.set_auto_send_flags((n & 0x100) ? flags_t::mecha_status : flags_t::mecha_setting);
+				}
+				published.fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+	}
+	// NimBLE host task: the only caller of apply()
+	threads.emplace_back([&] {
+		while (!stop.load(std::memory_order_relaxed)) {
+			state.apply(core);
+		}
+	});
+	// other readers
+	for (size_t r = 0; r < n_readers; r++) {
+		threads.emplace_back([&] {
+			uint32_t last = 0;
+			bool first = true;
+			while (!stop.load(std::memory_order_relaxed)) {
+				Sesame::mecha_status_5_t status;
+				Sesame::mecha_setting_5_t setting;
+				if (!state.get_mecha_status(status) || !state.get_mecha_setting(setting)) {
+					counters.retries.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+				counters.reads.fetch_add(1, std::memory_order_relaxed);
+				if (!is_consistent(status) || !is_consistent(setting)) {
+					counters.torn.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+				auto n = counter_of(status);
+				if (n_writers == 1 && !first && static_cast<int32_t>(n - last) < 0) {
+					counters.backwards.fetch_add(1, std::memory_order_relaxed);
+				}
+				last = n;
+				first = false;
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(duration);
+	stop = true;
+	for (auto& t : threads) {
+		t.join();
+	}
+
+	std::printf("writers=%zu readers=%zu published=%llu applied status=%llu setting=%llu reads=%llu\n", n_writers, n_readers,
+	            static_cast<unsigned long long>(published.load()), static_cast<unsigned long long>(core.statuses),
+	            static_cast<unsigned long long>(core.settings), static_cast<unsigned long long>(counters.reads.load()));
+	std::printf("retries=%llu torn=%llu backwards=%llu\n", static_cast<unsigned long long>(counters.retries.load()),
+	            static_cast<unsigned long long>(counters.torn.load()),
+	            static_cast<unsigned long long>(counters.backwards.load()));
+	return !counters.torn && !counters.backwards && core.statuses && counters.reads;
+}
+
+bool
+stress_server(std::chrono::milliseconds duration, size_t n_sessions) {
+	auto secret = loopback::demo_secret();
+	loopback::Link link;
+	SesameServer server{n_sessions};
+	loopback::Handler handler{link};
+	server.set_handler(&handler);
+	if (!loopback::start_server(server, secret)) {
+		std::fprintf(stderr, "server begin failed\n");
+		return false;
+	}
+	server.enable_admission_control();
+	server.enable_connection_params();
+	server.set_status_coalescing(2, 5);
+	auto centrals = loopback::login_centrals(link, NimBLEDevice::getAddress(), n_sessions, secret);
+	if (centrals.empty()) {
+		return false;
+	}
+	// enough buffers for the status bursts: a refused notification is queued or dropped, not what is tested here
+	NimBLEHost::set_acl_buffers(1024);
+
+	std::atomic<bool> stop{false};
+	std::atomic<uint64_t> statuses{0};
+	std::atomic<uint64_t> lost_sessions{0};
+	// application task
+	std::thread app([&] {
+		for (uint32_t n = 0; !stop.load(std::memory_order_relaxed); n++) {
+			if (n & 1) {
+				server.send_lock_status(n & 2);
+			} else {
+				server.send_mecha_status(&centrals[n / 2 % centrals.size()]->get_address(), make_status(n));
+			}
+			if ((n & 0xf) == 0) {
+				server.update();
+				// session queries read the table the host task updates
+				SesameServer::peer_t peers[LIBSESAME3BT_SERVER_MAX_CONNECTIONS];
+				for (size_t i = 0, count = server.get_logged_in_peers(peers, std::size(peers)); i < count; i++) {
+					if (!server.has_session(peers[i].address)) {
+						lost_sessions.fetch_add(1, std::memory_order_relaxed);
+					}
+				}
+			}
+			statuses.fetch_add(1, std::memory_order_relaxed);
+			std::this_thread::sleep_for(std::chrono::microseconds(20));
+		}
+	});
+	// NimBLE host task: commands of the centrals and delivery of what either task sent
+	size_t sent = 0;
+	auto until = std::chrono::steady_clock::now() + duration;
+	for (size_t i = 0; std::chrono::steady_clock::now() < until; i++) {
+		auto& c = *centrals[i % centrals.size()];
+		if (c.is_logged_in() && ((i & 1) ? c.unlock("stress") : c.lock("stress"))) {
+			++sent;
+		}
+		link.pump();
+	}
+	stop = true;
+	app.join();
+	link.pump();
+
+	size_t logged_in = std::count_if(centrals.begin(), centrals.end(), [](const auto& c) { return c->is_logged_in(); });
+	server_stats_t stats;
+	server.get_stats(stats);
+	auto tx = server.get_tx_queue_stats();
+	std::printf("sessions=%zu logged_in=%zu statuses=%llu commands=%zu handled=%zu notifications=%zu\n", n_sessions, logged_in,
+	            static_cast<unsigned long long>(statuses.load()), sent, handler.commands, link.notifications);
+	std::printf("framing_errors=%zu rejected_writes=%u dropped=%u lost_sessions=%llu\n", link.framing_errors,
+	            stats.rejected_writes, tx.dropped, static_cast<unsigned long long>(lost_sessions.load()));
+	NimBLEHost::set_acl_buffers(24);
+	return logged_in == n_sessions && link.framing_errors == 0 && stats.rejected_writes == 0 && tx.dropped == 0 && !lost_sessions &&
+	       handler.commands == sent && sent && statuses;
+}
+
+}  // namespace
+
+int
+main(int argc, char** argv) {
+	auto duration = std::chrono::milliseconds(args::value(argc, argv, "--ms", 2000));
+	size_t n_readers = args::value(argc, argv, "--readers", 2);
+	size_t n_writers = std::max<size_t>(1, args::value(argc, argv, "--writers", 1));
+	size_t n_sessions = std::max<size_t>(1, args::value(argc, argv, "--sessions", 3));
+
+	bool ok = stress_published_state(duration, n_readers, n_writers);
+	ok = stress_server(duration, n_sessions) && ok;
+	if (!ok) {
+		std::printf("FAIL\n");
+		return 1;
+	}
+	std::printf("OK\n");
+	return 0;
+}
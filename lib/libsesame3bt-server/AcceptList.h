@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Addresses of peers allowed to connect while connections are filtered, and the enrollment window.
+ *
+ * Mirrors the controller's filter accept list, which has a small fixed size: when full, learning a new peer evicts
+ * the least recently seen one.
+ *
+ * @tparam Address Peer address type (NimBLEAddress).
+ * @tparam N Capacity, at most the controller's filter accept list size.
+ */
+template <typename Address, size_t N>
+class AcceptList {
+ public:
+	/**
+	 * @brief Add the peer or refresh its last seen time.
+	 *
+	 * @param evicted Set to the peer removed to make room.
+	 * @return true if the peer was not known.
+	 */
+	bool learn(const Address& address, uint32_t now, std::optional<Address>& evicted) {
+		evicted.reset();
+		if (auto* entry = find(address)) {
+			entry->seen = now;
+			return false;
+		}
+		entry_t* slot = nullptr;
+		for (auto& entry : entries) {
+			if (!entry.used) {
+				slot = &entry;
+				break;
+			}
+			if (!slot || now - entry.seen > now - slot->seen) {
+				slot = &entry;
+			}
+		}
+		if (slot->used) {
+			evicted = slot->address;
+		} else {
+			++count;
+		}
+		*slot = entry_t{address, now, true};
+		return true;
+	}
+
+	bool remove(const Address& address) {
+		if (auto* entry = find(address)) {
+			*entry = entry_t{};
+			--count;
+			return true;
+		}
+		return false;
+	}
+
+	bool contains(const Address& address) const { return const_cast<AcceptList*>(this)->find(address) != nullptr; }
+	size_t size() const { return count; }
+	bool full() const { return count == N; }
+	static constexpr size_t capacity() { return N; }
+
+	/// @brief Copy the known addresses to out. @return Number copied.
+	size_t get(Address* out, size_t max) const {
+		size_t n = 0;
+		for (const auto& entry : entries) {
+			if (entry.used && n < max) {
+				out[n++] = entry.address;
+			}
+		}
+		return n;
+	}
+
+	/// @brief Accept any peer for duration_ms (0 closes the window).
+	void open(uint32_t now, uint32_t duration_ms) {
+		open_until = now + duration_ms;
+		window = duration_ms != 0;
+	}
+	bool is_open(uint32_t now) const { return window && static_cast<int32_t>(open_until - now) > 0; }
+
+ private:
+	struct entry_t {
+		Address address{};
+		uint32_t seen = 0;
+		bool used = false;
+	};
+	std::array<entry_t, N> entries{};
+	size_t count = 0;
+	uint32_t open_until = 0;
+	bool window = false;
+
+	entry_t* find(const Address& address) {
+		for (auto& entry : entries) {
+			if (entry.used && entry.address == address) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace libsesame3bt {
+
+/// @brief Priority class of a peer. Sessions are only evicted for peers of the same or a higher class.
+enum class peer_priority_t : uint8_t {
+	low,     ///< e.g. Open Sensor, connected for long periods
+	normal,  ///< default
+	high,    ///< operated by a human (Remote / Remote nano / Touch button)
+};
+
+struct admission_config_t {
+	/// disconnect sessions idle longer than this, by peer_priority_t (0: never)
+	std::array<uint32_t, 3> idle_timeout_ms;
+	/// sessions with activity (connect, login, command) more recent than this are never evicted
+	uint32_t min_idle_ms;
+	/// disconnect peers not logged in this long after connecting (0: never)
+	uint32_t login_timeout_ms;
+};
+
+/// Default: low priority sessions time out after 30 seconds idle, normal after 5 minutes, high never. Peers must log in
+/// within 10 seconds of connecting.
+constexpr admission_config_t default_admission_config{{30'000, 300'000, 0}, 1'000, 10'000};
+
+/**
+ * @brief Chooses which sessions to disconnect when a new peer needs a session slot or a session is idle too long.
+ *
+ * Connected peers past the login deadline are evicted first. Otherwise a candidate is a logged-in session, not
+ * already being evicted, not busy and idle for at least min_idle_ms.
+ * The victim is the candidate with the lowest priority, least recently active first.
+ *
+ * @tparam N Number of session slots (same indices as SessionTable).
+ */
+template <size_t N>
+class AdmissionControl {
+ public:
+	void set_config(const admission_config_t& config) { this->config = config; }
+
+	void on_connect(size_t slot, peer_priority_t priority, uint32_t now) { slots[slot] = slot_t{now, priority}; }
+	/// @brief Login or command on the slot.
+	void on_activity(size_t slot, uint32_t now) { slots[slot].last_activity = now; }
+	void reset(size_t slot) { slots[slot] = slot_t{}; }
+
+	peer_priority_t get_priority(size_t slot) const { return slots[slot].priority; }
+	void set_evicting(size_t slot) { slots[slot].evicting = true; }
+	bool is_evicting(size_t slot) const { return slots[slot].evicting; }
+
+	/// @brief The slot could not get a core session, retry when an evicted session is gone.
+	void set_waiting(size_t slot, bool waiting) { slots[slot].waiting = waiting; }
+	bool is_waiting(size_t slot) const { return slots[slot].waiting; }
+
+	/// @brief Evictions requested and not yet disconnected.
+	template <typename Sessions>
+	size_t evicting(const Sessions& sessions) const {
+		size_t n = 0;
+		for (size_t i = 0; i < N; i++) {
+			if (sessions.at(i).in_use() && slots[i].evicting) {
+				++n;
+			}
+		}
+		return n;
+	}
+
+	/**
+	 * @brief Session to evict for a new peer.
+	 *
+	 * @param sessions SessionTable
+	 * @param busy bool(size_t slot), true if the session must not be disconnected now (e.g. deferred command pending)
+	 * @return Slot index of the victim.
+	 */
+	template <typename Sessions, typename Busy>
+	std::optional<size_t> select_victim(peer_priority_t incoming, uint32_t now, const Sessions& sessions, Busy&& busy) const {
+		for (size_t i = 0; i < N; i++) {
+			if (login_expired(i, sessions.at(i), now)) {
+				return i;
+			}
+		}
+		std::optional<size_t> victim;
+		for (const auto& entry : sessions.logged_in()) {
+			auto i = sessions.index_of(entry);
+			const auto& s = slots[i];
+			if (s.evicting || s.priority > incoming || now - s.last_activity < config.min_idle_ms || busy(i)) {
+				continue;
+			}
+			if (!victim || s.priority < slots[*victim].priority ||
+			    (s.priority == slots[*victim].priority && now - s.last_activity > now - slots[*victim].last_activity)) {
+				victim = i;
+			}
+		}
+		return victim;
+	}
+
+	/// @brief Number of sessions select_victim() could choose from for a peer of the given priority.
+	template <typename Sessions, typename Busy>
+	size_t evictable(peer_priority_t incoming, uint32_t now, const Sessions& sessions, Busy&& busy) const {
+		size_t n = 0;
+		for (size_t i = 0; i < N; i++) {
+			n += login_expired(i, sessions.at(i), now);
+		}
+		for (const auto& entry : sessions.logged_in()) {
+			auto i = sessions.index_of(entry);
+			const auto& s = slots[i];
+			if (!s.evicting && s.priority <= incoming && now - s.last_activity >= config.min_idle_ms && !busy(i)) {
+				++n;
+			}
+		}
+		return n;
+	}
+
+	/**
+	 * @brief Call evict for each peer past the login deadline, then for each session idle longer than its idle timeout.
+	 *
+	 * @param evict void(size_t slot)
+	 */
+	template <typename Sessions, typename Busy, typename Evict>
+	void check_idle(uint32_t now, const Sessions& sessions, Busy&& busy, Evict&& evict) const {
+		for (size_t i = 0; i < N; i++) {
+			if (login_expired(i, sessions.at(i), now)) {
+				evict(i);
+			}
+		}
+		for (const auto& entry : sessions.logged_in()) {
+			auto i = sessions.index_of(entry);
+			const auto& s = slots[i];
+			auto timeout = config.idle_timeout_ms[static_cast<size_t>(s.priority)];
+			if (!s.evicting && timeout && now - s.last_activity >= timeout && !busy(i)) {
+				evict(i);
+			}
+		}
+	}
+
+ private:
+	struct slot_t {
+		uint32_t last_activity = 0;  // connect time until login
+		peer_priority_t priority = peer_priority_t::normal;
+		bool evicting = false;
+		bool waiting = false;
+	};
+	std::array<slot_t, N> slots{};
+	admission_config_t config = default_admission_config;
+
+	template <typename Entry>
+	bool login_expired(size_t slot, const Entry& entry, uint32_t now) const {
+		const auto& s = slots[slot];
+		return entry.in_use() && !entry.logged_in && !s.evicting && config.login_timeout_ms &&
+		       now - s.last_activity >= config.login_timeout_ms;
+	}
+};
+
+}  // namespace libsesame3bt
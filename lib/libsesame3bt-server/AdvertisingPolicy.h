@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace libsesame3bt {
+
+/// @brief Input of the advertising policy.
+struct advertising_context_t {
+	/// milliseconds since the last disconnect (or since advertising was started)
+	uint32_t since_disconnect_ms;
+	/// milliseconds since the last registration, UINT32_MAX if none
+	uint32_t since_registration_ms;
+	/// current BLE connections
+	size_t connections;
+	size_t max_sessions;
+	/// connections the server can hold (a new connection beyond max_sessions is admitted by evicting a session)
+	size_t max_connections;
+	/// sessions the admission control could evict for a high priority peer (0 if admission control is disabled)
+	size_t evictable;
+	bool registered;
+};
+
+/// @brief Advertising requested by the policy. Intervals are in units of 0.625 ms.
+struct advertising_params_t {
+	bool enabled;
+	uint16_t min_interval;
+	uint16_t max_interval;
+
+	bool operator==(const advertising_params_t& other) const {
+		return enabled == other.enabled && min_interval == other.min_interval && max_interval == other.max_interval;
+	}
+	bool operator!=(const advertising_params_t& other) const { return !(*this == other); }
+};
+
+/**
+ * @brief Default policy.
+ *
+ * Remote / Touch reconnect to the server on every operation, so advertise fast (20-30 ms) for 30 seconds after a
+ * disconnect or a registration, slow (625-937.5 ms) when idle, and not at all while every session slot is in use
+ * and no session can be evicted.
+ */
+inline advertising_params_t
+default_advertising_policy(const advertising_context_t& ctx) {
+	constexpr uint32_t FAST_PERIOD_MS = 30'000;
+	if (ctx.connections >= ctx.max_connections || (ctx.connections >= ctx.max_sessions && ctx.evictable == 0)) {
+		return {false, 0, 0};
+	}
+	if (ctx.since_disconnect_ms < FAST_PERIOD_MS || ctx.since_registration_ms < FAST_PERIOD_MS) {
+		return {true, 32, 48};
+	}
+	return {true, 1000, 1500};
+}
+
+}  // namespace libsesame3bt
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace libsesame3bt {
+
+/// @brief Connection parameters. Interval in units of 1.25 ms, supervision timeout in units of 10 ms.
+struct conn_params_t {
+	uint16_t min_interval;
+	uint16_t max_interval;
+	uint16_t latency;
+	uint16_t timeout;
+};
+
+/// @brief Connection parameters requested for a kind of device.
+struct conn_profile_t {
+	/// requested after login and while commands are exchanged
+	conn_params_t active;
+	/// requested after idle_after_ms without a command
+	conn_params_t idle;
+	uint32_t idle_after_ms;
+};
+
+/// Default profile: 7.5-15 ms with no slave latency while active, 30-50 ms with latency 4 after 2 seconds idle.
+constexpr conn_profile_t default_conn_profile{{6, 12, 0, 200}, {24, 40, 4, 400}, 2'000};
+
+/**
+ * @brief Decides when a session should switch between the active and idle connection parameters.
+ *
+ * @tparam N Number of session slots (same indices as SessionTable).
+ */
+template <size_t N>
+class ConnParamManager {
+ public:
+	/// @brief Session logged in. @return parameters to request.
+	const conn_params_t& on_login(size_t slot, const conn_profile_t& profile, uint32_t now) {
+		auto& s = slots[slot];
+		s.profile = profile;
+		s.managed = true;
+		s.active = true;
+		s.last_activity = now;
+		return profile.active;
+	}
+
+	/// @brief Command received. @return parameters to request if the session was idle.
+	std::optional<conn_params_t> on_command(size_t slot, uint32_t now) {
+		auto& s = slots[slot];
+		s.last_activity = now;
+		if (!s.managed || s.active) {
+			return std::nullopt;
+		}
+		s.active = true;
+		return s.profile.active;
+	}
+
+	/// @brief Check idle timeout. @return parameters to request if the session became idle.
+	std::optional<conn_params_t> check_idle(size_t slot, uint32_t now, bool busy) {
+		auto& s = slots[slot];
+		if (busy) {
+			s.last_activity = now;
+			return std::nullopt;
+		}
+		if (!s.managed || !s.active || now - s.last_activity < s.profile.idle_after_ms) {
+			return std::nullopt;
+		}
+		s.active = false;
+		return s.profile.idle;
+	}
+
+	/// @brief Record parameters the central actually applied.
+	void on_updated(size_t slot, const conn_params_t& params) { slots[slot].negotiated = params; }
+	const std::optional<conn_params_t>& get_negotiated(size_t slot) const { return slots[slot].negotiated; }
+
+	void reset(size_t slot) { slots[slot] = slot_t{}; }
+
+ private:
+	struct slot_t {
+		conn_profile_t profile = default_conn_profile;
+		std::optional<conn_params_t> negotiated;
+		uint32_t last_activity = 0;
+		bool managed = false;
+		bool active = false;
+	};
+	std::array<slot_t, N> slots{};
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+
+namespace libsesame3bt {
+
+enum class log_level_t : uint8_t { none = 0, error = 1, warn = 2, info = 3, debug = 4 };
+
+/// @brief Bytes printed as lowercase hex for a %s conversion, copied when the line is recorded.
+struct log_hex_t {
+	const void* data;
+	size_t size;
+};
+
+inline log_hex_t
+log_hex(const void* data, size_t size) {
+	return {data, size};
+}
+
+template <typename Container>
+log_hex_t
+log_hex(const Container& c) {
+	return {std::data(c), std::size(c) * sizeof(*std::data(c))};
+}
+
+/**
+ * @brief Bounded lock-free multi-producer / single-consumer buffer of log lines.
+ *
+ * write() stores the format string pointer (must be a string literal) and the arguments, copying strings into the
+ * entry, and never blocks; when the buffer is full the line is dropped and counted. The consumer formats the lines
+ * later with printf semantics (flags, width and precision; length modifiers are ignored, `*` is not supported).
+ *
+ * @tparam N Number of lines, must be a power of two.
+ * @tparam MaxArgs Arguments per line.
+ * @tparam TextSize Bytes per line for copied strings and hex dumps (longer ones are truncated).
+ */
+template <size_t N, size_t MaxArgs = 6, size_t TextSize = 64>
+class DeferredLog {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "DeferredLog size must be a power of two");
+	static_assert(TextSize <= UINT8_MAX, "DeferredLog TextSize must fit in uint8_t");
+
+ public:
+	struct entry_t {
+		const char* format;
+		log_level_t level;
+		uint8_t nargs;
+		uint8_t text_used;
+		std::array<uint8_t, MaxArgs> types;
+		union value_t {
+			long long i;
+			unsigned long long u;
+			double f;
+			const void* p;
+			struct {
+				uint8_t offset;
+				uint8_t size;
+			} text;
+		};
+		std::array<value_t, MaxArgs> values;
+		char text[TextSize];
+	};
+
+	DeferredLog() {
+		for (size_t i = 0; i < N; i++) {
+			cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	/// @brief Record a line. @return false if the buffer is full (the line is counted as dropped).
+	template <typename... Args>
+	bool write(log_level_t level, const char* format, const Args&... args) {
+		auto pos = head.load(std::memory_order_relaxed);
+		cell_t* cell;
+		for (;;) {
+			cell = &cells[pos & (N - 1)];
+			auto seq = cell->seq.load(std::memory_order_acquire);
+			auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+			if (diff == 0) {
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			} else if (diff < 0) {
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			} else {
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+		encode(cell->entry, level, format, args...);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	/// @brief Take the oldest line (single consumer). @return false if empty.
+	bool pop(entry_t& entry) {
+		auto& cell = cells[tail & (N - 1)];
+		if (cell.seq.load(std::memory_order_acquire) != tail + 1) {
+			return false;
+		}
+		entry = cell.entry;
+		cell.seq.store(tail + N, std::memory_order_release);
+		++tail;
+		return true;
+	}
+
+	uint32_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+	static constexpr size_t capacity() { return N; }
+
+	template <typename... Args>
+	static void encode(entry_t& e, log_level_t level, const char* format, const Args&... args) {
+		static_assert(sizeof...(Args) <= MaxArgs, "too many log arguments");
+		e.format = format;
+		e.level = level;
+		e.nargs = 0;
+		e.text_used = 0;
+		(put(e, args), ...);
+	}
+
+	/**
+	 * @brief Format a recorded line.
+	 *
+	 * @return Length written to out (always NUL terminated, truncated to size - 1).
+	 */
+	static size_t format(const entry_t& e, char* out, size_t size) {
+		if (size == 0) {
+			return 0;
+		}
+		size_t pos = 0;
+		size_t arg = 0;
+		auto append = [&](int n) {
+			if (n > 0) {
+				pos += std::min(static_cast<size_t>(n), size - 1 - pos);
+			}
+		};
+		for (const char* p = e.format; *p && pos < size - 1;) {
+			if (*p != '%') {
+				out[pos++] = *p++;
+				continue;
+			}
+			if (p[1] == '%') {
+				out[pos++] = '%';
+				p += 2;
+				continue;
+			}
+			char spec[16] = {'%'};
+			size_t n = 1;
+			for (++p; *p && std::strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4; p++) {
+				spec[n++] = *p;
+			}
+			while (*p && std::strchr("hlLqjzt", *p)) {
+				p++;
+			}
+			char conv = *p;
+			if (!conv) {
+				break;
+			}
+			p++;
+			if (arg >= e.nargs) {
+				append(std::snprintf(out + pos, size - pos, "<?>"));
+				continue;
+			}
+			auto type = e.types[arg];
+			const auto& v = e.values[arg++];
+			bool integer = std::strchr("diouxX", conv) != nullptr;
+			bool floating = std::strchr("fFeEgGaA", conv) != nullptr;
+			if ((type == TYPE_SIGNED || type == TYPE_UNSIGNED) && (integer || conv == 'c')) {
+				if (conv == 'c') {
+					spec[n++] = 'c';
+					append(std::snprintf(out + pos, size - pos, spec, static_cast<int>(v.i)));
+				} else {
+					spec[n++] = 'l';
+					spec[n++] = 'l';
+					spec[n++] = conv;
+					if (conv == 'd' || conv == 'i') {
+						append(std::snprintf(out + pos, size - pos, spec, v.i));
+					} else {
+						append(std::snprintf(out + pos, size - pos, spec, v.u));
+					}
+				}
+			} else if (type == TYPE_DOUBLE && floating) {
+				spec[n++] = conv;
+				append(std::snprintf(out + pos, size - pos, spec, v.f));
+			} else if (type == TYPE_STRING && conv == 's') {
+				char s[TextSize + 1];
+				std::memcpy(s, e.text + v.text.offset, v.text.size);
+				s[v.text.size] = '\0';
+				spec[n++] = 's';
+				append(std::snprintf(out + pos, size - pos, spec, s));
+			} else if (type == TYPE_HEX && conv == 's') {
+				for (size_t i = 0; i < v.text.size && pos + 2 < size; i++) {
+					append(std::snprintf(out + pos, size - pos, "%02x", static_cast<uint8_t>(e.text[v.text.offset + i])));
+				}
+			} else if (type == TYPE_POINTER && conv == 'p') {
+				spec[n++] = 'p';
+				append(std::snprintf(out + pos, size - pos, spec, v.p));
+			} else {
+				append(std::snprintf(out + pos, size - pos, "<?>"));
+			}
+		}
+		out[pos] = '\0';
+		return pos;
+	}
+
+ private:
+	enum : uint8_t { TYPE_SIGNED, TYPE_UNSIGNED, TYPE_DOUBLE, TYPE_STRING, TYPE_HEX, TYPE_POINTER };
+
+	struct cell_t {
+		std::atomic<size_t> seq;
+		entry_t entry;
+	};
+	std::array<cell_t, N> cells;
+	std::atomic<size_t> head{0};
+	size_t tail = 0;
+	std::atomic<uint32_t> dropped{0};
+
+	template <typename T, std::enable_if_t<std::is_integral_v<T> || std::is_enum_v<T>, int> = 0>
+	static void put(entry_t& e, T value) {
+		auto& v = e.values[e.nargs];
+		if constexpr (std::is_enum_v<T>) {
+			v.u = static_cast<unsigned long long>(value);
+			e.types[e.nargs++] = TYPE_UNSIGNED;
+		} else if constexpr (std::is_signed_v<T>) {
+			v.i = value;
+			e.types[e.nargs++] = TYPE_SIGNED;
+		} else {
+			v.u = value;
+			e.types[e.nargs++] = TYPE_UNSIGNED;
+		}
+	}
+
+	template <typename T, std::enable_if_t<std::is_floating_point_v<T>, int> = 0>
+	static void put(entry_t& e, T value) {
+		e.values[e.nargs].f = value;
+		e.types[e.nargs++] = TYPE_DOUBLE;
+	}
+
+	static void put(entry_t& e, const char* s) {
+		if (!s) {
+			s = "(null)";
+		}
+		copy_text(e, s, std::min(std::strlen(s), TextSize - e.text_used), TYPE_STRING);
+	}
+
+	static void put(entry_t& e, const log_hex_t& hex) {
+		copy_text(e, hex.data, std::min(hex.size, TextSize - e.text_used), TYPE_HEX);
+	}
+
+	static void put(entry_t& e, const void* p) {
+		e.values[e.nargs].p = p;
+		e.types[e.nargs++] = TYPE_POINTER;
+	}
+
+	static void copy_text(entry_t& e, const void* data, size_t size, uint8_t type) {
+		auto& v = e.values[e.nargs];
+		v.text.offset = e.text_used;
+		v.text.size = static_cast<uint8_t>(size);
+		std::memcpy(e.text + e.text_used, data, size);
+		e.text_used += size;
+		e.types[e.nargs++] = type;
+	}
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Bounded lock-free single-producer / single-consumer queue.
+ *
+ * The producer is the NimBLE host task, the consumer is the application task. push() never blocks; when the queue
+ * is full the new item is dropped and counted.
+ *
+ * @tparam T Copyable item type.
+ * @tparam N Capacity, must be a power of two.
+ */
+template <typename T, size_t N>
+class EventQueue {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "EventQueue size must be a power of two");
+
+ public:
+	bool push(const T& item) {
+		auto h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) >= N) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		items[h & (N - 1)] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& item) {
+		auto t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) {
+			return false;
+		}
+		item = items[t & (N - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+	bool empty() const { return size() == 0; }
+	static constexpr size_t capacity() { return N; }
+	uint32_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+ private:
+	std::array<T, N> items{};
+	std::atomic<size_t> head{0};
+	std::atomic<size_t> tail{0};
+	std::atomic<uint32_t> dropped{0};
+};
+
+}  // namespace libsesame3bt
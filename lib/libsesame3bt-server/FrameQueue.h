@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Fixed size FIFO of TX segments for one session. Not thread-safe.
+ *
+ * @tparam Depth Maximum number of segments.
+ * @tparam MaxSize Maximum size of a segment.
+ */
+template <size_t Depth, size_t MaxSize>
+class FrameQueue {
+ public:
+	bool push(const uint8_t* data, size_t size) {
+		if (count >= Depth || size > MaxSize) {
+			return false;
+		}
+		auto& f = frames[(first + count) % Depth];
+		std::memcpy(f.data.data(), data, size);
+		f.size = size;
+		++count;
+		return true;
+	}
+
+	/// @brief Oldest segment. Must not be called when empty.
+	const uint8_t* front(size_t& size) const {
+		const auto& f = frames[first];
+		size = f.size;
+		return f.data.data();
+	}
+
+	void pop() {
+		if (count) {
+			first = (first + 1) % Depth;
+			--count;
+		}
+	}
+
+	void clear() { first = count = 0; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	static constexpr size_t capacity() { return Depth; }
+
+ private:
+	struct frame_t {
+		std::array<uint8_t, MaxSize> data;
+		size_t size;
+	};
+	std::array<frame_t, Depth> frames{};
+	size_t first = 0;
+	size_t count = 0;
+};
+
+}  // namespace libsesame3bt
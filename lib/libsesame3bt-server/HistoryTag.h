@@ -0,0 +1,40 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace libsesame3bt {
+
+/// @brief Binary form of a UUID history tag given as 32 hex digits, nullopt if the tag is not in that form.
+inline std::optional<std::array<std::byte, 16>>
+parse_uuid_tag(std::string_view tag) {
+	auto hex_value = [](char c) {
+		if (c >= '0' && c <= '9') {
+			return c - '0';
+		}
+		if (c >= 'a' && c <= 'f') {
+			return c - 'a' + 10;
+		}
+		if (c >= 'A' && c <= 'F') {
+			return c - 'A' + 10;
+		}
+		return -1;
+	};
+	std::array<std::byte, 16> uuid;
+	if (tag.size() != uuid.size() * 2) {
+		return std::nullopt;
+	}
+	for (size_t i = 0; i < uuid.size(); i++) {
+		int hi = hex_value(tag[i * 2]);
+		int lo = hex_value(tag[i * 2 + 1]);
+		if (hi < 0 || lo < 0) {
+			return std::nullopt;
+		}
+		uuid[i] = static_cast<std::byte>(hi << 4 | lo);
+	}
+	return uuid;
+}
+
+}  // namespace libsesame3bt
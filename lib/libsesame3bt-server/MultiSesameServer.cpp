@@ -0,0 +1,451 @@
+#include "MultiSesameServer.h"
+
+#if LIBSESAME3BT_SERVER_EXT_ADV
+
+#include "debug.h"
+
+namespace libsesame3bt {
+
+/**
+ * @brief Add a SESAME identity.
+ *
+ * @param model Model to emulate.
+ * @param uuid UUID of the identity, its BLE address is derived from it (see uuid_to_ble_address()).
+ * @param handler Receives the events of this identity only, must outlive the server.
+ * @return Identity id, nullopt if MAX_IDENTITIES are already added, the UUID is invalid or begin() is already called.
+ */
+std::optional<MultiSesameServer::identity_id_t>
+MultiSesameServer::add_identity(Sesame::model_t model, const NimBLEUUID& uuid, SesameServerHandler* handler) {
+	if (identity_count >= MAX_IDENTITIES || ble_server) {
+		return std::nullopt;
+	}
+	auto address = uuid_to_ble_address(uuid);
+	if (address.isNull()) {
+		return std::nullopt;
+	}
+	auto id = static_cast<identity_id_t>(identity_count);
+	auto& identity = identities[id].emplace(*this, max_sessions);
+	identity.model = model;
+	identity.uuid = uuid;
+	identity.address = address;
+	identity.handler = handler;
+	identity.core.set_on_registration_callback(
+	    [this, id](auto session_id, const auto& secret) { on_registration(id, session_id, secret); });
+	identity.core.set_on_command_callback([this, id](uint16_t session_id, Sesame::item_code_t cmd, const std::string& tag,
+	                                                 std::optional<history_tag_type_t> trigger_type, float scaled_voltage) {
+		return on_command(id, session_id, cmd, tag, trigger_type, scaled_voltage);
+	});
+	identity.core.set_on_login_callback([this, id](uint16_t session_id) { on_login(id, session_id); });
+	++identity_count;
+	return id;
+}
+
+bool
+MultiSesameServer::begin() {
+	start_server_log();
+	if (identity_count == 0) {
+		ERROR_PRINTLN("No identity added");
+		return false;
+	}
+	core_lock = xSemaphoreCreateRecursiveMutexStatic(&core_lock_buffer);
+	// the device address is used for the first set only, every set has its own address
+	if (!NimBLEDevice::init("Peripheral Demo") || !NimBLEDevice::setOwnAddrType(BLE_OWN_ADDR_RANDOM) ||
+	    !NimBLEDevice::setOwnAddr(identities[0]->address)) {
+		ERROR_PRINTLN("Failed to init BLE");
+		return false;
+	}
+	for (size_t i = 0; i < identity_count; i++) {
+		auto r_uuid = identities[i]->uuid;
+		r_uuid.to128();
+		r_uuid.reverseByteOrder();
+		if (!identities[i]->core.begin(identities[i]->model, *reinterpret_cast<const uint8_t (*)[16]>(r_uuid.getValue()))) {
+			return false;
+		}
+	}
+
+	adv = NimBLEDevice::getAdvertising();
+	ble_server = NimBLEDevice::createServer();
+	ble_server->setCallbacks(this, false);
+	// an advertising set stops when a central connects to it, restarted by restart_advertising()
+	ble_server->advertiseOnDisconnect(false);
+	srv = ble_server->createService(NimBLEUUID{Sesame::SESAME3_SRV_UUID});
+	// NimBLEService takes ownership of the characteristic
+	rx = new RxCharacteristic(*this);
+	srv->addCharacteristic(rx);
+	rx->setCallbacks(this);
+	tx = srv->createCharacteristic(NimBLEUUID(Sesame::RxUUID), NIMBLE_PROPERTY::NOTIFY | NIMBLE_PROPERTY::READ);
+	tx->setCallbacks(this);
+	srv->start();
+	// create dummy service to limit end handle value of CANDY HOUSE service group (SESAME3_SRV_UUID(0xfd81))
+	auto srv2 = ble_server->createService(NimBLEUUID(static_cast<uint32_t>(0xfefefefe)));
+	srv2->start();
+	ble_server->start();
+
+	for (size_t i = 0; i < identity_count; i++) {
+		if (!set_advertising_data(static_cast<identity_id_t>(i))) {
+			WARN_PRINTLN("Failed to set advertising data of identity %u", static_cast<unsigned>(i));
+		}
+	}
+	return true;
+}
+
+void
+MultiSesameServer::update() {
+	RecursiveSemaphoreLock lock{core_lock};
+	for (size_t i = 0; i < identity_count; i++) {
+		identities[i]->core.update();
+	}
+	flush_tx_queue();
+	restart_advertising();
+}
+
+bool
+MultiSesameServer::start_advertising() {
+	if (!adv) {
+		return false;
+	}
+	RecursiveSemaphoreLock lock{core_lock};
+	advertising_enabled = true;
+	restart_advertising();
+	return adv->isAdvertising();
+}
+
+bool
+MultiSesameServer::stop_advertising() {
+	if (!adv) {
+		return false;
+	}
+	advertising_enabled = false;
+	return adv->stop();
+}
+
+/// Start the sets that are not advertising (stopped by a connection), while a connection is available.
+void
+MultiSesameServer::restart_advertising() {
+	if (!adv || !advertising_enabled || sessions.size() >= sessions.capacity()) {
+		return;
+	}
+	for (size_t i = 0; i < identity_count; i++) {
+		auto id = static_cast<identity_id_t>(i);
+		if (!adv->isActive(id) && !adv->start(id)) {
+			WARN_PRINTLN("Failed to start advertising identity %u", static_cast<unsigned>(id));
+		}
+	}
+}
+
+/**
+ * @brief Configure the advertising set of the identity for its registration state.
+ * Instance parameters cannot change while the set is active, so an active set is restarted.
+ */
+bool
+MultiSesameServer::set_advertising_data(identity_id_t id) {
+	auto& identity = *identities[id];
+	auto [manu, name] = identity.core.create_advertisement_data_os3();
+	NimBLEExtAdvertisement data;
+	NimBLEExtAdvertisement scan_response;
+	data.setLegacyAdvertising(true);
+	data.setConnectable(true);
+	data.setScannable(true);
+	data.setAddress(identity.address);
+	data.setFlags(BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP);
+	if (!data.addServiceUUID(NimBLEUUID{Sesame::SESAME3_SRV_UUID}) || !data.setManufacturerData(manu) ||
+	    !scan_response.setName(name)) {
+		return false;
+	}
+	bool active = adv->isActive(id);
+	if (active) {
+		adv->stop(id);
+	}
+	if (!adv->setInstanceData(id, data) || !adv->setScanResponseData(id, scan_response)) {
+		return false;
+	}
+	return !active || adv->start(id);
+}
+
+/// Identity of the advertising set the connection was made to (by our address of the connection).
+std::optional<MultiSesameServer::identity_id_t>
+MultiSesameServer::route(uint16_t conn_handle) const {
+	ble_gap_conn_desc desc;
+	if (ble_gap_conn_find(conn_handle, &desc) != 0) {
+		return std::nullopt;
+	}
+	NimBLEAddress ours{desc.our_ota_addr};
+	for (size_t i = 0; i < identity_count; i++) {
+		if (identities[i]->address == ours) {
+			return static_cast<identity_id_t>(i);
+		}
+	}
+	return std::nullopt;
+}
+
+MultiSesameServer::identity_t*
+MultiSesameServer::find_identity(uint16_t session_id) {
+	auto* entry = sessions.find(session_id);
+	return entry ? &*identities[session_identity[sessions.index_of(*entry)]] : nullptr;
+}
+
+void
+MultiSesameServer::onConnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo) {
+	DEBUG_PRINTLN("Connected from = %012llx", static_cast<uint64_t>(connInfo.getAddress()));
+	auto id = route(connInfo.getConnHandle());
+	if (!id) {
+		DEBUG_PRINTLN("Connection to unknown identity");
+		ble_server->disconnect(connInfo);
+		return;
+	}
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* entry = sessions.add(connInfo.getConnHandle(), connInfo.getAddress());
+	if (!entry) {
+		WARN_PRINTLN("Session table full");
+		ble_server->disconnect(connInfo);
+		return;
+	}
+	session_identity[sessions.index_of(*entry)] = *id;
+	tx_queue.reset(sessions.index_of(*entry));
+	restart_advertising();
+}
+
+void
+MultiSesameServer::onDisconnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo, int reason) {
+	DEBUG_PRINTLN("Disconnected from = %012llx", static_cast<uint64_t>(connInfo.getAddress()));
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* identity = find_identity(connInfo.getConnHandle());
+	if (auto* entry = sessions.find(connInfo.getConnHandle())) {
+		tx_queue.reset(sessions.index_of(*entry));
+	}
+	sessions.remove(connInfo.getConnHandle());
+	if (identity) {
+		identity->core.on_disconnected(connInfo.getConnHandle());
+		if (identity->handler) {
+			identity->handler->on_disconnect(connInfo.getAddress(), reason);
+		}
+	}
+	restart_advertising();
+}
+
+void
+MultiSesameServer::onSubscribe(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo, uint16_t subValue) {
+	if (pCharacteristic != tx) {
+		DEBUG_PRINTLN("Unexpected endpoint subscribed");
+		ble_server->disconnect(connInfo);
+		return;
+	}
+	if (!(subValue & 1)) {
+		return;
+	}
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* identity = find_identity(connInfo.getConnHandle());
+	if (!identity || !identity->core.on_subscribed(connInfo.getConnHandle())) {
+		ble_server->disconnect(connInfo);
+		return;
+	}
+	if (auto* entry = sessions.find(connInfo.getConnHandle())) {
+		entry->subscribed = true;
+	}
+	if (identity->handler) {
+		identity->handler->on_connect(connInfo.getAddress());
+	}
+}
+
+void
+MultiSesameServer::on_rx_written(NimBLEConnInfo& connInfo, const uint8_t* data, size_t size) {
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* identity = find_identity(connInfo.getConnHandle());
+	if (identity) {
+		identity->published.apply(identity->core);
+	}
+	if (!identity || !identity->core.on_received(connInfo.getConnHandle(), reinterpret_cast<const std::byte*>(data), size)) {
+		WARN_PRINTLN("core.on_received failed, disconnect");
+		ble_server->disconnect(connInfo);
+	}
+}
+
+/**
+ * @brief Notify a segment from a core, or queue it if the host is out of buffers (or other segments are waiting).
+ * Queued segments are retried from update() as in SesameServer.
+ *
+ * @return false if the segment is dropped because the session's queue is full.
+ */
+bool
+MultiSesameServer::write_to_central(uint16_t session_id, const uint8_t* data, size_t size) {
+	if (!tx) {
+		ERROR_PRINTLN("TX characteristic not created, cannot proceed");
+		return false;
+	}
+	auto* entry = sessions.find(session_id);
+	if (!entry) {
+		return notify_segment(session_id, data, size);
+	}
+	if (!tx_queue.write(sessions.index_of(*entry), data, size,
+	                    [this, session_id](const uint8_t* data, size_t size) { return notify_segment(session_id, data, size); })) {
+		WARN_PRINTLN("TX queue of session %u full, segment dropped", session_id);
+		return false;
+	}
+	return true;
+}
+
+bool
+MultiSesameServer::notify_segment(uint16_t session_id, const uint8_t* data, size_t size) {
+	return tx->notify(data, size, session_id);
+}
+
+void
+MultiSesameServer::flush_tx_queue() {
+	if (!tx) {
+		return;
+	}
+	tx_queue.flush(sessions, [this](uint16_t session_id, const uint8_t* data, size_t size) { return notify_segment(session_id, data, size); });
+}
+
+MultiSesameServer::tx_queue_stats_t
+MultiSesameServer::get_tx_queue_stats() const {
+	RecursiveSemaphoreLock lock{core_lock};
+	return tx_queue.get_stats();
+}
+
+void
+MultiSesameServer::disconnect(uint16_t session_id) {
+	DEBUG_PRINTLN("Disconnecting session %u", session_id);
+	if (!ble_server->disconnect(session_id)) {
+		WARN_PRINTLN("Failed to disconnect session %u", session_id);
+	}
+}
+
+void
+MultiSesameServer::on_login(identity_id_t id, uint16_t session_id) {
+	if (auto* entry = sessions.find(session_id)) {
+		entry->logged_in = true;
+	}
+	if (identities[id]->handler) {
+		identities[id]->handler->on_login(get_peer_address(session_id));
+	}
+}
+
+void
+MultiSesameServer::on_registration(identity_id_t id,
+                                   uint16_t session_id,
+                                   const std::array<std::byte, Sesame::SECRET_SIZE>& secret) {
+	if (!set_advertising_data(id)) {
+		WARN_PRINTLN("Failed to update advertising data");
+	}
+	if (identities[id]->handler) {
+		identities[id]->handler->on_registration(get_peer_address(session_id), secret);
+	}
+}
+
+Sesame::result_code_t
+MultiSesameServer::on_command(identity_id_t id,
+                              uint16_t session_id,
+                              Sesame::item_code_t cmd,
+                              const std::string& tag,
+                              std::optional<history_tag_type_t> trigger_type,
+                              float scaled_voltage) {
+	auto* handler = identities[id]->handler;
+	if (!handler) {
+		return Sesame::result_code_t::not_supported;
+	}
+	return handler->on_command({get_peer_address(session_id), session_id, cmd, tag, trigger_type, scaled_voltage, 0});
+}
+
+bool
+MultiSesameServer::set_registered(identity_id_t id, const std::array<std::byte, Sesame::SECRET_SIZE>& secret) {
+	if (id >= identity_count) {
+		return false;
+	}
+	{
+		RecursiveSemaphoreLock lock{core_lock};
+		if (!identities[id]->core.set_registered(secret)) {
+			return false;
+		}
+	}
+	return !adv || set_advertising_data(id);
+}
+
+bool
+MultiSesameServer::send_lock_status(identity_id_t id, bool locked) {
+	Sesame::mecha_status_5_t status{};
+	status.battery = 6 * 500;
+	status.in_lock = locked;
+	status.in_unlock = !locked;
+	status.target = -32768;
+	status.is_stop = true;
+	return send_mecha_status(id, nullptr, status);
+}
+
+/**
+ * @brief Send mecha_status to a peer of the identity, or to all peers of the identity if address is nullptr.
+ * May be called from any task, calls into the cores are serialized with the NimBLE host task.
+ */
+bool
+MultiSesameServer::send_mecha_status(identity_id_t id, const NimBLEAddress* address, const Sesame::mecha_status_5_t& status) {
+	if (id >= identity_count) {
+		return false;
+	}
+	RecursiveSemaphoreLock lock{core_lock};
+	std::optional<uint16_t> session_id;
+	if (address) {
+		auto* entry = sessions.find(*address);
+		if (!entry || session_identity[sessions.index_of(*entry)] != id) {
+			DEBUG_PRINTLN("No session for address %012llx", static_cast<uint64_t>(*address));
+			return false;
+		}
+		session_id = entry->conn_handle;
+	}
+	return identities[id]->core.send_notify(session_id, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status,
+	                                        reinterpret_cast<const std::byte*>(&status), sizeof(status));
+}
+
+/// Setters below are safe from any task, the core receives the values on the host task with the next RX write.
+void
+MultiSesameServer::set_mecha_setting(identity_id_t id, const Sesame::mecha_setting_5_t& setting) {
+	if (id < identity_count) {
+		identities[id]->published.set_mecha_setting(setting);
+	}
+}
+
+void
+MultiSesameServer::set_mecha_status(identity_id_t id, const Sesame::mecha_status_5_t& status) {
+	if (id < identity_count) {
+		identities[id]->published.set_mecha_status(status);
+	}
+}
+
+void
+MultiSesameServer::set_auto_send_flags(identity_id_t id, auto_send::flags flags) {
+	if (id < identity_count) {
+		identities[id]->published.set_auto_send_flags(flags);
+	}
+}
+
+std::optional<MultiSesameServer::identity_id_t>
+MultiSesameServer::get_identity(const NimBLEAddress& peer) const {
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* entry = sessions.find(peer);
+	if (!entry) {
+		return std::nullopt;
+	}
+	return session_identity[sessions.index_of(*entry)];
+}
+
+void
+MultiSesameServer::disconnect(const NimBLEAddress& addr) {
+	RecursiveSemaphoreLock lock{core_lock};
+	if (auto* entry = sessions.find(addr)) {
+		// same reason as SesameServer::disconnect(), others make Remote / Touch forget the registration
+		ble_server->disconnect(entry->conn_handle, BLE_ERR_RD_CONN_TERM_RESRCS);
+	} else {
+		DEBUG_PRINTLN("No connection found for address %012llx", static_cast<uint64_t>(addr));
+	}
+}
+
+NimBLEAddress
+MultiSesameServer::get_peer_address(uint16_t session_id) const {
+	if (auto* entry = sessions.find(session_id)) {
+		return entry->address;
+	}
+	return ble_server->getPeerInfoByHandle(session_id).getAddress();
+}
+
+}  // namespace libsesame3bt
+
+#endif  // LIBSESAME3BT_SERVER_EXT_ADV
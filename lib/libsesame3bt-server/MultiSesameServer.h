@@ -0,0 +1,140 @@
+#pragma once
+
+#include "SesameServer.h"
+
+#if LIBSESAME3BT_SERVER_EXT_ADV
+
+/* Number of SESAME identities, one extended advertising set each */
+#ifndef LIBSESAME3BT_SERVER_MAX_IDENTITIES
+#ifdef CONFIG_BT_NIMBLE_MAX_EXT_ADV_INSTANCES
+#define LIBSESAME3BT_SERVER_MAX_IDENTITIES CONFIG_BT_NIMBLE_MAX_EXT_ADV_INSTANCES
+#else
+#define LIBSESAME3BT_SERVER_MAX_IDENTITIES 4
+#endif
+#endif
+
+namespace libsesame3bt {
+
+/**
+ * @brief Several emulated SESAME locks on one device.
+ *
+ * Each identity has its own SesameServerCore, UUID, secret and SesameServerHandler, and is advertised from its own
+ * extended advertising set (legacy PDUs, so Remote / Touch can see it) with the random static address derived from its
+ * UUID. All identities share one GATT server and the NimBLE connection pool; a connection is routed to the identity
+ * whose address the central connected to.
+ *
+ * Notifications the host cannot take are queued and retried as in SesameServer.
+ *
+ * Requires CONFIG_BT_NIMBLE_EXT_ADV=y and CONFIG_BT_NIMBLE_MAX_EXT_ADV_INSTANCES >= number of identities.
+ * Status coalescing, deferred commands, admission control and the other SesameServer options are not available here.
+ */
+class MultiSesameServer : private NimBLEServerCallbacks, private NimBLECharacteristicCallbacks, private core::ServerBLEBackend {
+ public:
+	using identity_id_t = uint8_t;
+	static constexpr size_t MAX_IDENTITIES = LIBSESAME3BT_SERVER_MAX_IDENTITIES;
+	using tx_queue_t =
+	    TxQueue<LIBSESAME3BT_SERVER_MAX_CONNECTIONS, LIBSESAME3BT_SERVER_TX_QUEUE_DEPTH, LIBSESAME3BT_SERVER_TX_SEGMENT_MAX>;
+	using tx_queue_stats_t = tx_queue_t::stats_t;
+
+	/// @param max_sessions Maximum sessions per identity.
+	MultiSesameServer(size_t max_sessions) : max_sessions(max_sessions) {}
+	MultiSesameServer(const MultiSesameServer&) = delete;
+	virtual ~MultiSesameServer() {}
+
+	/// @brief Add an identity, must be called before begin(). @return identity id (advertising instance).
+	std::optional<identity_id_t> add_identity(Sesame::model_t model, const NimBLEUUID& uuid, SesameServerHandler* handler);
+	bool begin();
+	bool start_advertising();
+	bool stop_advertising();
+	void update();
+
+	bool set_registered(identity_id_t id, const std::array<std::byte, Sesame::SECRET_SIZE>& secret);
+	bool is_registered(identity_id_t id) const {
+		RecursiveSemaphoreLock lock{core_lock};
+		return id < identity_count && identities[id]->core.is_registered();
+	}
+	size_t get_session_count(identity_id_t id) const {
+		RecursiveSemaphoreLock lock{core_lock};
+		return id < identity_count ? identities[id]->core.get_session_count() : 0;
+	}
+	bool send_lock_status(identity_id_t id, bool locked);
+	bool send_mecha_status(identity_id_t id, const NimBLEAddress* address, const Sesame::mecha_status_5_t& status);
+	void set_mecha_setting(identity_id_t id, const Sesame::mecha_setting_5_t& setting);
+	void set_mecha_status(identity_id_t id, const Sesame::mecha_status_5_t& status);
+	void set_auto_send_flags(identity_id_t id, auto_send::flags flags);
+
+	/// @brief Identity the peer is connected to.
+	std::optional<identity_id_t> get_identity(const NimBLEAddress& peer) const;
+	size_t get_identity_count() const { return identity_count; }
+	void disconnect(const NimBLEAddress& addr);
+	tx_queue_stats_t get_tx_queue_stats() const;
+
+ private:
+	class RxCharacteristic : public NimBLECharacteristic {
+	 public:
+		RxCharacteristic(MultiSesameServer& server)
+		    : NimBLECharacteristic(NimBLEUUID{Sesame::TxUUID}, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR), server(server) {}
+
+	 private:
+		MultiSesameServer& server;
+		virtual void writeEvent(const uint8_t* val, uint16_t len, NimBLEConnInfo& connInfo) override {
+			server.on_rx_written(connInfo, val, len);
+		}
+	};
+
+	struct identity_t {
+		identity_t(MultiSesameServer& server, size_t max_sessions) : core(server, max_sessions) {}
+		core::SesameServerCore core;
+		PublishedState<auto_send::flags> published;
+		Sesame::model_t model;
+		NimBLEUUID uuid;
+		NimBLEAddress address;
+		SesameServerHandler* handler;
+	};
+	using session_table_t = SessionTable<NimBLEAddress, LIBSESAME3BT_SERVER_MAX_CONNECTIONS>;
+
+	size_t max_sessions;
+	std::array<std::optional<identity_t>, MAX_IDENTITIES> identities;
+	size_t identity_count = 0;
+	// the cores, the session table and the TX queue are not thread-safe: held around every access, by the NimBLE host
+	// task callbacks and by send_*(), update() and the queries on the application task (see SesameServer::core_lock)
+	StaticSemaphore_t core_lock_buffer;
+	SemaphoreHandle_t core_lock = nullptr;
+	session_table_t sessions;
+	/// identity of each session slot
+	std::array<identity_id_t, LIBSESAME3BT_SERVER_MAX_CONNECTIONS> session_identity{};
+	bool advertising_enabled = false;
+	tx_queue_t tx_queue;
+
+	NimBLEExtAdvertising* adv = nullptr;
+	NimBLEServer* ble_server = nullptr;
+	NimBLEService* srv = nullptr;
+	NimBLECharacteristic* tx = nullptr;
+	NimBLECharacteristic* rx = nullptr;
+
+	virtual void onConnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo) override;
+	virtual void onDisconnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo, int reason) override;
+	virtual void onSubscribe(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo, uint16_t subValue) override;
+	void on_rx_written(NimBLEConnInfo& connInfo, const uint8_t* data, size_t size);
+	virtual bool write_to_central(uint16_t session_id, const uint8_t* data, size_t size) override;
+	bool notify_segment(uint16_t session_id, const uint8_t* data, size_t size);
+	void flush_tx_queue();
+	virtual void disconnect(uint16_t session_id) override;
+	void on_registration(identity_id_t id, uint16_t session_id, const std::array<std::byte, Sesame::SECRET_SIZE>& secret);
+	void on_login(identity_id_t id, uint16_t session_id);
+	Sesame::result_code_t on_command(identity_id_t id,
+	                                 uint16_t session_id,
+	                                 Sesame::item_code_t cmd,
+	                                 const std::string& tag,
+	                                 std::optional<history_tag_type_t> trigger_type,
+	                                 float scaled_voltage);
+	identity_t* find_identity(uint16_t session_id);
+	std::optional<identity_id_t> route(uint16_t conn_handle) const;
+	bool set_advertising_data(identity_id_t id);
+	void restart_advertising();
+	NimBLEAddress get_peer_address(uint16_t session_id) const;
+};
+
+}  // namespace libsesame3bt
+
+#endif  // LIBSESAME3BT_SERVER_EXT_ADV
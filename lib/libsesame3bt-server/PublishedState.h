@@ -0,0 +1,60 @@
+#pragma once
+
+#include <Sesame.h>
+#include <cstdint>
+#include "Seqlock.h"
+
+namespace libsesame3bt {
+
+/**
+ * @brief Status and setting the core sends on its own (login auto-send), published across tasks without a mutex.
+ *
+ * The application task publishes with the setters; the NimBLE host task calls apply() before it passes data to the
+ * core, so the core's copies are only ever written and read on the host task.
+ *
+ * @tparam Flags auto_send::flags of the core.
+ */
+template <typename Flags>
+class PublishedState {
+ public:
+	void set_mecha_status(const Sesame::mecha_status_5_t& status) { this->status.store(status); }
+	void set_mecha_setting(const Sesame::mecha_setting_5_t& setting) { this->setting.store(setting); }
+	void set_auto_send_flags(Flags flags) { this->flags.store(flags); }
+	/// @brief Latest published status. @return false if never published or a store is in progress (retry later).
+	bool get_mecha_status(Sesame::mecha_status_5_t& status) const { return this->status.version() && this->status.try_load(status); }
+	bool get_mecha_setting(Sesame::mecha_setting_5_t& setting) const {
+		return this->setting.version() && this->setting.try_load(setting);
+	}
+
+	/**
+	 * @brief Pass values published since the last call to the core (host task only).
+	 *
+	 * Never waits for a writer: a value being stored right now is applied by the next call.
+	 */
+	template <typename Core>
+	void apply(Core& core) {
+		apply(status, status_applied, [&](const auto& v) { core.set_mecha_status(v); });
+		apply(setting, setting_applied, [&](const auto& v) { core.set_mecha_setting(v); });
+		apply(flags, flags_applied, [&](const auto& v) { core.set_auto_send_flags(v); });
+	}
+
+ private:
+	Seqlock<Sesame::mecha_status_5_t> status;
+	Seqlock<Sesame::mecha_setting_5_t> setting;
+	Seqlock<Flags> flags;
+	uint32_t status_applied = 0;
+	uint32_t setting_applied = 0;
+	uint32_t flags_applied = 0;
+
+	template <typename T, typename Set>
+	static void apply(const Seqlock<T>& published, uint32_t& applied, Set&& set) {
+		auto version = published.version();
+		T value;
+		if (version != applied && published.try_load(value)) {
+			applied = version;
+			set(value);
+		}
+	}
+};
+
+}  // namespace libsesame3bt
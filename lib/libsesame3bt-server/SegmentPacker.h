@@ -0,0 +1,113 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Repacks the segments of a frame into as few notifications as the negotiated ATT MTU allows, and counts them.
+ *
+ * The core cuts frames into segments for the default MTU (header byte and up to 19 bytes). A segment header carries
+ * the frame start flag (bit 0) and, on the last segment, the frame kind (bits 1-7, 0 while more segments follow), so
+ * the payloads of one frame can be concatenated under the first header and re-cut at a larger limit. With the default
+ * MTU the output is identical to the input. Not thread-safe.
+ *
+ * @tparam N Number of session slots (same indices as SessionTable).
+ * @tparam MAX Largest notification produced.
+ */
+template <size_t N, size_t MAX>
+class SegmentPacker {
+	static_assert(MAX >= 2, "MAX must hold a header and a payload byte");
+
+ public:
+	static constexpr uint8_t START = 0x01;
+
+	struct stats_t {
+		uint32_t frames;
+		uint32_t segments;       ///< produced by the core
+		uint32_t notifications;  ///< sent to the peer
+		uint16_t last_frame;     ///< notifications of the last complete frame
+	};
+
+	/**
+	 * @brief Take a segment from the core, emit the notifications it completes.
+	 *
+	 * @param limit Largest notification the peer takes (ATT MTU - 3), 0 to pass segments through unchanged.
+	 * @param emit bool(const uint8_t* data, size_t size)
+	 * @return false if emit failed.
+	 */
+	template <typename Emit>
+	bool write(size_t slot, size_t limit, const uint8_t* data, size_t size, Emit&& emit) {
+		auto& s = slots[slot];
+		if (size == 0) {
+			return emit(data, size);
+		}
+		bool start = data[0] & START;
+		bool last = (data[0] & ~START) != 0;
+		if (start) {
+			++s.stats.frames;
+			s.frame_notifications = 0;
+			s.used = 0;
+		}
+		++s.stats.segments;
+		if (limit == 0 || (s.used == 0 && start && last)) {
+			return send(s, data, size, last, emit);
+		}
+		limit = limit < MAX ? limit : MAX;
+		if (s.used == 0) {
+			s.buffer[0] = data[0] & START;
+			s.used = 1;
+		}
+		const uint8_t* payload = data + 1;
+		size_t remain = size - 1;
+		while (s.used + remain > limit) {
+			size_t n = limit - s.used;
+			std::memcpy(s.buffer.data() + s.used, payload, n);
+			payload += n;
+			remain -= n;
+			if (!send(s, s.buffer.data(), limit, false, emit)) {
+				s.used = 0;
+				return false;
+			}
+			s.buffer[0] = 0;  // continuation
+			s.used = 1;
+		}
+		std::memcpy(s.buffer.data() + s.used, payload, remain);
+		s.used += remain;
+		if (!last) {
+			return true;
+		}
+		s.buffer[0] |= data[0] & ~START;
+		size_t used = s.used;
+		s.used = 0;
+		return send(s, s.buffer.data(), used, true, emit);
+	}
+
+	/// @brief Drop a partial frame and the statistics of the slot (new connection).
+	void reset(size_t slot) { slots[slot] = slot_t{}; }
+	const stats_t& get_stats(size_t slot) const { return slots[slot].stats; }
+
+ private:
+	struct slot_t {
+		std::array<uint8_t, MAX> buffer{};
+		size_t used = 0;
+		uint16_t frame_notifications = 0;
+		stats_t stats{};
+	};
+	std::array<slot_t, N> slots{};
+
+	template <typename Emit>
+	static bool send(slot_t& s, const uint8_t* data, size_t size, bool last, Emit& emit) {
+		++s.stats.notifications;
+		++s.frame_notifications;
+		if (last) {
+			s.stats.last_frame = s.frame_notifications;
+		}
+		return emit(data, size);
+	}
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+namespace libsesame3bt {
+
+/// Holds a FreeRTOS mutex for the scope, no-op if the mutex is not created.
+class SemaphoreLock {
+ public:
+	SemaphoreLock(SemaphoreHandle_t sem) : sem(sem) {
+		if (sem) {
+			xSemaphoreTake(sem, portMAX_DELAY);
+		}
+	}
+	~SemaphoreLock() {
+		if (sem) {
+			xSemaphoreGive(sem);
+		}
+	}
+	SemaphoreLock(const SemaphoreLock&) = delete;
+
+ private:
+	SemaphoreHandle_t sem;
+};
+
+/// Holds a FreeRTOS recursive mutex for the scope, no-op if the mutex is not created.
+class RecursiveSemaphoreLock {
+ public:
+	RecursiveSemaphoreLock(SemaphoreHandle_t sem) : sem(sem) {
+		if (sem) {
+			xSemaphoreTakeRecursive(sem, portMAX_DELAY);
+		}
+	}
+	~RecursiveSemaphoreLock() {
+		if (sem) {
+			xSemaphoreGiveRecursive(sem);
+		}
+	}
+	RecursiveSemaphoreLock(const RecursiveSemaphoreLock&) = delete;
+
+ private:
+	SemaphoreHandle_t sem;
+};
+
+}  // namespace libsesame3bt
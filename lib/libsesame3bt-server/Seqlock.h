@@ -0,0 +1,80 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Lock-free published value (seqlock): readers never block writers and never see a torn value.
+ *
+ * The value is stored as atomic words between two updates of an even/odd sequence. A writer makes the sequence odd,
+ * stores the words and makes it even again; concurrent writers spin on the odd sequence (publishing is rare and
+ * short). A reader copies the words and retries if the sequence was odd or changed meanwhile.
+ *
+ * @tparam T Trivially copyable value type.
+ */
+template <typename T>
+class Seqlock {
+	static_assert(std::is_trivially_copyable_v<T>, "Seqlock value must be trivially copyable");
+
+ public:
+	Seqlock() = default;
+	explicit Seqlock(const T& value) { store(value); }
+
+	void store(const T& value) {
+		auto seq = sequence.load(std::memory_order_relaxed);
+		for (;;) {
+			if ((seq & 1) == 0 && sequence.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire)) {
+				break;
+			}
+			seq = sequence.load(std::memory_order_relaxed);
+		}
+		std::array<uint32_t, WORDS> buf{};
+		std::memcpy(buf.data(), &value, sizeof(T));
+		for (size_t i = 0; i < WORDS; i++) {
+			// release: a reader that sees this word also sees the odd sequence
+			words[i].store(buf[i], std::memory_order_release);
+		}
+		sequence.store(seq + 2, std::memory_order_release);
+	}
+
+	/// @brief Spins while a store is in progress: not for a task that can preempt the writer on the same core.
+	T load() const {
+		T value;
+		while (!try_load(value)) {
+		}
+		return value;
+	}
+
+	/// @brief Copy the value unless a writer is active or interferes. @return false if the copy must be retried.
+	bool try_load(T& value) const {
+		auto before = sequence.load(std::memory_order_acquire);
+		if (before & 1) {
+			return false;
+		}
+		std::array<uint32_t, WORDS> buf;
+		for (size_t i = 0; i < WORDS; i++) {
+			buf[i] = words[i].load(std::memory_order_acquire);
+		}
+		if (sequence.load(std::memory_order_relaxed) != before) {
+			return false;
+		}
+		std::memcpy(&value, buf.data(), sizeof(T));
+		return true;
+	}
+
+	/// @brief Even number that changes with each store() (0: never stored).
+	uint32_t version() const { return sequence.load(std::memory_order_acquire) & ~1u; }
+
+ private:
+	static constexpr size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+	std::atomic<uint32_t> sequence{0};
+	std::array<std::atomic<uint32_t>, WORDS> words{};
+};
+
+}  // namespace libsesame3bt
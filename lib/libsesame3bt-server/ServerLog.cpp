@@ -0,0 +1,92 @@
+#include "ServerLog.h"
+#include "debug.h"
+
+#if LIBSESAME3BT_SERVER_LOG_LEVEL
+#include <Arduino.h>
+#include <freertos/task.h>
+#endif
+
+namespace libsesame3bt {
+
+#if LIBSESAME3BT_SERVER_LOG_LEVEL && LIBSESAME3BT_SERVER_LOG_DEFERRED
+
+namespace log_detail {
+
+server_log_t server_log;
+
+}  // namespace log_detail
+
+namespace {
+
+constexpr uint32_t LOG_TASK_STACK = 3072;
+constexpr uint32_t LOG_FLUSH_INTERVAL_MS = 20;
+
+StaticTask_t log_task_buffer;
+StackType_t log_task_stack[LOG_TASK_STACK];
+TaskHandle_t log_task;
+
+void
+print_log(void*) {
+	using log_detail::server_log;
+	static char line[192];
+	log_detail::server_log_t::entry_t entry;
+	uint32_t reported = 0;
+	for (;;) {
+		while (server_log.pop(entry)) {
+			log_detail::server_log_t::format(entry, line, sizeof(line));
+			Serial.println(line);
+		}
+		if (auto dropped = server_log.get_dropped(); dropped != reported) {
+			Serial.printf("(%u log lines dropped)\n", static_cast<unsigned>(dropped - reported));
+			reported = dropped;
+		}
+		vTaskDelay(pdMS_TO_TICKS(LOG_FLUSH_INTERVAL_MS));
+	}
+}
+
+}  // namespace
+
+/**
+ * @brief Start the task printing the deferred library log to Serial. Called by begin() of the servers.
+ *
+ * Lines logged before the task starts are kept up to LIBSESAME3BT_SERVER_LOG_SIZE.
+ *
+ * @param priority Task priority, keep it below the NimBLE host task.
+ * @return false if the task cannot be created.
+ */
+bool
+start_server_log(UBaseType_t priority) {
+	if (!log_task) {
+		log_task = xTaskCreateStatic(print_log, "sesame_log", LOG_TASK_STACK, nullptr, priority, log_task_stack, &log_task_buffer);
+	}
+	return log_task != nullptr;
+}
+
+/// @brief Log lines dropped because the log task did not keep up.
+uint32_t
+get_server_log_dropped() {
+	return log_detail::server_log.get_dropped();
+}
+
+#else
+
+#if LIBSESAME3BT_SERVER_LOG_LEVEL
+void
+log_detail::print_line(const char* line) {
+	Serial.println(line);
+}
+#endif
+
+bool
+start_server_log(UBaseType_t) {
+	return true;
+}
+
+uint32_t
+get_server_log_dropped() {
+	return 0;
+}
+
+#endif
+
+}  // namespace libsesame3bt
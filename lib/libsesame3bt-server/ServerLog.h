@@ -0,0 +1,30 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <cstdint>
+
+/* Library log level: 0 none, 1 error, 2 warn, 3 info, 4 debug (messages above the level are compiled out) */
+#ifndef LIBSESAME3BT_SERVER_LOG_LEVEL
+#if LIBSESAME3BT_SERVER_DEBUG
+#define LIBSESAME3BT_SERVER_LOG_LEVEL 4
+#else
+#define LIBSESAME3BT_SERVER_LOG_LEVEL 0
+#endif
+#endif
+
+/* Queue log lines and print them from a low priority task (1), or print them in place (0) */
+#ifndef LIBSESAME3BT_SERVER_LOG_DEFERRED
+#define LIBSESAME3BT_SERVER_LOG_DEFERRED 1
+#endif
+
+/* Log lines buffered until the log task prints them (power of two) */
+#ifndef LIBSESAME3BT_SERVER_LOG_SIZE
+#define LIBSESAME3BT_SERVER_LOG_SIZE 32
+#endif
+
+namespace libsesame3bt {
+
+bool start_server_log(UBaseType_t priority = tskIDLE_PRIORITY + 1);
+uint32_t get_server_log_dropped();
+
+}  // namespace libsesame3bt
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <Sesame.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace libsesame3bt {
+
+/**
+ * @brief State derived by SesameServer::begin(), persisted by the application for begin_from_snapshot().
+ *
+ * Plain bytes: store it as it is (e.g. Preferences::putBytes()). Holds the shared secret, protect it like the secret.
+ */
+struct server_snapshot_t {
+	static constexpr uint32_t MAGIC = 0x50533353;  // "S3SP" in little-endian byte order
+	static constexpr uint16_t VERSION = 1;
+	static constexpr size_t MAX_PAYLOAD = 31;
+
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;  ///< sizeof(server_snapshot_t)
+	int8_t model;   ///< Sesame::model_t
+	uint8_t registered;
+	uint8_t manufacturer_data_size;
+	uint8_t name_size;
+	uint8_t uuid[16];    ///< 128 bit UUID in NimBLEUUID byte order
+	uint8_t address[6];  ///< random static address derived from the UUID (NimBLEAddress byte order)
+	uint8_t reserved[2];
+	std::byte secret[Sesame::SECRET_SIZE];
+	/// advertising payload of the registration state above
+	uint8_t manufacturer_data[MAX_PAYLOAD];
+	char name[MAX_PAYLOAD];
+	uint8_t reserved2[2];
+	uint32_t crc;  ///< CRC-32 of the preceding bytes
+};
+static_assert(sizeof(server_snapshot_t) % 4 == 0, "server_snapshot_t must not have tail padding");
+
+/// @brief CRC-32 (IEEE 802.3).
+inline uint32_t
+snapshot_crc32(const void* data, size_t size) {
+	uint32_t crc = 0xffffffff;
+	auto* p = static_cast<const uint8_t*>(data);
+	for (size_t i = 0; i < size; i++) {
+		crc ^= p[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+/// @brief Set the header and checksum after the fields are filled.
+inline void
+seal_snapshot(server_snapshot_t& snapshot) {
+	snapshot.magic = server_snapshot_t::MAGIC;
+	snapshot.version = server_snapshot_t::VERSION;
+	snapshot.size = sizeof(server_snapshot_t);
+	snapshot.crc = snapshot_crc32(&snapshot, offsetof(server_snapshot_t, crc));
+}
+
+inline bool
+is_valid_snapshot(const server_snapshot_t& snapshot) {
+	return snapshot.magic == server_snapshot_t::MAGIC && snapshot.version == server_snapshot_t::VERSION &&
+	       snapshot.size == sizeof(server_snapshot_t) && snapshot.manufacturer_data_size <= server_snapshot_t::MAX_PAYLOAD &&
+	       snapshot.name_size <= server_snapshot_t::MAX_PAYLOAD &&
+	       snapshot.crc == snapshot_crc32(&snapshot, offsetof(server_snapshot_t, crc));
+}
+
+/// @brief Microseconds since boot (esp_timer) at the steps of the last begin(), 0 if not reached.
+struct boot_timing_t {
+	uint32_t begin_us;
+	uint32_t ble_ready_us;          ///< NimBLE initialized, own address set
+	uint32_t core_ready_us;         ///< core started, advertising data set
+	uint32_t gatt_ready_us;         ///< GATT server started
+	uint32_t first_advertising_us;  ///< advertising started for the first time
+	bool from_snapshot;
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Histogram with power-of-two buckets.
+ *
+ * Bucket 0 counts 0, bucket i (1 <= i < BUCKETS - 1) counts [2^(i-1), 2^i), the last bucket counts everything above.
+ */
+struct latency_histogram_t {
+	static constexpr size_t BUCKETS = 16;
+
+	std::array<uint32_t, BUCKETS> counts;
+	uint32_t max;
+
+	void add(uint32_t value) {
+		size_t bucket = 0;
+		for (auto v = value; v && bucket < BUCKETS - 1; v >>= 1) {
+			++bucket;
+		}
+		++counts[bucket];
+		if (value > max) {
+			max = value;
+		}
+	}
+	/// Lower bound of the bucket
+	static constexpr uint32_t bucket_floor(size_t bucket) { return bucket == 0 ? 0 : 1u << (bucket - 1); }
+	uint32_t total() const {
+		uint32_t n = 0;
+		for (auto c : counts) {
+			n += c;
+		}
+		return n;
+	}
+};
+
+/// @brief Snapshot of SesameServer statistics, see SesameServer::get_stats().
+struct server_stats_t {
+	/// connection phases in milliseconds
+	latency_histogram_t connect_to_subscribe_ms;
+	latency_histogram_t subscribe_to_login_ms;
+	latency_histogram_t login_to_first_command_ms;
+	latency_histogram_t connect_to_first_command_ms;
+	/// time spent in the command handler / callback in microseconds
+	latency_histogram_t command_handler_us;
+	/// time for a connection to arrive after advertising (re)started / after the previous disconnect, in milliseconds
+	latency_histogram_t advertising_to_connect_ms;
+	latency_histogram_t disconnect_to_connect_ms;
+	/// notifications sent per frame (segments after packing, see SesameServer::enable_link_negotiation())
+	latency_histogram_t notifications_per_frame;
+
+	uint32_t connects;
+	uint32_t subscribes;
+	uint32_t rejected_subscribes;
+	uint32_t logins;
+	uint32_t registrations;
+	/// commands by Sesame::item_code_t
+	std::array<uint32_t, 256> commands;
+	/// writes core.on_received() failed (the session is disconnected)
+	uint32_t rejected_writes;
+	/// segments dropped because the session's TX queue was full
+	uint32_t notify_failures;
+	/// sessions disconnected by the admission control for a new peer / for idle or login timeout
+	uint32_t evictions;
+	uint32_t idle_disconnects;
+	/// disconnects by HCI reason code (NimBLE reason - BLE_HS_ERR_HCI_BASE), non HCI reasons are counted in [0]
+	std::array<uint32_t, 256> disconnect_reasons;
+};
+
+/**
+ * @brief Collects server_stats_t and per-session phase timestamps.
+ *
+ * Updated from the NimBLE host task. Counters are plain integers: a snapshot taken from another task may be slightly
+ * inconsistent but is never blocked.
+ *
+ * @tparam N Number of session slots (same indices as SessionTable).
+ */
+template <size_t N>
+class ServerStats {
+ public:
+	void on_connect(size_t slot, uint32_t now_us) {
+		++stats.connects;
+		slots[slot] = slot_t{now_us};
+	}
+	void on_connect_arrival(std::optional<uint32_t> since_advertising_ms, std::optional<uint32_t> since_disconnect_ms) {
+		if (since_advertising_ms) {
+			stats.advertising_to_connect_ms.add(*since_advertising_ms);
+		}
+		if (since_disconnect_ms) {
+			stats.disconnect_to_connect_ms.add(*since_disconnect_ms);
+		}
+	}
+	void on_subscribe(size_t slot, uint32_t now_us, bool accepted) {
+		if (!accepted) {
+			++stats.rejected_subscribes;
+			return;
+		}
+		++stats.subscribes;
+		slots[slot].subscribed_us = now_us;
+		stats.connect_to_subscribe_ms.add(ms(now_us - slots[slot].connected_us));
+	}
+	void on_login(size_t slot, uint32_t now_us) {
+		++stats.logins;
+		slots[slot].login_us = now_us;
+		if (slots[slot].subscribed_us) {
+			stats.subscribe_to_login_ms.add(ms(now_us - slots[slot].subscribed_us));
+		}
+	}
+	void on_registration() { ++stats.registrations; }
+	void on_command(size_t slot, uint8_t item_code, uint32_t started_us, uint32_t now_us) {
+		++stats.commands[item_code];
+		stats.command_handler_us.add(now_us - started_us);
+		auto& s = slots[slot];
+		if (!s.commanded) {
+			s.commanded = true;
+			if (s.login_us) {
+				stats.login_to_first_command_ms.add(ms(started_us - s.login_us));
+			}
+			stats.connect_to_first_command_ms.add(ms(started_us - s.connected_us));
+		}
+	}
+	void on_frame_sent(uint16_t notifications) { stats.notifications_per_frame.add(notifications); }
+	void on_rejected_write() { ++stats.rejected_writes; }
+	void on_notify_failure() { ++stats.notify_failures; }
+	void on_eviction(bool idle) { ++(idle ? stats.idle_disconnects : stats.evictions); }
+	void on_disconnect(int hci_reason) { ++stats.disconnect_reasons[hci_reason >= 0 && hci_reason < 256 ? hci_reason : 0]; }
+
+	const server_stats_t& get() const { return stats; }
+	void reset() { stats = server_stats_t{}; }
+
+ private:
+	struct slot_t {
+		uint32_t connected_us = 0;
+		uint32_t subscribed_us = 0;
+		uint32_t login_us = 0;
+		bool commanded = false;
+	};
+	server_stats_t stats{};
+	std::array<slot_t, N> slots{};
+
+	static uint32_t ms(uint32_t us) { return us / 1000; }
+};
+
+}  // namespace libsesame3bt
@@ -1,19 +1,172 @@
 #include "SesameServer.h"
+#include <esp_timer.h>
+#include <freertos/task.h>
+#include <algorithm>
+#include <cstring>
 #include <libsesame3bt/ScannerCore.h>
 #include <libsesame3bt/util.h>
 #include "debug.h"
 
 namespace libsesame3bt {
 
+/// @brief Retrieve a BLE address from SESAME UUID (SESAME 5 and later).
+/// @param uuid The SESAME UUID to convert.
+/// @return BLE address. If error occurred, empty NimBLEAddress is returned (test with isNull()).
+NimBLEAddress
+uuid_to_ble_address(const NimBLEUUID& uuid) {
+	if (uuid.bitSize() != 128) {
+		ERROR_PRINTLN("Invalid UUID size, must be 128 bits");
+		return {};
+	}
+	NimBLEUUID r_uuid{uuid};
+	r_uuid.reverseByteOrder();
+	auto b_addr = libsesame3bt::core::SesameServerCore::uuid_to_ble_address(
+	    *reinterpret_cast<const std::byte(*)[16]>(reinterpret_cast<const std::byte*>(r_uuid.getValue())));
+	return {reinterpret_cast<const uint8_t*>(b_addr.data()), BLE_ADDR_RANDOM};
+}
+
+#if !LIBSESAME3BT_SERVER_EXT_ADV
+
 namespace util = libsesame3bt::core::util;
 
+#if LIBSESAME3BT_SERVER_STATS
+#define SERVER_STATS(...) stats.__VA_ARGS__
+#else
+#define SERVER_STATS(...) \
+	do {                    \
+	} while (false)
+#endif
+
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+#define SERVER_TRACE(conn_handle, type, arg, value) trace.record(now_us(), (conn_handle), trace_type_t::type, (arg), (value))
+#else
+#define SERVER_TRACE(...) \
+	do {                    \
+	} while (false)
+#endif
+
+namespace {
+
+server_event_t
+make_event(server_event_t::type_t type, uint16_t session_id, const NimBLEAddress& address) {
+	server_event_t event{};
+	event.type = type;
+	event.session_id = session_id;
+	event.address = address;
+	return event;
+}
+
+uint32_t
+now_ms() {
+	return static_cast<uint32_t>(esp_timer_get_time() / 1000);
+}
+
+[[maybe_unused]] uint32_t
+now_us() {
+	return static_cast<uint32_t>(esp_timer_get_time());
+}
+
+}  // namespace
+
 bool
 SesameServer::begin(Sesame::model_t model, const NimBLEUUID& my_uuid) {
+	start_server_log();
+	boot_timing = {};
+	boot_timing.begin_us = now_us();
 	auto server_address = SesameServer::uuid_to_ble_address(my_uuid);
 	if (server_address.isNull()) {
-		DEBUG_PRINTLN("Failed to convert UUID to BLE address");
+		ERROR_PRINTLN("Failed to convert UUID to BLE address");
+		return false;
+	}
+	auto uuid = my_uuid;
+	uuid.to128();
+	return start(model, uuid, server_address);
+}
+
+/**
+ * @brief Start from the state saved by make_snapshot() and start advertising.
+ *
+ * Skips the address derivation and the advertising payload construction, and restores the registration.
+ * Callbacks and options must be set before, as for begin().
+ *
+ * @return false if the snapshot is invalid (use begin() instead) or the server cannot be started.
+ */
+bool
+SesameServer::begin_from_snapshot(const server_snapshot_t& snapshot) {
+	start_server_log();
+	boot_timing = {};
+	boot_timing.begin_us = now_us();
+	boot_timing.from_snapshot = true;
+	if (!is_valid_snapshot(snapshot)) {
+		WARN_PRINTLN("Invalid snapshot");
+		return false;
+	}
+	if (snapshot.registered) {
+		std::array<std::byte, Sesame::SECRET_SIZE> restored;
+		std::copy(std::begin(snapshot.secret), std::end(snapshot.secret), restored.begin());
+		if (!set_registered(restored)) {
+			return false;
+		}
+	}
+	if (!build_advertising_payload(
+	        advertising_payloads[snapshot.registered ? 1 : 0],
+	        std::string(reinterpret_cast<const char*>(snapshot.manufacturer_data), snapshot.manufacturer_data_size),
+	        std::string(snapshot.name, snapshot.name_size))) {
+		return false;
+	}
+	if (!start(static_cast<Sesame::model_t>(snapshot.model), NimBLEUUID{snapshot.uuid, sizeof(snapshot.uuid)},
+	           NimBLEAddress{snapshot.address, BLE_ADDR_RANDOM})) {
+		return false;
+	}
+	return start_advertising();
+}
+
+/**
+ * @brief Save the state derived by begin() and the registration for begin_from_snapshot().
+ *
+ * Take a new snapshot after registration (e.g. from the registration callback).
+ */
+bool
+SesameServer::make_snapshot(server_snapshot_t& snapshot) const {
+	if (!ble_server) {
+		return false;
+	}
+	auto [manu, name] = core.create_advertisement_data_os3();
+	if (manu.size() > server_snapshot_t::MAX_PAYLOAD || name.size() > server_snapshot_t::MAX_PAYLOAD ||
+	    core.is_registered() != secret.has_value()) {
+		return false;
+	}
+	snapshot = {};
+	snapshot.model = static_cast<int8_t>(model);
+	snapshot.registered = core.is_registered();
+	std::memcpy(snapshot.uuid, uuid.getValue(), sizeof(snapshot.uuid));
+	std::memcpy(snapshot.address, address.getVal(), sizeof(snapshot.address));
+	if (secret) {
+		std::copy(secret->begin(), secret->end(), snapshot.secret);
+	}
+	snapshot.manufacturer_data_size = manu.size();
+	std::memcpy(snapshot.manufacturer_data, manu.data(), manu.size());
+	snapshot.name_size = name.size();
+	std::memcpy(snapshot.name, name.data(), name.size());
+	seal_snapshot(snapshot);
+	return true;
+}
+
+bool
+SesameServer::set_registered(const std::array<std::byte, Sesame::SECRET_SIZE>& secret) {
+	RecursiveSemaphoreLock lock{core_lock};
+	if (!core.set_registered(secret)) {
 		return false;
 	}
+	this->secret = secret;
+	return true;
+}
+
+bool
+SesameServer::start(Sesame::model_t model, const NimBLEUUID& uuid, const NimBLEAddress& address) {
+	this->model = model;
+	this->uuid = uuid;
+	this->address = address;
 	core.set_on_registration_callback([this](auto session_id, const auto& secret) { on_registration(session_id, secret); });
 	core.set_on_command_callback(
 	    [this](uint16_t session_id, Sesame::item_code_t cmd, const std::string& tag, std::optional<history_tag_type_t> trigger_type,
@@ -21,29 +174,36 @@ SesameServer::begin(Sesame::model_t model, const NimBLEUUID& my_uuid) {
 	core.set_on_login_callback([this](uint16_t session_id) { on_login(session_id); });
 
 	if (!NimBLEDevice::init("Peripheral Demo") || !NimBLEDevice::setOwnAddrType(BLE_OWN_ADDR_RANDOM) ||
-	    !NimBLEDevice::setOwnAddr(server_address)) {
-		DEBUG_PRINTLN("Failed to init BLE");
+	    !NimBLEDevice::setOwnAddr(address)) {
+		ERROR_PRINTLN("Failed to init BLE");
 		return false;
 	}
+	boot_timing.ble_ready_us = now_us();
 
-	auto r_uuid = my_uuid;
-	r_uuid.to128();
+	auto r_uuid = uuid;
 	r_uuid.reverseByteOrder();
 	if (!core.begin(model, *reinterpret_cast<const uint8_t (*)[16]>(r_uuid.getValue()))) {
 		return false;
 	}
 
 	adv = NimBLEDevice::getAdvertising();
-	adv->setMinInterval(1000);
-	adv->setMaxInterval(1500);
+	core_lock = xSemaphoreCreateRecursiveMutexStatic(&core_lock_buffer);
+	adv_lock = xSemaphoreCreateMutexStatic(&adv_lock_buffer);
 	if (!set_advertising_data()) {
-		DEBUG_PRINTLN("Failed to set advertising data");
+		WARN_PRINTLN("Failed to set advertising data");
 	}
+	boot_timing.core_ready_us = now_us();
 
 	ble_server = NimBLEDevice::createServer();
 	ble_server->setCallbacks(this, false);
+	// advertising is restarted by apply_advertising_policy()
+	ble_server->advertiseOnDisconnect(false);
+	// fixed creation order: attribute handles and the Database Hash (CONFIG_BT_NIMBLE_GATT_CACHING) are the same on every
+	// boot, including begin_from_snapshot(), so centrals that cache the database can skip discovery on reconnect
 	srv = ble_server->createService(NimBLEUUID{Sesame::SESAME3_SRV_UUID});
-	rx = srv->createCharacteristic(NimBLEUUID{Sesame::TxUUID}, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR);
+	// NimBLEService takes ownership of the characteristic
+	rx = new RxCharacteristic(*this);
+	srv->addCharacteristic(rx);
 	rx->setCallbacks(this);
 	tx = srv->createCharacteristic(NimBLEUUID(Sesame::RxUUID), NIMBLE_PROPERTY::NOTIFY | NIMBLE_PROPERTY::READ);
 	tx->setCallbacks(this);
@@ -52,20 +212,82 @@ SesameServer::begin(Sesame::model_t model, const NimBLEUUID& my_uuid) {
 	auto srv2 = ble_server->createService(NimBLEUUID(static_cast<uint32_t>(0xfefefefe)));
 	srv2->start();
 	ble_server->start();
+	boot_timing.gatt_ready_us = now_us();
 
 	return true;
 }
 
+/**
+ * @brief Time-driven work: core timeouts, admission and idle checks, deferred command timeouts, queued notifications,
+ * coalesced broadcasts and the advertising policy. Call periodically from the application task.
+ * Runs under core_lock, like the NimBLE host task callbacks that reset the same per-session state.
+ */
 void
 SesameServer::update() {
 	if (!ble_server) {
 		return;
 	}
+	RecursiveSemaphoreLock lock{core_lock};
 	core.update();
+	if (admission_enabled) {
+		admission.check_idle(
+		    now_ms(), sessions, [this](size_t slot) { return is_busy(slot); }, [this](size_t slot) { evict(slot, true); });
+	}
+	apply_advertising_policy();
+	if (conn_profile || conn_profile_selector) {
+		auto now = now_ms();
+		for (const auto& peer : sessions.logged_in()) {
+			auto* pending = find_pending(peer.conn_handle);
+			if (auto params = conn_params.check_idle(sessions.index_of(peer), now, pending && pending->token)) {
+				request_conn_params(peer.conn_handle, *params);
+			}
+		}
+	}
+	if (deferred_commands) {
+		auto now = now_ms();
+		for (auto& pending : pending_commands) {
+			if (pending.token && static_cast<int32_t>(now - pending.deadline) >= 0) {
+				WARN_PRINTLN("Command %u timed out", static_cast<unsigned>(pending.token));
+				finish_command(pending, false);
+			}
+		}
+	}
+	flush_tx_queue();
+	if (coalesce_status) {
+		broadcaster.flush(now_ms(), sessions, [this](uint16_t session_id, const Sesame::mecha_status_5_t& status) {
+			return send_notify(session_id, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status,
+			                   reinterpret_cast<const std::byte*>(&status), sizeof(status));
+		});
+	}
+}
+
+/**
+ * @brief Coalesce status broadcasts (send_lock_status() and send_mecha_status(nullptr, ...)).
+ *
+ * Broadcasts are then sent from update(): statuses posted within window_ms are merged into the latest one, a session
+ * is not sent a status equal to the last one it received, and not more often than every min_interval_ms.
+ * Pass 0, 0 to send broadcasts immediately (default).
+ */
+void
+SesameServer::set_status_coalescing(uint32_t window_ms, uint32_t min_interval_ms) {
+	coalesce_status = window_ms != 0 || min_interval_ms != 0;
+	broadcaster.set_window(window_ms, min_interval_ms);
+}
+
+bool
+SesameServer::broadcast_mecha_status(const Sesame::mecha_status_5_t& status) {
+	RecursiveSemaphoreLock lock{core_lock};
+	if (coalesce_status) {
+		broadcaster.post(status, now_ms());
+		return true;
+	}
+	return send_notify({}, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status, reinterpret_cast<const std::byte*>(&status),
+	                   sizeof(status));
 }
 
 /**
  * @brief Send mecha_status to a specific device or all connected devices.
+ * May be called from any task, calls into the core are serialized with the NimBLE host task.
  *
  * @param address The address of the device to send the status to. If nullptr, send to all connected devices.
  * @param status The mecha_status_5_t structure containing the status information.
@@ -75,16 +297,22 @@ SesameServer::update() {
 bool
 SesameServer::send_mecha_status(const NimBLEAddress* address, const Sesame::mecha_status_5_t& status) {
 	if (address == nullptr) {
-		return send_notify({}, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status,
-		                   reinterpret_cast<const std::byte*>(&status), sizeof(status));
+		return broadcast_mecha_status(status);
 	}
+	RecursiveSemaphoreLock lock{core_lock};
 	auto session_id = get_session_id(*address);
 	if (!session_id.has_value()) {
-		DEBUG_PRINTLN("No session for address %s", address->toString().c_str());
+		DEBUG_PRINTLN("No session for address %012llx", static_cast<uint64_t>(*address));
 		return false;
 	}
-	return send_notify(*session_id, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status,
-	                   reinterpret_cast<const std::byte*>(&status), sizeof(status));
+	if (!send_notify(*session_id, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status,
+	                 reinterpret_cast<const std::byte*>(&status), sizeof(status))) {
+		return false;
+	}
+	if (auto* entry = sessions.find(*session_id)) {
+		broadcaster.on_sent(sessions.index_of(*entry), status, now_ms());
+	}
+	return true;
 }
 
 bool
@@ -95,39 +323,316 @@ SesameServer::send_lock_status(bool locked) {
 	status.in_unlock = !locked;
 	status.target = -32768;
 	status.is_stop = true;
-	return send_notify({}, Sesame::op_code_t::publish, Sesame::item_code_t::mech_status, reinterpret_cast<std::byte*>(&status),
-	                   sizeof(status));
+	return broadcast_mecha_status(status);
+}
+
+/// Frame to one or all sessions through the core, from the application task or the NimBLE host task.
+bool
+SesameServer::send_notify(std::optional<uint16_t> session_id,
+                          Sesame::op_code_t op_code,
+                          Sesame::item_code_t item_code,
+                          const std::byte* data,
+                          size_t size) {
+	RecursiveSemaphoreLock lock{core_lock};
+	return core.send_notify(session_id, op_code, item_code, data, size);
 }
 
 void
 SesameServer::onConnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo) {
-	DEBUG_PRINTLN("Connected from = %s", connInfo.getAddress().toString().c_str());
-	start_advertising();
+	DEBUG_PRINTLN("Connected from = %012llx", static_cast<uint64_t>(connInfo.getAddress()));
+	SERVER_TRACE(connInfo.getConnHandle(), connect, 0, 0);
+	RecursiveSemaphoreLock lock{core_lock};
+	if (auto* entry = sessions.add(connInfo.getConnHandle(), connInfo.getAddress())) {
+		broadcaster.reset(sessions.index_of(*entry));
+		tx_queue.reset(sessions.index_of(*entry));
+		packer.reset(sessions.index_of(*entry));
+		entry->mtu = connInfo.getMTU();
+		if (data_len) {
+			ble_server->setDataLen(connInfo.getConnHandle(), data_len);
+		}
+		SERVER_STATS(on_connect(sessions.index_of(*entry), now_us()));
+		conn_params.reset(sessions.index_of(*entry));
+		conn_params.on_updated(sessions.index_of(*entry), {connInfo.getConnInterval(), connInfo.getConnInterval(),
+		                                                   connInfo.getConnLatency(), connInfo.getConnTimeout()});
+		if (admission_enabled) {
+			auto priority = peer_priority_selector ? peer_priority_selector(entry->address) : peer_priority_t::normal;
+			admission.on_connect(sessions.index_of(*entry), priority, now_ms());
+			// start evicting now so the slot is likely free before the peer subscribes
+			if (sessions.size() > max_sessions + admission.evicting(sessions)) {
+				make_room(sessions.index_of(*entry));
+			}
+		}
+	} else {
+		WARN_PRINTLN("Session table full");
+	}
+	post_event(make_event(server_event_t::type_t::connect, connInfo.getConnHandle(), connInfo.getAddress()));
+#if LIBSESAME3BT_SERVER_STATS
+	{
+		SemaphoreLock lock{adv_lock};
+		auto now = now_ms();
+		stats.on_connect_arrival(advertising_applied.enabled ? std::make_optional(now - advertising_started_ms) : std::nullopt,
+		                         reconnect_pending ? std::make_optional(now - *last_disconnect_ms) : std::nullopt);
+		reconnect_pending = false;
+	}
+#endif
+	apply_advertising_policy();
 }
 
 void
 SesameServer::onDisconnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo, int reason) {
-	DEBUG_PRINTLN("Disconnected from = %s", connInfo.getAddress().toString().c_str());
+	DEBUG_PRINTLN("Disconnected from = %012llx", static_cast<uint64_t>(connInfo.getAddress()));
+	SERVER_TRACE(connInfo.getConnHandle(), disconnect, 0, static_cast<uint32_t>(reason));
+	SERVER_STATS(on_disconnect(reason - BLE_HS_ERR_HCI_BASE));
+	{
+		SemaphoreLock lock{adv_lock};
+		last_disconnect_ms = now_ms();
+		reconnect_pending = true;
+	}
+	RecursiveSemaphoreLock lock{core_lock};
 	core.on_disconnected(connInfo.getConnHandle());
-	if (disconnect_callback) {
-		disconnect_callback(connInfo.getAddress(), reason);
+	if (auto* pending = find_pending(connInfo.getConnHandle())) {
+		*pending = pending_command_t{};
+	}
+	if (auto* entry = sessions.find(connInfo.getConnHandle())) {
+		admission.reset(sessions.index_of(*entry));
+		tx_queue.reset(sessions.index_of(*entry));
 	}
+	sessions.remove(connInfo.getConnHandle());
+	if (admission_enabled) {
+		// peers that could not get a session while the evicted one was still connected
+		for (size_t i = 0; i < sessions.capacity(); i++) {
+			const auto& entry = sessions.at(i);
+			if (!entry.in_use() || !admission.is_waiting(i)) {
+				continue;
+			}
+			admission.set_waiting(i, false);
+			if (!accept_subscription(entry.conn_handle, entry.address)) {
+				if (admission.evicting(sessions)) {
+					admission.set_waiting(i, true);
+				} else {
+					DEBUG_PRINTLN("No session for waiting peer %012llx", static_cast<uint64_t>(entry.address));
+					SERVER_STATS(on_subscribe(i, now_us(), false));
+					ble_server->disconnect(entry.conn_handle);
+				}
+			}
+		}
+	}
+	apply_advertising_policy();
+	if (event_signal) {
+		auto event = make_event(server_event_t::type_t::disconnect, connInfo.getConnHandle(), connInfo.getAddress());
+		event.reason = reason;
+		post_event(event);
+	}
+	handler->on_disconnect(connInfo.getAddress(), reason);
 }
 
+/**
+ * @brief Start advertising. Interval and pauses are then controlled by the advertising policy.
+ */
 bool
 SesameServer::start_advertising() {
-	if (adv) {
-		return adv->start();
+	if (!adv) {
+		return false;
 	}
-	return false;
+	{
+		SemaphoreLock lock{adv_lock};
+		advertising_enabled = true;
+		advertising_enabled_ms = now_ms();
+	}
+	apply_advertising_policy();
+	return advertising_applied.enabled || adv->isAdvertising();
 }
 
 bool
 SesameServer::stop_advertising() {
-	if (adv) {
-		return adv->stop();
+	if (!adv) {
+		return false;
+	}
+	SemaphoreLock lock{adv_lock};
+	advertising_enabled = false;
+	advertising_applied.enabled = false;
+	return adv->stop();
+}
+
+/**
+ * @brief Accept connections only from peers that logged in before.
+ *
+ * Peers are learned on login and installed in the controller's filter accept list, restore the persisted ones with
+ * add_known_peer(). Any peer may connect while unregistered, while no peer is known and during open_enrollment().
+ * Peers using resolvable private addresses (smartphones) are not recognized once their address changes.
+ *
+ * @param callback Called from the NimBLE host task when a peer is learned or evicted to make room.
+ */
+bool
+SesameServer::enable_accept_list(accept_list_callback_t callback) {
+	if (!adv) {
+		return false;
+	}
+	{
+		SemaphoreLock lock{adv_lock};
+		accept_list_enabled = true;
+		accept_list_callback = callback;
+	}
+	apply_advertising_policy();
+	return true;
+}
+
+/**
+ * @brief Restore a known peer (the accept list callback is not called).
+ * @return false if the accept list is not enabled or full.
+ */
+bool
+SesameServer::add_known_peer(const NimBLEAddress& addr) {
+	if (!accept_list_enabled) {
+		return false;
+	}
+	{
+		SemaphoreLock lock{adv_lock};
+		if (accept_list.contains(addr)) {
+			return true;
+		}
+		if (accept_list.full()) {
+			return false;
+		}
+		std::optional<NimBLEAddress> evicted;
+		accept_list.learn(addr, now_ms(), evicted);
+		if (!update_controller_list(&addr, nullptr)) {
+			WARN_PRINTLN("Failed to add %012llx to filter accept list", static_cast<uint64_t>(addr));
+		}
+	}
+	apply_advertising_policy();
+	return true;
+}
+
+/// @brief Remove a peer from the accept list (the accept list callback is not called).
+bool
+SesameServer::forget_peer(const NimBLEAddress& addr) {
+	{
+		SemaphoreLock lock{adv_lock};
+		if (!accept_list.remove(addr)) {
+			return false;
+		}
+		update_controller_list(nullptr, &addr);
+	}
+	apply_advertising_policy();
+	return true;
+}
+
+size_t
+SesameServer::get_known_peers(NimBLEAddress* out, size_t max) const {
+	SemaphoreLock lock{adv_lock};
+	return accept_list.get(out, max);
+}
+
+/// @brief Accept connections from any peer for duration_ms (0 closes the window), to enroll a new Remote / Touch.
+void
+SesameServer::open_enrollment(uint32_t duration_ms) {
+	{
+		SemaphoreLock lock{adv_lock};
+		accept_list.open(now_ms(), duration_ms);
+	}
+	apply_advertising_policy();
+}
+
+void
+SesameServer::learn_peer(const NimBLEAddress& addr) {
+	std::optional<NimBLEAddress> evicted;
+	{
+		SemaphoreLock lock{adv_lock};
+		if (!accept_list.learn(addr, now_ms(), evicted)) {
+			return;
+		}
+		if (!update_controller_list(&addr, evicted ? &*evicted : nullptr)) {
+			WARN_PRINTLN("Failed to update filter accept list");
+		}
+	}
+	DEBUG_PRINTLN("Learned peer %012llx", static_cast<uint64_t>(addr));
+	apply_advertising_policy();
+	if (accept_list_callback) {
+		if (evicted) {
+			accept_list_callback(*evicted, false);
+		}
+		accept_list_callback(addr, true);
+	}
+}
+
+/**
+ * @brief Mirror an accept list change to the controller, which rejects it while advertising uses the list: such
+ * advertising is stopped here and restarted by apply_advertising_policy(). Called with adv_lock held.
+ */
+bool
+SesameServer::update_controller_list(const NimBLEAddress* add, const NimBLEAddress* remove) {
+	if (filter_applied && adv->isAdvertising()) {
+		adv->stop();
+	}
+	bool ok = true;
+	if (remove && !NimBLEDevice::whiteListRemove(*remove)) {
+		ok = false;
+	}
+	if (add && !NimBLEDevice::whiteListAdd(*add)) {
+		ok = false;
+	}
+	return ok;
+}
+
+/**
+ * @brief Evaluate the advertising policy and restart advertising if the requested parameters changed.
+ * Called from the connection callbacks (NimBLE host task) and update().
+ */
+void
+SesameServer::apply_advertising_policy() {
+	if (!adv || !advertising_enabled) {
+		return;
+	}
+	// the context and the policy read the session table and the core
+	RecursiveSemaphoreLock state{core_lock};
+	SemaphoreLock lock{adv_lock};
+	auto now = now_ms();
+	advertising_context_t context{
+	    now - last_disconnect_ms.value_or(advertising_enabled_ms),
+	    last_registration_ms ? now - *last_registration_ms : UINT32_MAX,
+	    sessions.size(),
+	    max_sessions,
+	    sessions.capacity(),
+	    admission_enabled ? admission.evictable(peer_priority_t::high, now, sessions, [this](size_t slot) { return is_busy(slot); })
+	                      : 0,
+	    core.is_registered(),
+	};
+	auto params = advertising_policy ? advertising_policy(context) : default_advertising_policy(context);
+	bool filter = accept_list_enabled && core.is_registered() && accept_list.size() > 0 && !accept_list.is_open(now);
+	bool running = adv->isAdvertising();
+	if (!params.enabled) {
+		if (running) {
+			DEBUG_PRINTLN("Advertising paused");
+			adv->stop();
+		}
+		advertising_applied = params;
+		return;
+	}
+	if (running && params == advertising_applied && filter == filter_applied) {
+		return;
+	}
+	if (running) {
+		adv->stop();
+	}
+	adv->setMinInterval(params.min_interval);
+	adv->setMaxInterval(params.max_interval);
+	adv->setScanFilter(false, filter);
+	if (adv->start()) {
+		if (filter != filter_applied) {
+			DEBUG_PRINTLN("Connections from %s", filter ? "known peers" : "any peer");
+		}
+		filter_applied = filter;
+		if (!boot_timing.first_advertising_us) {
+			boot_timing.first_advertising_us = now_us();
+		}
+		DEBUG_PRINTLN("Advertising interval %u-%u", params.min_interval, params.max_interval);
+		advertising_applied = params;
+		advertising_started_ms = now;
+	} else {
+		WARN_PRINTLN("Failed to start advertising");
+		advertising_applied.enabled = false;
 	}
-	return false;
 }
 
 void
@@ -137,16 +642,41 @@ SesameServer::onSubscribe(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo&
 		ble_server->disconnect(connInfo);
 		return;
 	}
-	DEBUG_PRINTLN("Subscribed from=%s, val=%u", connInfo.getAddress().toString().c_str(), subValue);
+	DEBUG_PRINTLN("Subscribed from=%012llx, val=%u", static_cast<uint64_t>(connInfo.getAddress()), subValue);
+	RecursiveSemaphoreLock lock{core_lock};
 	if ((subValue & 1)) {
-		if (core.on_subscribed(connInfo.getConnHandle())) {
-			if (connect_callback) {
-				connect_callback(connInfo.getAddress());
+		if (accept_subscription(connInfo.getConnHandle(), connInfo.getAddress())) {
+			SERVER_TRACE(connInfo.getConnHandle(), subscribe, 0, 1);
+			return;
+		}
+		SERVER_TRACE(connInfo.getConnHandle(), subscribe, 0, 0);
+		if (admission_enabled) {
+			auto* entry = sessions.find(connInfo.getConnHandle());
+			if (entry && (admission.evicting(sessions) || make_room(sessions.index_of(*entry)))) {
+				DEBUG_PRINTLN("No session available, waiting for eviction");
+				admission.set_waiting(sessions.index_of(*entry), true);
+				return;
 			}
-		} else {
-			ble_server->disconnect(connInfo);
 		}
+		SERVER_STATS(on_subscribe(0, now_us(), false));
+		ble_server->disconnect(connInfo);
+	}
+}
+
+/// Start a core session for the peer. @return false if the core has no session available.
+bool
+SesameServer::accept_subscription(uint16_t session_id, const NimBLEAddress& address) {
+	RecursiveSemaphoreLock lock{core_lock};
+	if (!core.on_subscribed(session_id)) {
+		return false;
 	}
+	if (auto* entry = sessions.find(session_id)) {
+		entry->subscribed = true;
+		SERVER_STATS(on_subscribe(sessions.index_of(*entry), now_us(), true));
+	}
+	post_event(make_event(server_event_t::type_t::subscribe, session_id, address));
+	handler->on_connect(address);
+	return true;
 }
 
 void
@@ -160,52 +690,209 @@ SesameServer::onRead(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& conn
 
 void
 SesameServer::onWrite(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo) {
-	if (pCharacteristic == rx) {
-		auto val = pCharacteristic->getValue();
-		if (!core.on_received(connInfo.getConnHandle(), reinterpret_cast<const std::byte*>(val.data()), val.size())) {
-			DEBUG_PRINTLN("core.on_received failed, disconnect");
-			ble_server->disconnect(connInfo);
-		}
-	} else if (pCharacteristic == tx) {
+	// RX writes are delivered through RxCharacteristic::writeEvent()
+	if (pCharacteristic == tx) {
 		DEBUG_PRINTLN("onWrite TX(ignored)");
 	}
 }
 
+/**
+ * @brief Pass the RX write payload to the core.
+ *
+ * @param connInfo Connection of the writer.
+ * @param data Payload flattened from the host mbuf by NimBLEServer. Only valid during this call.
+ * @param size Payload size.
+ */
+void
+SesameServer::on_rx_written(NimBLEConnInfo& connInfo, const uint8_t* data, size_t size) {
+	SERVER_TRACE(connInfo.getConnHandle(), rx_write, size ? data[0] : 0, size);
+	RecursiveSemaphoreLock lock{core_lock};
+	published.apply(core);
+	if (!core.on_received(connInfo.getConnHandle(), reinterpret_cast<const std::byte*>(data), size)) {
+		WARN_PRINTLN("core.on_received failed, disconnect");
+		SERVER_TRACE(connInfo.getConnHandle(), rx_rejected, size ? data[0] : 0, size);
+		SERVER_STATS(on_rejected_write());
+		ble_server->disconnect(connInfo);
+	}
+}
+
+/**
+ * @brief Segment from the core: repacked for the session's MTU if enabled, then held or transmitted.
+ */
 bool
 SesameServer::write_to_central(uint16_t session_id, const uint8_t* data, size_t size) {
-	if (tx) {
-		tx->notify(data, size, session_id);
-		return true;
+	auto* entry = sessions.find(session_id);
+	if (!entry) {
+		return write_segment(session_id, data, size);
 	}
-	DEBUG_PRINTLN("TX characteristic not created, cannot proceed");
-	return false;
+	auto slot = sessions.index_of(*entry);
+	size_t limit = pack_segments ? entry->mtu - 3 : 0;
+	bool sent = packer.write(slot, limit, data, size,
+	                         [this, session_id](const uint8_t* data, size_t size) { return write_segment(session_id, data, size); });
+	if (size && (data[0] & ~packer_t::START)) {
+		SERVER_STATS(on_frame_sent(packer.get_stats(slot).last_frame));
+	}
+	return sent;
+}
+
+bool
+SesameServer::write_segment(uint16_t session_id, const uint8_t* data, size_t size) {
+	if (auto* pending = find_pending(session_id)) {
+		if (pending->holding) {
+			if (!pending->token) {
+				DEBUG_PRINTLN("Command failed, segment discarded");
+				return false;
+			}
+			if (!pending->held.push(data, size)) {
+				WARN_PRINTLN("Cannot hold segment of %u bytes", static_cast<unsigned>(size));
+				return false;
+			}
+			return true;
+		}
+	}
+	return transmit(session_id, data, size);
+}
+
+/**
+ * @brief Notify a segment, or queue it if the host is out of buffers (or other segments are waiting).
+ * Queued segments are retried from update(), which the application polls: NimBLE reports onStatus() from inside
+ * notify(), not when the host frees its buffers, so there is no event to retry them from.
+ *
+ * @return false if the segment is dropped because the session's queue is full.
+ */
+bool
+SesameServer::transmit(uint16_t session_id, const uint8_t* data, size_t size) {
+	if (!tx) {
+		ERROR_PRINTLN("TX characteristic not created, cannot proceed");
+		return false;
+	}
+	auto* entry = sessions.find(session_id);
+	if (!entry) {
+		return notify_segment(session_id, data, size);
+	}
+	if (!tx_queue.write(sessions.index_of(*entry), data, size,
+	                    [this, session_id](const uint8_t* data, size_t size) { return notify_segment(session_id, data, size); })) {
+		WARN_PRINTLN("TX queue of session %u full, segment dropped", session_id);
+		SERVER_TRACE(session_id, tx_dropped, size ? data[0] : 0, size);
+		SERVER_STATS(on_notify_failure());
+		return false;
+	}
+	return true;
+}
+
+bool
+SesameServer::notify_segment(uint16_t session_id, const uint8_t* data, size_t size) {
+	bool sent = tx->notify(data, size, session_id);
+	if (sent) {
+		SERVER_TRACE(session_id, tx_notify, size ? data[0] : 0, size);
+	} else {
+		SERVER_TRACE(session_id, tx_busy, size ? data[0] : 0, size);
+	}
+	return sent;
+}
+
+void
+SesameServer::flush_tx_queue() {
+	if (!tx) {
+		return;
+	}
+	tx_queue.flush(sessions, [this](uint16_t session_id, const uint8_t* data, size_t size) { return notify_segment(session_id, data, size); });
+}
+
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+/**
+ * @brief Copy the protocol trace (docs/trace.md) into buffer. May be called from any task.
+ *
+ * @param size Size of buffer, trace_dump_size() is always enough.
+ * @return Bytes written, 0 if buffer is too small for the current trace.
+ */
+size_t
+SesameServer::dump_trace(uint8_t* buffer, size_t size) const {
+	size_t pos = 0;
+	bool overflow = false;
+	trace.dump([&](const uint8_t* data, size_t n) {
+		if (overflow || size - pos < n) {
+			overflow = true;
+			return;
+		}
+		std::memcpy(buffer + pos, data, n);
+		pos += n;
+	});
+	return overflow ? 0 : pos;
+}
+#endif
+
+SesameServer::tx_queue_stats_t
+SesameServer::get_tx_queue_stats() const {
+	RecursiveSemaphoreLock lock{core_lock};
+	return tx_queue.get_stats();
+}
+
+SesameServer::broadcast_stats_t
+SesameServer::get_broadcast_stats() const {
+	RecursiveSemaphoreLock lock{core_lock};
+	return broadcaster.get_stats();
+}
+
+/// @brief Segments queued for the peer.
+size_t
+SesameServer::get_tx_queue_depth(const NimBLEAddress& addr) const {
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* entry = sessions.find(addr);
+	if (!entry) {
+		return 0;
+	}
+	return tx_queue.depth(sessions.index_of(*entry));
 }
 
 void
 SesameServer::disconnect(uint16_t session_id) {
 	DEBUG_PRINTLN("Disconnecting session %u", session_id);
-	if (ble_server->disconnect(session_id) != 0) {
-		DEBUG_PRINTLN("Failed to disconnect session %u", session_id);
+	if (!ble_server->disconnect(session_id)) {
+		WARN_PRINTLN("Failed to disconnect session %u", session_id);
 	}
 }
 
 void
 SesameServer::on_login(uint16_t session_id) {
-	if (login_callback) {
-		login_callback(ble_server->getPeerInfoByHandle(session_id).getAddress());
+	SERVER_TRACE(session_id, login, 0, 0);
+	if (auto* entry = sessions.find(session_id)) {
+		entry->logged_in = true;
+		admission.on_activity(sessions.index_of(*entry), now_ms());
+		SERVER_STATS(on_login(sessions.index_of(*entry), now_us()));
+		if (conn_profile || conn_profile_selector) {
+			auto profile = conn_profile_selector ? conn_profile_selector(entry->address) : *conn_profile;
+			request_conn_params(session_id, conn_params.on_login(sessions.index_of(*entry), profile, now_ms()));
+		}
 	}
+	if (accept_list_enabled) {
+		learn_peer(get_peer_address(session_id));
+	}
+	post_event(make_event(server_event_t::type_t::login, session_id, get_peer_address(session_id)));
+	handler->on_login(get_peer_address(session_id));
 }
 
 void
 SesameServer::on_registration(uint16_t session_id, const std::array<std::byte, Sesame::SECRET_SIZE>& secret) {
-	adv->stop();
-	if (!set_advertising_data()) {
-		DEBUG_PRINTLN("Failed to update advertising data");
+	SERVER_TRACE(session_id, registration, 0, 0);
+	SERVER_STATS(on_registration());
+	this->secret = secret;
+	{
+		// serialized with the application task's start / stop_advertising() and the advertising policy
+		SemaphoreLock lock{adv_lock};
+		// switch to the registered payload while advertising, without stop/start
+		if (!set_advertising_data()) {
+			WARN_PRINTLN("Failed to update advertising data");
+		}
+		last_registration_ms = now_ms();
 	}
-	adv->start();
-	if (registration_callback) {
-		registration_callback(ble_server->getPeerInfoByHandle(session_id).getAddress(), secret);
+	apply_advertising_policy();
+	if (event_signal) {
+		auto event = make_event(server_event_t::type_t::registration, session_id, get_peer_address(session_id));
+		event.secret = secret;
+		post_event(event);
 	}
+	handler->on_registration(get_peer_address(session_id), secret);
 }
 
 Sesame::result_code_t
@@ -214,66 +901,450 @@ SesameServer::on_command(uint16_t session_id,
                          const std::string& tag,
                          std::optional<history_tag_type_t> trigger_type,
                          float scaled_voltage) {
-	if (command_callback) {
-		return command_callback(ble_server->getPeerInfoByHandle(session_id).getAddress(), cmd, tag, trigger_type, scaled_voltage);
+	[[maybe_unused]] auto started = now_us();
+	if (auto* entry = sessions.find(session_id)) {
+		admission.on_activity(sessions.index_of(*entry), now_ms());
+		if (auto params = conn_params.on_command(sessions.index_of(*entry), now_ms())) {
+			request_conn_params(session_id, *params);
+		}
+	}
+	// the command callback answers synchronously, only a handler of the application and the event queue take a token
+	bool deferred = deferred_commands && (handler != &callbacks || (!callbacks.command && event_signal));
+	command_token_t token = deferred ? defer_command(session_id) : 0;
+	if (deferred && !token) {
+		return Sesame::result_code_t::busy;
+	}
+	auto result =
+	    handler->on_command({get_peer_address(session_id), session_id, cmd, tag, trigger_type, scaled_voltage, token});
+	if (token) {
+		// completed by complete_command()
+		result = Sesame::result_code_t::success;
+	}
+	SERVER_TRACE(session_id, command, static_cast<uint8_t>(cmd), static_cast<uint32_t>(result));
+#if LIBSESAME3BT_SERVER_STATS
+	if (auto* entry = sessions.find(session_id)) {
+		stats.on_command(sessions.index_of(*entry), static_cast<uint8_t>(cmd), started, now_us());
+	}
+#endif
+	if (event_signal) {
+		auto event = make_event(server_event_t::type_t::command, session_id, get_peer_address(session_id));
+		event.cmd = cmd;
+		event.result = result;
+		event.trigger_type = trigger_type;
+		event.scaled_voltage = scaled_voltage;
+		event.token = token;
+		event.tag_length = static_cast<uint8_t>(std::min(tag.size(), server_event_t::TAG_MAX));
+		tag.copy(event.tag_data, event.tag_length);
+		post_event(event);
+	}
+	return result;
+}
+
+void
+SesameServer::CallbackHandler::on_connect(const NimBLEAddress& addr) {
+	if (connect) {
+		connect(addr);
+	}
+}
+
+void
+SesameServer::CallbackHandler::on_login(const NimBLEAddress& addr) {
+	if (login) {
+		login(addr);
+	}
+}
+
+void
+SesameServer::CallbackHandler::on_registration(const NimBLEAddress& addr,
+                                               const std::array<std::byte, Sesame::SECRET_SIZE>& secret) {
+	if (registration) {
+		registration(addr, secret);
+	}
+}
+
+Sesame::result_code_t
+SesameServer::CallbackHandler::on_command(const command_event_t& event) {
+	if (command) {
+		return command(event.address, event.cmd, std::string{event.tag}, event.trigger_type, event.scaled_voltage);
+	}
+	// the application handles commands from wait_event()
+	return server.event_signal ? Sesame::result_code_t::success : Sesame::result_code_t::not_supported;
+}
+
+void
+SesameServer::CallbackHandler::on_disconnect(const NimBLEAddress& addr, int reason) {
+	if (disconnect) {
+		disconnect(addr, reason);
+	}
+}
+
+/**
+ * @brief Deliver connect / subscribe / login / command / registration / disconnect events through wait_event().
+ *
+ * Events are queued from the NimBLE host task without locking. Callbacks and handler are still called.
+ * Commands are answered with success if neither a handler nor a command callback is set.
+ *
+ * @return true if the queue is enabled.
+ */
+bool
+SesameServer::enable_event_queue() {
+	if (!event_signal) {
+		event_signal = xSemaphoreCreateBinaryStatic(&event_signal_buffer);
+	}
+	return event_signal != nullptr;
+}
+
+/**
+ * @brief Wait for an event from the NimBLE host task.
+ *
+ * @param event Event received.
+ * @param timeout_ms Maximum time to wait, 0 to poll.
+ * @return true if an event is received, false on timeout.
+ */
+bool
+SesameServer::wait_event(server_event_t& event, uint32_t timeout_ms) {
+	if (events.pop(event)) {
+		return true;
+	}
+	if (!event_signal) {
+		return false;
+	}
+	auto start = xTaskGetTickCount();
+	auto timeout = pdMS_TO_TICKS(timeout_ms);
+	for (TickType_t elapsed = 0; elapsed < timeout; elapsed = xTaskGetTickCount() - start) {
+		if (xSemaphoreTake(event_signal, timeout - elapsed) != pdTRUE) {
+			break;
+		}
+		if (events.pop(event)) {
+			return true;
+		}
+	}
+	return events.pop(event);
+}
+
+void
+SesameServer::post_event(const server_event_t& event) {
+	if (!event_signal) {
+		return;
+	}
+	if (!events.push(event)) {
+		WARN_PRINTLN("Event queue full, event dropped");
+		return;
+	}
+	xSemaphoreGive(event_signal);
+}
+
+/**
+ * @brief Answer commands asynchronously.
+ *
+ * Commands are passed to the handler (command_event_t::token) and to the event queue (server_event_t::token) with a
+ * token, and the response is held until complete_command() is called with it, so the NimBLE host task is not blocked
+ * while the command is executed. Other segments to the same session are queued behind the response.
+ * Return value of SesameServerHandler::on_command() is ignored. The command callback, if used instead, is not deferred:
+ * its return value is answered by libsesame3bt-core as usual.
+ *
+ * libsesame3bt-core encodes the response when the command is received, so the held response always reports success:
+ * complete_command() with a failure result, or no completion within timeout_ms, drops the response and disconnects
+ * the session, which Remote / Touch report as a failed operation.
+ *
+ * @param timeout_ms Time allowed for complete_command().
+ * @return true if enabled.
+ */
+bool
+SesameServer::enable_deferred_commands(uint32_t timeout_ms) {
+	RecursiveSemaphoreLock lock{core_lock};
+	deferred_timeout_ms = timeout_ms;
+	deferred_commands = true;
+	return true;
+}
+
+/**
+ * @brief Complete a deferred command. May be called from any task.
+ *
+ * @param token Token of the command.
+ * @param result Command result. On success the held response is sent, otherwise the session is disconnected.
+ * @return false if the token is unknown (already completed, timed out or disconnected).
+ */
+bool
+SesameServer::complete_command(command_token_t token, Sesame::result_code_t result) {
+	if (!token) {
+		return false;
+	}
+	RecursiveSemaphoreLock lock{core_lock};
+	for (auto& pending : pending_commands) {
+		if (pending.token == token) {
+			finish_command(pending, result == Sesame::result_code_t::success);
+			return true;
+		}
+	}
+	return false;
+}
+
+SesameServer::pending_command_t*
+SesameServer::find_pending(uint16_t session_id) {
+	if (!deferred_commands) {
+		return nullptr;
+	}
+	auto* entry = sessions.find(session_id);
+	return entry ? &pending_commands[sessions.index_of(*entry)] : nullptr;
+}
+
+command_token_t
+SesameServer::defer_command(uint16_t session_id) {
+	auto* pending = find_pending(session_id);
+	if (!pending) {
+		return 0;
+	}
+	if (pending->holding) {
+		DEBUG_PRINTLN("Command already pending on session %u", session_id);
+		return 0;
+	}
+	if (++last_token == 0) {
+		++last_token;
+	}
+	pending->token = last_token;
+	pending->session_id = session_id;
+	pending->deadline = now_ms() + deferred_timeout_ms;
+	pending->holding = true;
+	pending->held.clear();
+	return pending->token;
+}
+
+/// Release (deliver=true) or drop the held segments. Called with core_lock held.
+void
+SesameServer::finish_command(pending_command_t& pending, bool deliver) {
+	if (deliver) {
+		while (!pending.held.empty()) {
+			size_t size;
+			auto* data = pending.held.front(size);
+			transmit(pending.session_id, data, size);
+			pending.held.pop();
+		}
+		pending.holding = false;
 	} else {
-		return Sesame::result_code_t::not_supported;
+		// keep holding with no token: later segments of the session are discarded until it is disconnected
+		pending.held.clear();
+		ble_server->disconnect(pending.session_id, BLE_ERR_RD_CONN_TERM_RESRCS);
+	}
+	pending.token = 0;
+}
+
+/**
+ * @brief Payload for the current registration state.
+ *
+ * Built from core.create_advertisement_data_os3() the first time the state is seen and kept in raw form, so later
+ * state changes only hand the cached payload to the controller.
+ */
+const SesameServer::advertising_payload_t&
+SesameServer::get_advertising_payload() {
+	auto& payload = advertising_payloads[core.is_registered() ? 1 : 0];
+	if (!payload.valid) {
+		auto [manu, name] = core.create_advertisement_data_os3();
+		DEBUG_PRINTLN("new manu = %s", log_hex(manu));
+		build_advertising_payload(payload, manu, name);
+	}
+	return payload;
+}
+
+bool
+SesameServer::build_advertising_payload(advertising_payload_t& payload, const std::string& manu, const std::string& name) {
+	payload.adv.setFlags(BLE_HS_ADV_F_DISC_GEN | BLE_HS_ADV_F_BREDR_UNSUP);
+	payload.valid = payload.adv.addServiceUUID(NimBLEUUID{Sesame::SESAME3_SRV_UUID}) && payload.adv.setManufacturerData(manu) &&
+	                payload.scan_response.setName(name);
+	return payload.valid;
+}
+
+/**
+ * @brief Manage connection parameters of logged-in sessions.
+ *
+ * After login, profile.active (short interval, no slave latency) is requested so command responses go out on the
+ * next connection event. After profile.idle_after_ms without a command (and no deferred command pending)
+ * profile.idle is requested, and profile.active again on the next command.
+ */
+void
+SesameServer::enable_connection_params(const conn_profile_t& profile) {
+	conn_profile = profile;
+}
+
+/// @brief Connection parameters currently in use for the peer (as reported by the controller).
+std::optional<conn_params_t>
+SesameServer::get_connection_params(const NimBLEAddress& addr) const {
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* entry = sessions.find(addr);
+	if (!entry) {
+		return std::nullopt;
 	}
+	return conn_params.get_negotiated(sessions.index_of(*entry));
 }
 
+void
+SesameServer::request_conn_params(uint16_t session_id, const conn_params_t& params) {
+	DEBUG_PRINTLN("Request conn params %u: %u-%u latency=%u timeout=%u", session_id, params.min_interval, params.max_interval,
+	              params.latency, params.timeout);
+	ble_server->updateConnParams(session_id, params.min_interval, params.max_interval, params.latency, params.timeout);
+}
+
+/**
+ * @brief Prefer a larger ATT MTU and LE data length, so frames take fewer notifications and connection events.
+ *
+ * Call after begin(). The central starts the MTU exchange, the data length is requested on each connection. With
+ * pack_segments the segments of a frame are repacked up to min(MTU - 3, LIBSESAME3BT_SERVER_TX_SEGMENT_MAX) bytes
+ * (the core always cuts 20 byte segments): only for centrals known to reassemble segments of any size.
+ *
+ * @param mtu Preferred ATT MTU (23-517).
+ * @param tx_octets LE data length (27-251), 0 to leave it to the controller.
+ */
+bool
+SesameServer::enable_link_negotiation(uint16_t mtu, uint16_t tx_octets, bool pack_segments) {
+	if (!ble_server || !NimBLEDevice::setMTU(mtu)) {
+		return false;
+	}
+	data_len = tx_octets;
+	this->pack_segments = pack_segments;
+	return true;
+}
+
+std::optional<link_stats_t>
+SesameServer::get_link_stats(const NimBLEAddress& addr) const {
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* entry = sessions.find(addr);
+	if (!entry) {
+		return std::nullopt;
+	}
+	const auto& stats = packer.get_stats(sessions.index_of(*entry));
+	return link_stats_t{entry->mtu, stats.frames, stats.segments, stats.notifications, stats.last_frame};
+}
+
+void
+SesameServer::onMTUChange(uint16_t MTU, NimBLEConnInfo& connInfo) {
+	RecursiveSemaphoreLock lock{core_lock};
+	if (auto* entry = sessions.find(connInfo.getConnHandle())) {
+		entry->mtu = MTU;
+		DEBUG_PRINTLN("MTU %u: %u", connInfo.getConnHandle(), MTU);
+	}
+}
+
+void
+SesameServer::onConnParamsUpdate(NimBLEConnInfo& connInfo) {
+	RecursiveSemaphoreLock lock{core_lock};
+	if (auto* entry = sessions.find(connInfo.getConnHandle())) {
+		auto interval = connInfo.getConnInterval();
+		conn_params.on_updated(sessions.index_of(*entry), {interval, interval, connInfo.getConnLatency(), connInfo.getConnTimeout()});
+		DEBUG_PRINTLN("Conn params %u: interval=%u latency=%u timeout=%u", connInfo.getConnHandle(), interval,
+		              connInfo.getConnLatency(), connInfo.getConnTimeout());
+	}
+}
+
+/**
+ * @brief Disconnect sessions to admit new peers and on idle timeout.
+ *
+ * When a peer connects while max_sessions sessions are in use, the least recently active idle session of the lowest
+ * priority class (not higher than the peer's) is disconnected, and the peer's subscription is completed as soon as
+ * the evicted session is gone. Sessions idle longer than config.idle_timeout_ms are disconnected from update().
+ * Sessions with a deferred command pending are never evicted. Peers that have not logged in config.login_timeout_ms
+ * after connecting are disconnected from update(), and are the first to be evicted for a new peer.
+ *
+ * A new peer can only connect if the BLE stack allows more connections than max_sessions
+ * (LIBSESAME3BT_SERVER_MAX_CONNECTIONS / CONFIG_BT_NIMBLE_MAX_CONNECTIONS), otherwise idle timeouts are the only way
+ * to free a session. Advertising continues while a session can be evicted for a peer_priority_t::high peer.
+ */
+void
+SesameServer::enable_admission_control(const admission_config_t& config) {
+	admission.set_config(config);
+	admission_enabled = true;
+}
+
+/// Evict a session for the peer in slot. @return true if a session is being disconnected.
+bool
+SesameServer::make_room(size_t slot) {
+	auto victim = admission.select_victim(admission.get_priority(slot), now_ms(), sessions, [this](size_t i) { return is_busy(i); });
+	if (!victim) {
+		DEBUG_PRINTLN("No session to evict");
+		return false;
+	}
+	evict(*victim, false);
+	return true;
+}
+
+void
+SesameServer::evict(size_t slot, bool idle) {
+	const auto& entry = sessions.at(slot);
+	DEBUG_PRINTLN("Evict %012llx (%s)", static_cast<uint64_t>(entry.address), idle ? "idle" : "admission");
+	admission.set_evicting(slot);
+	SERVER_STATS(on_eviction(idle));
+	// by connection: a peer past the login deadline may have no core session
+	ble_server->disconnect(entry.conn_handle, BLE_ERR_RD_CONN_TERM_RESRCS);
+}
+
+/**
+ * @brief Hand the payload for the current registration state to the controller.
+ * While advertising the data is replaced in place, so the device stays visible. Called with adv_lock held once started.
+ */
 bool
 SesameServer::set_advertising_data() {
 	if (!adv) {
 		return false;
 	}
-	adv->clearData();
-	auto [manu, name] = core.create_advertisement_data_os3();
-	DEBUG_PRINTLN("new manu = %s", util::bin2hex(manu).c_str());
-	adv->enableScanResponse(true);
-	return adv->addServiceUUID(NimBLEUUID{Sesame::SESAME3_SRV_UUID}) && adv->setManufacturerData(manu) && adv->setName(name);
+	const auto& payload = get_advertising_payload();
+	if (!payload.valid || !adv->setAdvertisementData(payload.adv) || !adv->setScanResponseData(payload.scan_response)) {
+		return false;
+	}
+	return !adv->isAdvertising() || adv->refreshAdvertisingData();
 }
 
 void
 SesameServer::disconnect(const NimBLEAddress& addr) {
+	RecursiveSemaphoreLock lock{core_lock};
 	auto session_id = get_session_id(addr);
 	if (session_id.has_value()) {
 		// 切断理由をデフォルト値のBLE_ERR_REM_USER_CONN_TERMを使うと、Touchの登録から削除されてしまう模様
 		// BLE_ERR_CONN_TERM_LOCALを使うと、Remoteの登録から削除されてしまう模様..
 		ble_server->disconnect(*session_id, BLE_ERR_RD_CONN_TERM_RESRCS);
 	} else {
-		DEBUG_PRINTLN("No connection found for address %s", addr.toString().c_str());
+		DEBUG_PRINTLN("No connection found for address %012llx", static_cast<uint64_t>(addr));
 	}
 }
 
-/// @brief Retrieve a BLE address from SESAME UUID (SESAME 5 and later).
-/// @param uuid The SESAME UUID to convert.
-/// @return BLE address. If error occurred, empty NimBLEAddress is returned (test with isNull()).
-NimBLEAddress
-SesameServer::uuid_to_ble_address(const NimBLEUUID& uuid) {
-	if (uuid.bitSize() != 128) {
-		DEBUG_PRINTLN("Invalid UUID size, must be 128 bits");
-		return {};
-	}
-	NimBLEUUID r_uuid{uuid};
-	r_uuid.reverseByteOrder();
-	auto b_addr = libsesame3bt::core::SesameServerCore::uuid_to_ble_address(
-	    *reinterpret_cast<const std::byte(*)[16]>(reinterpret_cast<const std::byte*>(r_uuid.getValue())));
-	return {reinterpret_cast<const uint8_t*>(b_addr.data()), BLE_ADDR_RANDOM};
-}
-
 bool
 SesameServer::has_session(const NimBLEAddress& addr) const {
-	auto conn = ble_server->getPeerInfo(addr);
-	return !conn.getAddress().isNull() && core.has_session(conn.getConnHandle());
+	return get_session_id(addr).has_value();
+}
+
+/// @brief Copy the currently logged-in peers to out (may be called from any task). @return Number copied.
+size_t
+SesameServer::get_logged_in_peers(peer_t* out, size_t max) const {
+	RecursiveSemaphoreLock lock{core_lock};
+	size_t n = 0;
+	for (const auto& peer : sessions.logged_in()) {
+		if (n == max) {
+			break;
+		}
+		out[n++] = peer;
+	}
+	return n;
 }
 
 std::optional<uint16_t>
 SesameServer::get_session_id(const NimBLEAddress& addr) const {
-	auto conn = ble_server->getPeerInfo(addr);
-	if (conn.getAddress().isNull() || !core.has_session(conn.getConnHandle())) {
+	RecursiveSemaphoreLock lock{core_lock};
+	auto* entry = sessions.find(addr);
+	if (!entry) {
 		return std::nullopt;
 	}
-	return conn.getConnHandle();
+	if (!core.has_session(entry->conn_handle)) {
+		return std::nullopt;
+	}
+	return entry->conn_handle;
+}
+
+NimBLEAddress
+SesameServer::get_peer_address(uint16_t session_id) const {
+	if (auto* entry = sessions.find(session_id)) {
+		return entry->address;
+	}
+	return ble_server->getPeerInfoByHandle(session_id).getAddress();
 }
 
+#endif  // !LIBSESAME3BT_SERVER_EXT_ADV
+
 }  // namespace libsesame3bt
@@ -2,15 +2,84 @@
 
 #include <NimBLEDevice.h>
 #include <Sesame.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <libsesame3bt/BLEBackend.h>
 #include <libsesame3bt/ServerCore.h>
 #include <functional>
 #include <optional>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include "AcceptList.h"
+#include "AdmissionControl.h"
+#include "AdvertisingPolicy.h"
+#include "ConnectionParams.h"
+#include "EventQueue.h"
+#include "FrameQueue.h"
+#include "HistoryTag.h"
+#include "PublishedState.h"
+#include "ServerLog.h"
+#include "ServerSnapshot.h"
+#include "SegmentPacker.h"
+#include "SemaphoreLock.h"
+#include "ServerStats.h"
+#include "SessionTable.h"
+#include "StatusBroadcaster.h"
+#include "TraceRing.h"
+#include "TxQueue.h"
+
+/* Capacity of the per-connection tables, defaults to the NimBLE connection limit */
+#ifndef LIBSESAME3BT_SERVER_MAX_CONNECTIONS
+#ifdef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define LIBSESAME3BT_SERVER_MAX_CONNECTIONS CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#else
+#define LIBSESAME3BT_SERVER_MAX_CONNECTIONS 3
+#endif
+#endif
+
+/* Capacity of the event queue (power of two) */
+#ifndef LIBSESAME3BT_SERVER_EVENT_QUEUE_SIZE
+#define LIBSESAME3BT_SERVER_EVENT_QUEUE_SIZE 16
+#endif
+
+/*
+ * Per-session TX segment buffers (segments the host could not take, segments held while a deferred command is pending),
+ * SEGMENT_MAX also bounds the notifications packed for a larger ATT MTU
+ */
+#ifndef LIBSESAME3BT_SERVER_TX_QUEUE_DEPTH
+#define LIBSESAME3BT_SERVER_TX_QUEUE_DEPTH 8
+#endif
+#ifndef LIBSESAME3BT_SERVER_TX_SEGMENT_MAX
+#define LIBSESAME3BT_SERVER_TX_SEGMENT_MAX 64
+#endif
+
+/* Records in the protocol trace ring (power of two, 16 bytes each), define as 0 to compile out */
+#ifndef LIBSESAME3BT_SERVER_TRACE_SIZE
+#define LIBSESAME3BT_SERVER_TRACE_SIZE 256
+#endif
+
+/* Peers remembered for connection filtering (at most the controller's filter accept list size) */
+#ifndef LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE
+#define LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE 8
+#endif
+
+/* NimBLE built with extended advertising provides NimBLEExtAdvertising only: use MultiSesameServer */
+#if defined(CONFIG_BT_NIMBLE_EXT_ADV) && CONFIG_BT_NIMBLE_EXT_ADV
+#define LIBSESAME3BT_SERVER_EXT_ADV 1
+#else
+#define LIBSESAME3BT_SERVER_EXT_ADV 0
+#endif
+
+/* Collect statistics for get_stats(), define as 0 to compile out */
+#ifndef LIBSESAME3BT_SERVER_STATS
+#define LIBSESAME3BT_SERVER_STATS 1
+#endif
 
 namespace libsesame3bt {
 
+/// @brief Identifies a deferred command, see SesameServer::enable_deferred_commands(). 0 is never used.
+using command_token_t = uint32_t;
+
 using registration_callback_t =
     std::function<void(const NimBLEAddress& addr, const std::array<std::byte, Sesame::SECRET_SIZE>& secret)>;
 using command_callback_t = std::function<Sesame::result_code_t(const NimBLEAddress& addr,
@@ -21,58 +90,316 @@ using command_callback_t = std::function<Sesame::result_code_t(const NimBLEAddre
 using connect_callback_t = std::function<void(const NimBLEAddress& addr)>;
 using disconnect_callback_t = std::function<void(const NimBLEAddress& addr, int reason)>;
 using login_callback_t = std::function<void(const NimBLEAddress& addr)>;
+using advertising_policy_t = std::function<advertising_params_t(const advertising_context_t& context)>;
+using conn_profile_selector_t = std::function<conn_profile_t(const NimBLEAddress& addr)>;
+using peer_priority_selector_t = std::function<peer_priority_t(const NimBLEAddress& addr)>;
+/// @brief Called when a peer is added to (learned) or removed from (evicted) the accept list, to persist it.
+using accept_list_callback_t = std::function<void(const NimBLEAddress& addr, bool added)>;
 
 namespace auto_send = core::auto_send;
 
+/// @brief Command received from Remote / Remote nano / Touch / Open Sensor.
+struct command_event_t {
+	const NimBLEAddress& address;
+	uint16_t session_id;
+	Sesame::item_code_t cmd;
+	/// Literal tag (older firmware), or 32 hex digits of UUID if trigger_type has a value. Valid during the call only.
+	std::string_view tag;
+	std::optional<history_tag_type_t> trigger_type;
+	float scaled_voltage;
+	/// Deferred command token (0 unless deferred commands are enabled)
+	command_token_t token;
+
+	/// Binary form of the UUID tag (new history tag format), parsed on each call.
+	std::optional<std::array<std::byte, 16>> tag_uuid() const {
+		return trigger_type.has_value() ? parse_uuid_tag(tag) : std::nullopt;
+	}
+};
+
+/// @brief Negotiated MTU and frame segmentation of a session, see SesameServer::get_link_stats().
+struct link_stats_t {
+	uint16_t mtu;
+	uint32_t frames;
+	uint32_t segments;       ///< produced by the core
+	uint32_t notifications;  ///< sent to the peer
+	uint16_t last_frame_notifications;
+};
+
+/// @brief Event delivered to the application task through SesameServer::wait_event().
+struct server_event_t {
+	enum class type_t : uint8_t { connect, subscribe, login, command, registration, disconnect };
+	static constexpr size_t TAG_MAX = 32;
+
+	type_t type;
+	uint16_t session_id;
+	NimBLEAddress address;
+	/// command: command item code and the result returned to the peer
+	Sesame::item_code_t cmd;
+	Sesame::result_code_t result;
+	std::optional<history_tag_type_t> trigger_type;
+	float scaled_voltage;
+	/// command: deferred command token, pass to SesameServer::complete_command() (0 if not deferred)
+	command_token_t token;
+	/// registration: shared secret
+	std::array<std::byte, Sesame::SECRET_SIZE> secret;
+	/// disconnect: reason
+	int reason;
+	uint8_t tag_length;
+	char tag_data[TAG_MAX];
+
+	/// command: tag (truncated to TAG_MAX)
+	std::string_view tag() const { return {tag_data, tag_length}; }
+	/// command: binary form of the UUID tag (new history tag format), parsed on each call
+	std::optional<std::array<std::byte, 16>> tag_uuid() const {
+		return trigger_type.has_value() ? parse_uuid_tag(tag()) : std::nullopt;
+	}
+};
+
+/**
+ * @brief Event handler interface, alternative to the set_on_*_callback() functions.
+ *
+ * The callbacks are implemented by a built-in handler, so every event is dispatched through this interface.
+ * A handler of its own saves the std::function call and, for on_command(), the copy of the tag into a std::string.
+ * All functions are called from the NimBLE host task.
+ */
+class SesameServerHandler {
+ public:
+	virtual ~SesameServerHandler() {}
+	virtual void on_connect(const NimBLEAddress& /* addr */) {}
+	virtual void on_login(const NimBLEAddress& /* addr */) {}
+	virtual void on_registration(const NimBLEAddress& /* addr */, const std::array<std::byte, Sesame::SECRET_SIZE>& /* secret */) {}
+	virtual Sesame::result_code_t on_command(const command_event_t& /* event */) { return Sesame::result_code_t::not_supported; }
+	virtual void on_disconnect(const NimBLEAddress& /* addr */, int /* reason */) {}
+};
+
+/// @brief Random static BLE address of the SESAME identity with the UUID, null address if the UUID is invalid.
+NimBLEAddress uuid_to_ble_address(const NimBLEUUID& uuid);
+
+#if !LIBSESAME3BT_SERVER_EXT_ADV
 class SesameServer : private NimBLEServerCallbacks, private NimBLECharacteristicCallbacks, private core::ServerBLEBackend {
  public:
-	SesameServer(size_t max_sessions) : core(*this, max_sessions) {}
+	using session_table_t = SessionTable<NimBLEAddress, LIBSESAME3BT_SERVER_MAX_CONNECTIONS>;
+	using peer_t = session_table_t::entry_t;
+	using broadcast_stats_t = StatusBroadcaster<LIBSESAME3BT_SERVER_MAX_CONNECTIONS>::stats_t;
+	using tx_queue_t =
+	    TxQueue<LIBSESAME3BT_SERVER_MAX_CONNECTIONS, LIBSESAME3BT_SERVER_TX_QUEUE_DEPTH, LIBSESAME3BT_SERVER_TX_SEGMENT_MAX>;
+	using tx_queue_stats_t = tx_queue_t::stats_t;
+
+	SesameServer(size_t max_sessions) : max_sessions(max_sessions), core(*this, max_sessions) {}
 	SesameServer(const SesameServer&) = delete;
 	virtual ~SesameServer() {}
 
 	bool begin(Sesame::model_t model, const NimBLEUUID& uuid);
+	bool begin_from_snapshot(const server_snapshot_t& snapshot);
+	bool make_snapshot(server_snapshot_t& snapshot) const;
+	const boot_timing_t& get_boot_timing() const { return boot_timing; }
 	bool start_advertising();
 	bool stop_advertising();
+	/// @brief Replace default_advertising_policy() (nullptr to restore it).
+	void set_advertising_policy(advertising_policy_t policy) { advertising_policy = policy; }
 	void update();
-	bool set_registered(const std::array<std::byte, Sesame::SECRET_SIZE>& secret) { return core.set_registered(secret); }
-	void set_on_registration_callback(registration_callback_t callback) { registration_callback = callback; }
-	void set_on_command_callback(command_callback_t callback) { command_callback = callback; }
-	void set_on_connect_callback(connect_callback_t callback) { connect_callback = callback; }
-	void set_on_disconnect_callback(disconnect_callback_t callback) { disconnect_callback = callback; }
-	void set_on_login_callback(login_callback_t callback) { login_callback = callback; }
-	size_t get_session_count() { return core.get_session_count(); }
-	bool is_registered() const { return core.is_registered(); }
+	bool set_registered(const std::array<std::byte, Sesame::SECRET_SIZE>& secret);
+	void set_on_registration_callback(registration_callback_t callback) { callbacks.registration = callback; }
+	void set_on_command_callback(command_callback_t callback) { callbacks.command = callback; }
+	void set_on_connect_callback(connect_callback_t callback) { callbacks.connect = callback; }
+	void set_on_disconnect_callback(disconnect_callback_t callback) { callbacks.disconnect = callback; }
+	void set_on_login_callback(login_callback_t callback) { callbacks.login = callback; }
+	/// @brief Use handler instead of the callbacks above (nullptr to revert to the callbacks).
+	void set_handler(SesameServerHandler* handler) { this->handler = handler ? handler : &callbacks; }
+	bool enable_event_queue();
+	bool wait_event(server_event_t& event, uint32_t timeout_ms);
+	uint32_t get_dropped_events() const { return events.get_dropped(); }
+	bool enable_deferred_commands(uint32_t timeout_ms);
+	bool complete_command(command_token_t token, Sesame::result_code_t result);
+	size_t get_session_count() {
+		RecursiveSemaphoreLock lock{core_lock};
+		return core.get_session_count();
+	}
+	bool is_registered() const {
+		RecursiveSemaphoreLock lock{core_lock};
+		return core.is_registered();
+	}
 	bool send_lock_status(bool locked);
 	bool send_mecha_status(const NimBLEAddress* address, const Sesame::mecha_status_5_t& status);
-	void set_mecha_setting(const Sesame::mecha_setting_5_t& setting) { core.set_mecha_setting(setting); }
-	void set_mecha_status(const Sesame::mecha_status_5_t& status) { core.set_mecha_status(status); }
-	void set_auto_send_flags(auto_send::flags flags) { core.set_auto_send_flags(flags); }
+	/// @brief Safe from any task, passed to the core on the NimBLE host task with the next RX write.
+	void set_mecha_setting(const Sesame::mecha_setting_5_t& setting) { published.set_mecha_setting(setting); }
+	void set_mecha_status(const Sesame::mecha_status_5_t& status) { published.set_mecha_status(status); }
+	void set_auto_send_flags(auto_send::flags flags) { published.set_auto_send_flags(flags); }
+	void set_status_coalescing(uint32_t window_ms, uint32_t min_interval_ms);
+	broadcast_stats_t get_broadcast_stats() const;
+	tx_queue_stats_t get_tx_queue_stats() const;
+	size_t get_tx_queue_depth(const NimBLEAddress& addr) const;
+
+	void enable_connection_params(const conn_profile_t& profile = default_conn_profile);
+	/// @brief Choose the connection profile per peer (e.g. Remote / Touch / Open Sensor), overrides enable_connection_params().
+	void set_connection_profile_selector(conn_profile_selector_t selector) { conn_profile_selector = selector; }
+	std::optional<conn_params_t> get_connection_params(const NimBLEAddress& addr) const;
+	void enable_admission_control(const admission_config_t& config = default_admission_config);
+	/// @brief Priority class of a connecting peer (peer_priority_t::normal for all if not set).
+	void set_peer_priority_selector(peer_priority_selector_t selector) { peer_priority_selector = selector; }
+	bool enable_accept_list(accept_list_callback_t callback = nullptr);
+	bool add_known_peer(const NimBLEAddress& addr);
+	bool forget_peer(const NimBLEAddress& addr);
+	size_t get_known_peers(NimBLEAddress* out, size_t max) const;
+	void open_enrollment(uint32_t duration_ms);
+	/// @brief true while advertising accepts connections from known peers only.
+	bool is_connection_filtered() const { return filter_applied; }
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+	using trace_t = TraceRing<LIBSESAME3BT_SERVER_TRACE_SIZE>;
+	/// @brief Write the protocol trace (docs/trace.md) through write (may be called from any task). @return valid records.
+	size_t dump_trace(const std::function<void(const uint8_t* data, size_t size)>& write) const { return trace.dump(write); }
+	size_t dump_trace(uint8_t* buffer, size_t size) const;
+	static constexpr size_t trace_dump_size() { return trace_t::dump_size(); }
+#endif
+#if LIBSESAME3BT_SERVER_STATS
+	/// @brief Copy current statistics (may be called from any task).
+	void get_stats(server_stats_t& out) const { out = stats.get(); }
+	void reset_stats() { stats.reset(); }
+#endif
+
+	bool enable_link_negotiation(uint16_t mtu = 247, uint16_t tx_octets = 251, bool pack_segments = false);
+	std::optional<link_stats_t> get_link_stats(const NimBLEAddress& addr) const;
 
 	bool has_session(const NimBLEAddress& addr) const;
 	void disconnect(const NimBLEAddress& addr);
+	size_t get_logged_in_peers(peer_t* out, size_t max) const;
 
-	static NimBLEAddress uuid_to_ble_address(const NimBLEUUID& uuid);
+	static NimBLEAddress uuid_to_ble_address(const NimBLEUUID& uuid) { return libsesame3bt::uuid_to_ble_address(uuid); }
 
  private:
+	/// RX characteristic that hands the ATT write payload to the core without copying it into an NimBLEAttValue.
+	class RxCharacteristic : public NimBLECharacteristic {
+	 public:
+		RxCharacteristic(SesameServer& server)
+		    : NimBLECharacteristic(NimBLEUUID{Sesame::TxUUID}, NIMBLE_PROPERTY::WRITE | NIMBLE_PROPERTY::WRITE_NR), server(server) {}
+
+	 private:
+		SesameServer& server;
+		virtual void writeEvent(const uint8_t* val, uint16_t len, NimBLEConnInfo& connInfo) override {
+			server.on_rx_written(connInfo, val, len);
+		}
+	};
+
+	/// Handler that calls the set_on_*_callback() functions, used unless set_handler() is called.
+	class CallbackHandler : public SesameServerHandler {
+	 public:
+		CallbackHandler(SesameServer& server) : server(server) {}
+
+		registration_callback_t registration = nullptr;
+		command_callback_t command = nullptr;
+		connect_callback_t connect = nullptr;
+		disconnect_callback_t disconnect = nullptr;
+		login_callback_t login = nullptr;
+
+	 private:
+		SesameServer& server;
+		virtual void on_connect(const NimBLEAddress& addr) override;
+		virtual void on_login(const NimBLEAddress& addr) override;
+		virtual void on_registration(const NimBLEAddress& addr, const std::array<std::byte, Sesame::SECRET_SIZE>& secret) override;
+		virtual Sesame::result_code_t on_command(const command_event_t& event) override;
+		virtual void on_disconnect(const NimBLEAddress& addr, int reason) override;
+	};
+
 	NimBLEAdvertising* adv = nullptr;
 	NimBLEServer* ble_server = nullptr;
 	NimBLEService* srv = nullptr;
 	NimBLECharacteristic* tx = nullptr;
 	NimBLECharacteristic* rx = nullptr;
-	registration_callback_t registration_callback = nullptr;
-	command_callback_t command_callback = nullptr;
-	connect_callback_t connect_callback = nullptr;
-	disconnect_callback_t disconnect_callback = nullptr;
-	login_callback_t login_callback = nullptr;
+	CallbackHandler callbacks{*this};
+	SesameServerHandler* handler = &callbacks;
+	advertising_policy_t advertising_policy = nullptr;
+	conn_profile_selector_t conn_profile_selector = nullptr;
+	peer_priority_selector_t peer_priority_selector = nullptr;
 
+	size_t max_sessions;
 	core::SesameServerCore core;
+	// The core and the per-session state (session table, TX queue, packer, pending commands, broadcaster, admission and
+	// connection parameters) are not thread-safe: this one lock is held around every access, by the NimBLE host task
+	// callbacks and by send_*(), complete_command(), update() and the queries on the application task. Lock order:
+	// core_lock, then adv_lock.
+	// The host task therefore waits while the application task is inside one of these calls (a core call or one
+	// update() pass, no I/O). Handing them to the host task instead would mean posting events to the NimBLE host's
+	// event queue, and send_*() could no longer return the core's result.
+	StaticSemaphore_t core_lock_buffer;
+	SemaphoreHandle_t core_lock = nullptr;
+	PublishedState<auto_send::flags> published;
+	session_table_t sessions;
+	StatusBroadcaster<LIBSESAME3BT_SERVER_MAX_CONNECTIONS> broadcaster;
+	bool coalesce_status = false;
+	EventQueue<server_event_t, LIBSESAME3BT_SERVER_EVENT_QUEUE_SIZE> events;
+	StaticSemaphore_t event_signal_buffer;
+	SemaphoreHandle_t event_signal = nullptr;
+
+	struct pending_command_t {
+		command_token_t token = 0;
+		uint16_t session_id = 0;
+		uint32_t deadline = 0;
+		bool holding = false;  // TX segments go to held instead of the air
+		FrameQueue<LIBSESAME3BT_SERVER_TX_QUEUE_DEPTH, LIBSESAME3BT_SERVER_TX_SEGMENT_MAX> held;
+	};
+	std::array<pending_command_t, LIBSESAME3BT_SERVER_MAX_CONNECTIONS> pending_commands;
+	command_token_t last_token = 0;
+	uint32_t deferred_timeout_ms = 0;
+	bool deferred_commands = false;
+	tx_queue_t tx_queue;
+	using packer_t = SegmentPacker<LIBSESAME3BT_SERVER_MAX_CONNECTIONS, LIBSESAME3BT_SERVER_TX_SEGMENT_MAX>;
+	packer_t packer;
+	bool pack_segments = false;
+	uint16_t data_len = 0;
+#if LIBSESAME3BT_SERVER_STATS
+	ServerStats<LIBSESAME3BT_SERVER_MAX_CONNECTIONS> stats;
+#endif
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+	trace_t trace;
+#endif
+	bool advertising_enabled = false;
+	advertising_params_t advertising_applied{};
+	uint32_t advertising_started_ms = 0;
+	uint32_t advertising_enabled_ms = 0;
+	std::optional<uint32_t> last_disconnect_ms;
+	std::optional<uint32_t> last_registration_ms;
+	bool reconnect_pending = false;
+	StaticSemaphore_t adv_lock_buffer;
+	SemaphoreHandle_t adv_lock = nullptr;
+
+	/// Advertising and scan response payloads, built once per registration state
+	struct advertising_payload_t {
+		NimBLEAdvertisementData adv;
+		NimBLEAdvertisementData scan_response;
+		bool valid = false;
+	};
+	std::array<advertising_payload_t, 2> advertising_payloads;  // [0] unregistered, [1] registered
+
+	Sesame::model_t model = Sesame::model_t::unknown;
+	NimBLEUUID uuid;
+	NimBLEAddress address;
+	std::optional<std::array<std::byte, Sesame::SECRET_SIZE>> secret;  // for make_snapshot()
+	boot_timing_t boot_timing{};
+
+	ConnParamManager<LIBSESAME3BT_SERVER_MAX_CONNECTIONS> conn_params;
+	std::optional<conn_profile_t> conn_profile;
+
+	AdmissionControl<LIBSESAME3BT_SERVER_MAX_CONNECTIONS> admission;
+	bool admission_enabled = false;
+
+	AcceptList<NimBLEAddress, LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE> accept_list;
+	accept_list_callback_t accept_list_callback = nullptr;
+	bool accept_list_enabled = false;
+	bool filter_applied = false;
 
 	virtual void onDisconnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo, int reason) override;
 	virtual void onConnect(NimBLEServer* pServer, NimBLEConnInfo& connInfo) override;
 	virtual void onSubscribe(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo, uint16_t subValue) override;
 	virtual void onRead(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo) override;
 	virtual void onWrite(NimBLECharacteristic* pCharacteristic, NimBLEConnInfo& connInfo) override;
+	virtual void onConnParamsUpdate(NimBLEConnInfo& connInfo) override;
+	virtual void onMTUChange(uint16_t MTU, NimBLEConnInfo& connInfo) override;
+	void on_rx_written(NimBLEConnInfo& connInfo, const uint8_t* data, size_t size);
 	virtual bool write_to_central(uint16_t session_id, const uint8_t* data, size_t size) override;
+	bool write_segment(uint16_t session_id, const uint8_t* data, size_t size);
+	bool transmit(uint16_t session_id, const uint8_t* data, size_t size);
+	bool notify_segment(uint16_t session_id, const uint8_t* data, size_t size);
+	void flush_tx_queue();
 	virtual void disconnect(uint16_t session_id) override;
 	void on_registration(uint16_t session_id, const std::array<std::byte, Sesame::SECRET_SIZE>& secret);
 	void on_login(uint16_t session_id);
@@ -85,11 +412,28 @@ class SesameServer : private NimBLEServerCallbacks, private NimBLECharacteristic
 	                 Sesame::op_code_t op_code,
 	                 Sesame::item_code_t item_code,
 	                 const std::byte* data,
-	                 size_t size) {
-		return core.send_notify(session_id, op_code, item_code, data, size);
-	}
+	                 size_t size);
+	bool start(Sesame::model_t model, const NimBLEUUID& uuid, const NimBLEAddress& address);
 	bool set_advertising_data();
+	const advertising_payload_t& get_advertising_payload();
+	static bool build_advertising_payload(advertising_payload_t& payload, const std::string& manu, const std::string& name);
+	void apply_advertising_policy();
+	bool update_controller_list(const NimBLEAddress* add, const NimBLEAddress* remove);
+	void learn_peer(const NimBLEAddress& addr);
+	void request_conn_params(uint16_t session_id, const conn_params_t& params);
+	bool accept_subscription(uint16_t session_id, const NimBLEAddress& address);
+	bool make_room(size_t slot);
+	void evict(size_t slot, bool idle);
+	bool is_busy(size_t slot) const { return deferred_commands && pending_commands[slot].token != 0; }
 	std::optional<uint16_t> get_session_id(const NimBLEAddress& addr) const;
+	bool broadcast_mecha_status(const Sesame::mecha_status_5_t& status);
+	void post_event(const server_event_t& event);
+	command_token_t defer_command(uint16_t session_id);
+	void finish_command(pending_command_t& pending, bool deliver);
+	pending_command_t* find_pending(uint16_t session_id);
+	NimBLEAddress get_peer_address(uint16_t session_id) const;
 };
 
+#endif  // !LIBSESAME3BT_SERVER_EXT_ADV
+
 }  // namespace libsesame3bt
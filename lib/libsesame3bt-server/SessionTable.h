@@ -0,0 +1,130 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Fixed size table of BLE connections, looked up by connection handle or by peer address.
+ *
+ * Filled from the connection events, so the hot path never has to query the host's connection list.
+ * Handles are placed at (handle % N) with linear probing, so handle lookup is normally a single probe;
+ * address lookup compares at most N entries. Not thread-safe: the servers hold their core lock around every access.
+ *
+ * @tparam Address Peer address type (NimBLEAddress on target), must be default constructible and comparable.
+ * @tparam N Maximum number of simultaneous connections.
+ */
+template <typename Address, size_t N>
+class SessionTable {
+ public:
+	static constexpr uint16_t NO_HANDLE = 0xffff;
+
+	struct entry_t {
+		uint16_t conn_handle = NO_HANDLE;
+		Address address{};
+		bool subscribed = false;
+		bool logged_in = false;
+		uint16_t mtu = 23;  ///< negotiated ATT MTU
+
+		bool in_use() const { return conn_handle != NO_HANDLE; }
+	};
+
+	/// @brief Iterates over the logged-in entries only.
+	class logged_in_iterator {
+	 public:
+		logged_in_iterator(const entry_t* cur, const entry_t* end) : cur(cur), end(end) { skip(); }
+		const entry_t& operator*() const { return *cur; }
+		const entry_t* operator->() const { return cur; }
+		logged_in_iterator& operator++() {
+			++cur;
+			skip();
+			return *this;
+		}
+		bool operator!=(const logged_in_iterator& other) const { return cur != other.cur; }
+		bool operator==(const logged_in_iterator& other) const { return cur == other.cur; }
+
+	 private:
+		const entry_t* cur;
+		const entry_t* end;
+		void skip() {
+			while (cur != end && !(cur->in_use() && cur->logged_in)) {
+				++cur;
+			}
+		}
+	};
+
+	struct logged_in_range {
+		const SessionTable& table;
+		logged_in_iterator begin() const { return {table.entries.data(), table.entries.data() + N}; }
+		logged_in_iterator end() const { return {table.entries.data() + N, table.entries.data() + N}; }
+	};
+
+	/// @brief Register a new connection.
+	/// @return Entry for the connection, nullptr if the table is full.
+	entry_t* add(uint16_t conn_handle, const Address& address) {
+		if (auto* existing = find(conn_handle)) {
+			*existing = entry_t{conn_handle, address};
+			return existing;
+		}
+		for (size_t i = 0; i < N; i++) {
+			auto& entry = entries[(conn_handle + i) % N];
+			if (!entry.in_use()) {
+				entry = entry_t{conn_handle, address};
+				++count;
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	void remove(uint16_t conn_handle) {
+		if (auto* entry = find(conn_handle)) {
+			*entry = entry_t{};
+			--count;
+		}
+	}
+
+	entry_t* find(uint16_t conn_handle) {
+		return const_cast<entry_t*>(static_cast<const SessionTable*>(this)->find(conn_handle));
+	}
+	const entry_t* find(uint16_t conn_handle) const {
+		if (conn_handle == NO_HANDLE) {
+			return nullptr;
+		}
+		for (size_t i = 0; i < N; i++) {
+			const auto& entry = entries[(conn_handle + i) % N];
+			if (entry.conn_handle == conn_handle) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	entry_t* find(const Address& address) {
+		return const_cast<entry_t*>(static_cast<const SessionTable*>(this)->find(address));
+	}
+	const entry_t* find(const Address& address) const {
+		for (const auto& entry : entries) {
+			if (entry.in_use() && entry.address == address) {
+				return &entry;
+			}
+		}
+		return nullptr;
+	}
+
+	/// @brief Index of the entry in [0, N), stable while the connection lives.
+	size_t index_of(const entry_t& entry) const { return &entry - entries.data(); }
+	const entry_t& at(size_t index) const { return entries[index]; }
+
+	size_t size() const { return count; }
+	static constexpr size_t capacity() { return N; }
+	logged_in_range logged_in() const { return {*this}; }
+
+ private:
+	std::array<entry_t, N> entries{};
+	size_t count = 0;
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <Sesame.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+namespace libsesame3bt {
+
+/**
+ * @brief Coalesces mecha_status broadcasts and deduplicates them per session.
+ *
+ * Statuses posted within the coalescing window collapse into the latest one. When the window closes the status is
+ * sent to each logged-in session, unless it equals the last status sent to that session (suppressed) or the session
+ * was sent to less than min_interval ago (deferred until the interval has passed).
+ *
+ * @tparam N Number of session slots (same indices as SessionTable).
+ */
+template <size_t N>
+class StatusBroadcaster {
+ public:
+	struct stats_t {
+		uint32_t posted;      ///< statuses passed to post()
+		uint32_t coalesced;   ///< statuses replaced by a newer one within the window
+		uint32_t suppressed;  ///< notifies skipped because the session already has the status
+		uint32_t deferred;    ///< notifies delayed by the per-session rate limit
+		uint32_t sent;        ///< notifies sent
+		uint32_t failed;      ///< notifies the core failed to send (each is retried)
+	};
+
+	void set_window(uint32_t window_ms, uint32_t min_interval_ms) {
+		this->window_ms = window_ms;
+		this->min_interval_ms = min_interval_ms;
+	}
+
+	void post(const Sesame::mecha_status_5_t& status, uint32_t now) {
+		++stats.posted;
+		if (pending) {
+			++stats.coalesced;
+		} else {
+			pending = true;
+			posted_at = now;
+		}
+		latest = status;
+	}
+
+	/// @brief Record a status sent to the slot outside of the broadcaster.
+	void on_sent(size_t slot, const Sesame::mecha_status_5_t& status, uint32_t now) {
+		auto& s = slots[slot];
+		s.last = status;
+		s.has_last = true;
+		s.sent_at = now;
+	}
+
+	/// @brief Forget the slot state (new or closed connection).
+	void reset(size_t slot) { slots[slot] = slot_t{}; }
+
+	/**
+	 * @brief Send the pending status where due.
+	 *
+	 * @param sessions SessionTable, only logged-in sessions receive broadcasts.
+	 * @param send bool(uint16_t conn_handle, const Sesame::mecha_status_5_t&)
+	 */
+	template <typename Sessions, typename Send>
+	void flush(uint32_t now, const Sessions& sessions, Send&& send) {
+		if (pending && now - posted_at >= window_ms) {
+			pending = false;
+			for (const auto& entry : sessions.logged_in()) {
+				slots[sessions.index_of(entry)].dirty = true;
+			}
+		}
+		for (const auto& entry : sessions.logged_in()) {
+			auto& s = slots[sessions.index_of(entry)];
+			if (!s.dirty) {
+				continue;
+			}
+			if (s.has_last && std::memcmp(&s.last, &latest, sizeof(latest)) == 0) {
+				++stats.suppressed;
+				s.dirty = false;
+				continue;
+			}
+			if (s.has_last && now - s.sent_at < min_interval_ms) {
+				if (!s.deferred) {
+					++stats.deferred;
+					s.deferred = true;
+				}
+				continue;
+			}
+			if (send(entry.conn_handle, latest)) {
+				++stats.sent;
+				s.dirty = false;
+				s.deferred = false;
+				on_sent(sessions.index_of(entry), latest, now);
+			} else {
+				// still due: retried by the next flush()
+				++stats.failed;
+			}
+		}
+	}
+
+	const stats_t& get_stats() const { return stats; }
+
+ private:
+	struct slot_t {
+		Sesame::mecha_status_5_t last{};
+		uint32_t sent_at = 0;
+		bool has_last = false;
+		bool dirty = false;
+		bool deferred = false;
+	};
+	std::array<slot_t, N> slots{};
+	Sesame::mecha_status_5_t latest{};
+	uint32_t posted_at = 0;
+	uint32_t window_ms = 0;
+	uint32_t min_interval_ms = 0;
+	bool pending = false;
+	stats_t stats{};
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace libsesame3bt {
+
+/// @brief Event kinds in the trace, see docs/trace.md.
+enum class trace_type_t : uint8_t {
+	connect = 1,
+	subscribe = 2,     ///< value: 1 accepted, 0 rejected
+	rx_write = 3,      ///< arg: first byte (segment header), value: size
+	rx_rejected = 4,   ///< arg: first byte, value: size (core.on_received() failed)
+	tx_notify = 5,     ///< arg: first byte, value: size (accepted by the host)
+	tx_busy = 6,       ///< arg: first byte, value: size (host out of buffers, queued)
+	tx_dropped = 7,    ///< arg: first byte, value: size
+	login = 8,
+	command = 9,       ///< arg: item code, value: result code
+	disconnect = 10,   ///< value: reason
+	registration = 11,
+};
+
+/// @brief One trace record, 16 bytes, stored and dumped in little-endian byte order.
+struct trace_record_t {
+	uint32_t time_us;
+	uint16_t conn_handle;
+	trace_type_t type;
+	uint8_t arg;
+	uint32_t value;
+	uint32_t seq;  ///< 1-based sequence number, 0 while being written
+};
+static_assert(sizeof(trace_record_t) == 16, "trace_record_t must be 16 bytes");
+
+/**
+ * @brief Fixed size binary ring buffer of protocol events.
+ *
+ * record() is lock-free and may be called from any task: a slot is claimed with one atomic increment and published by
+ * its sequence number. Old records are overwritten. dump() streams the records in order without a copy of the ring;
+ * a record overwritten while it is read is dumped with seq 0.
+ *
+ * Dump format: "S3TR" | uint16 version (1) | uint16 record size (16) | uint32 first seq | uint32 count | records.
+ *
+ * @tparam N Number of records, must be a power of two.
+ */
+template <size_t N>
+class TraceRing {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "TraceRing size must be a power of two");
+
+ public:
+	static constexpr uint16_t VERSION = 1;
+	static constexpr size_t HEADER_SIZE = 16;
+
+	void record(uint32_t time_us, uint16_t conn_handle, trace_type_t type, uint8_t arg, uint32_t value) {
+		auto seq = next.fetch_add(1, std::memory_order_relaxed) + 1;
+		auto& slot = slots[seq & (N - 1)];
+		slot.seq.store(0, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.time_us = time_us;
+		slot.conn_handle = conn_handle;
+		slot.type = type;
+		slot.arg = arg;
+		slot.value = value;
+		slot.seq.store(seq, std::memory_order_release);
+	}
+
+	/// @brief Number of bytes dump() writes at most.
+	static constexpr size_t dump_size() { return HEADER_SIZE + N * sizeof(trace_record_t); }
+
+	/**
+	 * @brief Write header and records (oldest first) through write.
+	 *
+	 * @param write void(const uint8_t* data, size_t size)
+	 * @return Number of valid records written.
+	 */
+	template <typename Write>
+	size_t dump(Write&& write) const {
+		uint32_t last = next.load(std::memory_order_acquire);
+		uint32_t first = last > N ? last - N + 1 : 1;
+		uint32_t count = last - first + 1;
+		uint8_t header[HEADER_SIZE] = {'S', '3', 'T', 'R'};
+		put(header + 4, VERSION, 2);
+		put(header + 6, sizeof(trace_record_t), 2);
+		put(header + 8, first, 4);
+		put(header + 12, count, 4);
+		write(header, sizeof(header));
+		size_t valid = 0;
+		for (uint32_t seq = first; seq <= last; seq++) {
+			const auto& slot = slots[seq & (N - 1)];
+			uint8_t rec[sizeof(trace_record_t)];
+			bool ok = slot.seq.load(std::memory_order_acquire) == seq;
+			put(rec, slot.time_us, 4);
+			put(rec + 4, slot.conn_handle, 2);
+			rec[6] = static_cast<uint8_t>(slot.type);
+			rec[7] = slot.arg;
+			put(rec + 8, slot.value, 4);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			ok = ok && slot.seq.load(std::memory_order_relaxed) == seq;
+			put(rec + 12, ok ? seq : 0, 4);
+			write(rec, sizeof(rec));
+			valid += ok;
+		}
+		return valid;
+	}
+
+	/// @brief Total number of records ever recorded.
+	uint32_t recorded() const { return next.load(std::memory_order_relaxed); }
+
+ private:
+	struct slot_t {
+		uint32_t time_us;
+		uint16_t conn_handle;
+		trace_type_t type;
+		uint8_t arg;
+		uint32_t value;
+		std::atomic<uint32_t> seq{0};
+	};
+	std::array<slot_t, N> slots{};
+	std::atomic<uint32_t> next{0};
+
+	static void put(uint8_t* p, uint32_t v, size_t n) {
+		for (size_t i = 0; i < n; i++) {
+			p[i] = static_cast<uint8_t>(v >> (8 * i));
+		}
+	}
+};
+
+}  // namespace libsesame3bt
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "FrameQueue.h"
+
+namespace libsesame3bt {
+
+/**
+ * @brief Per-session bounded queues of notifications the host could not take.
+ *
+ * A segment is sent immediately only while nothing is queued for any session; otherwise it is queued behind the
+ * others, so a congested host serves sessions in turn. flush() retries the queued segments round-robin, one segment
+ * per session per turn, until the host refuses again. Not thread-safe.
+ *
+ * @tparam N Number of session slots (same indices as SessionTable).
+ * @tparam Depth Segments queued per session.
+ * @tparam MaxSize Maximum size of a segment.
+ */
+template <size_t N, size_t Depth, size_t MaxSize>
+class TxQueue {
+ public:
+	struct stats_t {
+		uint32_t sent;       ///< segments the host accepted
+		uint32_t queued;     ///< segments queued because the host refused them or others were waiting
+		uint32_t retried;    ///< queued segments sent later
+		uint32_t dropped;    ///< segments dropped: queue full, too large, or session closed with segments queued
+		uint32_t max_depth;  ///< largest total number of queued segments seen
+	};
+
+	/**
+	 * @brief Send or queue a segment.
+	 *
+	 * @param send bool(const uint8_t* data, size_t size), false if the host cannot take the segment now
+	 * @return false if the segment is dropped.
+	 */
+	template <typename Send>
+	bool write(size_t slot, const uint8_t* data, size_t size, Send&& send) {
+		if (total == 0 && send(data, size)) {
+			++stats.sent;
+			return true;
+		}
+		if (!queues[slot].push(data, size)) {
+			++stats.dropped;
+			return false;
+		}
+		++stats.queued;
+		if (++total > stats.max_depth) {
+			stats.max_depth = total;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Retry queued segments.
+	 *
+	 * @param sessions SessionTable, to map slots to connection handles.
+	 * @param send bool(uint16_t conn_handle, const uint8_t* data, size_t size)
+	 * @return Number of segments sent.
+	 */
+	template <typename Sessions, typename Send>
+	size_t flush(const Sessions& sessions, Send&& send) {
+		size_t n = 0;
+		size_t idle = 0;
+		while (total && idle < N) {
+			auto slot = next;
+			next = (next + 1) % N;
+			auto& q = queues[slot];
+			if (q.empty()) {
+				++idle;
+				continue;
+			}
+			size_t size;
+			auto* data = q.front(size);
+			if (!send(sessions.at(slot).conn_handle, data, size)) {
+				// retry this session first next time
+				next = slot;
+				break;
+			}
+			q.pop();
+			--total;
+			++stats.sent;
+			++stats.retried;
+			++n;
+			idle = 0;
+		}
+		return n;
+	}
+
+	/// @brief Drop the segments of the slot (new or closed connection).
+	void reset(size_t slot) {
+		auto& q = queues[slot];
+		stats.dropped += q.size();
+		total -= q.size();
+		q.clear();
+	}
+
+	size_t depth(size_t slot) const { return queues[slot].size(); }
+	size_t depth() const { return total; }
+	const stats_t& get_stats() const { return stats; }
+
+ private:
+	std::array<FrameQueue<Depth, MaxSize>, N> queues{};
+	size_t total = 0;
+	size_t next = 0;
+	stats_t stats{};
+};
+
+}  // namespace libsesame3bt
@@ -1,31 +1,61 @@
 #pragma once
 
-#if LIBSESAME3BT_SERVER_DEBUG
-#include <Arduino.h>
-#define DEBUG_PRINTLN(...)      \
-	do {                          \
-		Serial.printf(__VA_ARGS__); \
-		Serial.println();           \
-	} while (false)
-#define DEBUG_PRINT(...)        \
-	do {                          \
-		Serial.printf(__VA_ARGS__); \
-	} while (false)
-#define DEBUG_PRINTF(...)       \
-	do {                          \
-		Serial.printf(__VA_ARGS__); \
-	} while (false)
+#include "DeferredLog.h"
+#include "ServerLog.h"
+
+#if LIBSESAME3BT_SERVER_LOG_LEVEL
+
+namespace libsesame3bt::log_detail {
+
+using server_log_t = DeferredLog<LIBSESAME3BT_SERVER_LOG_SIZE>;
 
+#if LIBSESAME3BT_SERVER_LOG_DEFERRED
+extern server_log_t server_log;
 #else
+void print_line(const char* line);
+#endif
 
-#define DEBUG_PRINTLN(...) \
-	do {                     \
-	} while (false)
-#define DEBUG_PRINT(...) \
-	do {                   \
-	} while (false)
-#define DEBUG_PRINTF(...) \
-	do {                    \
+template <typename... Args>
+inline void
+write(log_level_t level, const char* format, const Args&... args) {
+#if LIBSESAME3BT_SERVER_LOG_DEFERRED
+	server_log.write(level, format, args...);
+#else
+	server_log_t::entry_t entry;
+	server_log_t::encode(entry, level, format, args...);
+	char line[192];
+	server_log_t::format(entry, line, sizeof(line));
+	print_line(line);
+#endif
+}
+
+}  // namespace libsesame3bt::log_detail
+
+#define SERVER_LOG(level, ...) ::libsesame3bt::log_detail::write(::libsesame3bt::log_level_t::level, __VA_ARGS__)
+
+#endif  // LIBSESAME3BT_SERVER_LOG_LEVEL
+
+#define SERVER_LOG_NONE(...) \
+	do {                       \
 	} while (false)
 
+#if LIBSESAME3BT_SERVER_LOG_LEVEL >= 1
+#define ERROR_PRINTLN(...) SERVER_LOG(error, __VA_ARGS__)
+#else
+#define ERROR_PRINTLN(...) SERVER_LOG_NONE()
+#endif
+#if LIBSESAME3BT_SERVER_LOG_LEVEL >= 2
+#define WARN_PRINTLN(...) SERVER_LOG(warn, __VA_ARGS__)
+#else
+#define WARN_PRINTLN(...) SERVER_LOG_NONE()
+#endif
+#if LIBSESAME3BT_SERVER_LOG_LEVEL >= 3
+#define INFO_PRINTLN(...) SERVER_LOG(info, __VA_ARGS__)
+#else
+#define INFO_PRINTLN(...) SERVER_LOG_NONE()
+#endif
+#if LIBSESAME3BT_SERVER_LOG_LEVEL >= 4
+#define DEBUG_PRINTLN(...) SERVER_LOG(debug, __VA_ARGS__)
+#else
+#define DEBUG_PRINTLN(...) SERVER_LOG_NONE()
 #endif
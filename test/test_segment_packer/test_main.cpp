@@ -0,0 +1,159 @@
+/*
+ * SegmentPacker: segments of the core (20 bytes) re-cut for the negotiated ATT MTU.
+ *
+ * pio test -e test
+ */
+#include <unity.h>
+#include <SegmentPacker.h>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using libsesame3bt::SegmentPacker;
+
+using packer_t = SegmentPacker<2, 64>;
+using segment_t = std::vector<uint8_t>;
+
+static constexpr size_t CORE_SEGMENT = 20;
+static constexpr uint8_t KIND = 2;
+
+void
+setUp() {}
+
+void
+tearDown() {}
+
+static std::vector<uint8_t>
+make_payload(size_t size) {
+	std::vector<uint8_t> payload(size);
+	for (size_t i = 0; i < size; i++) {
+		payload[i] = static_cast<uint8_t>(i * 7 + 3);
+	}
+	return payload;
+}
+
+/// Cut a frame as the core does: start flag on the first segment, kind on the last.
+static std::vector<segment_t>
+cut(const std::vector<uint8_t>& payload, uint8_t kind) {
+	std::vector<segment_t> segments;
+	for (size_t pos = 0; pos < payload.size(); pos += CORE_SEGMENT - 1) {
+		size_t n = std::min(payload.size() - pos, CORE_SEGMENT - 1);
+		segment_t s{static_cast<uint8_t>((pos == 0 ? packer_t::START : 0) | (pos + n == payload.size() ? kind << 1 : 0))};
+		s.insert(s.end(), payload.begin() + pos, payload.begin() + pos + n);
+		segments.push_back(s);
+	}
+	return segments;
+}
+
+static std::vector<segment_t>
+pack(packer_t& packer, size_t slot, size_t limit, const std::vector<segment_t>& segments) {
+	std::vector<segment_t> out;
+	for (const auto& s : segments) {
+		TEST_ASSERT_TRUE(packer.write(slot, limit, s.data(), s.size(), [&out](const uint8_t* data, size_t size) {
+			out.emplace_back(data, data + size);
+			return true;
+		}));
+	}
+	return out;
+}
+
+/// Check the notifications of one frame and return its payload.
+static std::vector<uint8_t>
+reassemble(const std::vector<segment_t>& notifications, size_t limit, uint8_t kind) {
+	std::vector<uint8_t> payload;
+	for (size_t i = 0; i < notifications.size(); i++) {
+		const auto& n = notifications[i];
+		bool last = i + 1 == notifications.size();
+		TEST_ASSERT_GREATER_THAN(1, n.size());
+		TEST_ASSERT_LESS_OR_EQUAL(limit, n.size());
+		TEST_ASSERT_EQUAL(i == 0, (n[0] & packer_t::START) != 0);
+		TEST_ASSERT_EQUAL(last ? kind : 0, n[0] >> 1);
+		if (!last) {
+			TEST_ASSERT_EQUAL(limit, n.size());
+		}
+		payload.insert(payload.end(), n.begin() + 1, n.end());
+	}
+	return payload;
+}
+
+static void
+test_pass_through_at_default_mtu() {
+	for (size_t limit : {size_t{0}, CORE_SEGMENT}) {
+		packer_t packer;
+		for (size_t size : {1, 19, 20, 38, 57, 100}) {
+			auto segments = cut(make_payload(size), KIND);
+			auto out = pack(packer, 0, limit, segments);
+			TEST_ASSERT_EQUAL(segments.size(), out.size());
+			for (size_t i = 0; i < segments.size(); i++) {
+				TEST_ASSERT_EQUAL(segments[i].size(), out[i].size());
+				TEST_ASSERT_EQUAL_UINT8_ARRAY(segments[i].data(), out[i].data(), segments[i].size());
+			}
+			TEST_ASSERT_EQUAL(segments.size(), packer.get_stats(0).last_frame);
+		}
+		TEST_ASSERT_EQUAL(6, packer.get_stats(0).frames);
+		TEST_ASSERT_EQUAL(packer.get_stats(0).segments, packer.get_stats(0).notifications);
+	}
+}
+
+static void
+test_recut_at_larger_limits() {
+	// 64 is MAX, 244 (ATT MTU 247) is capped at MAX
+	for (size_t limit : {23, 40, 64, 244}) {
+		size_t effective = std::min<size_t>(limit, 64);
+		packer_t packer;
+		for (size_t size : {20, 22, 39, 63, 64, 126, 200}) {
+			auto payload = make_payload(size);
+			auto segments = cut(payload, KIND);
+			auto out = pack(packer, 1, limit, segments);
+			TEST_ASSERT_EQUAL((size + effective - 2) / (effective - 1), out.size());
+			auto joined = reassemble(out, effective, KIND);
+			TEST_ASSERT_EQUAL(size, joined.size());
+			TEST_ASSERT_EQUAL_UINT8_ARRAY(payload.data(), joined.data(), size);
+			TEST_ASSERT_EQUAL(out.size(), packer.get_stats(1).last_frame);
+		}
+		TEST_ASSERT_EQUAL(0, packer.get_stats(0).frames);
+	}
+}
+
+static void
+test_single_segment_frame() {
+	packer_t packer;
+	auto segments = cut(make_payload(5), KIND);
+	TEST_ASSERT_EQUAL(1, segments.size());
+	auto out = pack(packer, 0, 244, segments);
+	TEST_ASSERT_EQUAL(1, out.size());
+	TEST_ASSERT_EQUAL(segments[0].size(), out[0].size());
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(segments[0].data(), out[0].data(), out[0].size());
+	TEST_ASSERT_EQUAL(packer_t::START | KIND << 1, out[0][0]);
+	const auto& stats = packer.get_stats(0);
+	TEST_ASSERT_EQUAL(1, stats.frames);
+	TEST_ASSERT_EQUAL(1, stats.segments);
+	TEST_ASSERT_EQUAL(1, stats.notifications);
+	TEST_ASSERT_EQUAL(1, stats.last_frame);
+}
+
+static void
+test_reset_drops_partial_frame() {
+	packer_t packer;
+	auto first = cut(make_payload(50), KIND);
+	pack(packer, 0, 64, {first[0], first[1]});
+	packer.reset(0);
+	TEST_ASSERT_EQUAL(0, packer.get_stats(0).frames);
+
+	auto payload = make_payload(30);
+	auto out = pack(packer, 0, 64, cut(payload, KIND));
+	TEST_ASSERT_EQUAL(1, out.size());
+	auto joined = reassemble(out, 64, KIND);
+	TEST_ASSERT_EQUAL(payload.size(), joined.size());
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(payload.data(), joined.data(), payload.size());
+}
+
+int
+main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_pass_through_at_default_mtu);
+	RUN_TEST(test_recut_at_larger_limits);
+	RUN_TEST(test_single_segment_frame);
+	RUN_TEST(test_reset_drops_partial_frame);
+	return UNITY_END();
+}
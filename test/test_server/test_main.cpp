@@ -0,0 +1,851 @@
+/*
+ * SesameServer on the NimBLE host stand-in, driven by loopback centrals.
+ *
+ * pio test -e test
+ */
+#include <unity.h>
+#include <thread>
+#include "../../example/native_common/loopback.h"
+
+using namespace loopback;
+using libsesame3bt::SesameServer;
+using libsesame3bt::server_stats_t;
+
+void
+setUp() {}
+
+void
+tearDown() {
+	NimBLEHost::set_acl_buffers(24);
+	host_clock::use_real_time();
+}
+
+static server_stats_t
+get_stats(const SesameServer& server) {
+	server_stats_t stats;
+	server.get_stats(stats);
+	return stats;
+}
+
+static void
+test_login_and_command() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 2, secret);
+	TEST_ASSERT_EQUAL(2, centrals.size());
+	TEST_ASSERT_EQUAL(2, handler.logins);
+	TEST_ASSERT_EQUAL(2, server.get_session_count());
+
+	auto other = centrals[0]->get_received();
+	auto received = centrals[1]->get_received();
+	TEST_ASSERT_TRUE(centrals[1]->lock("test"));
+	link.pump();
+	TEST_ASSERT_EQUAL(1, handler.commands);
+	TEST_ASSERT_GREATER_THAN(received, centrals[1]->get_received());
+	TEST_ASSERT_EQUAL(other, centrals[0]->get_received());
+
+	auto stats = get_stats(server);
+	TEST_ASSERT_EQUAL(2, stats.connects);
+	TEST_ASSERT_EQUAL(2, stats.logins);
+	TEST_ASSERT_EQUAL(1, stats.commands[static_cast<uint8_t>(Sesame::item_code_t::lock)]);
+	TEST_ASSERT_EQUAL(0, stats.rejected_writes);
+	TEST_ASSERT_EQUAL(0, link.framing_errors);
+}
+
+static void
+test_callbacks() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	size_t connects = 0, logins = 0, commands = 0, disconnects = 0;
+	std::string tag;
+	server.set_on_connect_callback([&](const NimBLEAddress&) { ++connects; });
+	server.set_on_login_callback([&](const NimBLEAddress&) { ++logins; });
+	server.set_on_command_callback([&](const NimBLEAddress&, Sesame::item_code_t, const std::string& command_tag,
+	                                   std::optional<libsesame3bt::history_tag_type_t>, float) {
+		++commands;
+		tag = command_tag;
+		return Sesame::result_code_t::success;
+	});
+	server.set_on_disconnect_callback([&](const NimBLEAddress&, int) { ++disconnects; });
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	TEST_ASSERT_EQUAL(1, connects);
+	TEST_ASSERT_EQUAL(1, logins);
+	TEST_ASSERT_TRUE(centrals[0]->lock("callback"));
+	link.pump();
+	TEST_ASSERT_EQUAL(1, commands);
+	TEST_ASSERT_EQUAL_STRING("callback", tag.c_str());
+
+	// a handler replaces the callbacks, nullptr restores them
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(centrals[0]->unlock("handler"));
+	link.pump();
+	TEST_ASSERT_EQUAL(1, handler.commands);
+	TEST_ASSERT_EQUAL(1, commands);
+	server.set_handler(nullptr);
+	TEST_ASSERT_TRUE(centrals[0]->lock("callback"));
+	link.pump();
+	TEST_ASSERT_EQUAL(2, commands);
+	TEST_ASSERT_EQUAL(1, handler.commands);
+
+	centrals[0]->disconnect(REASON_REMOTE_TERM);
+	link.pump();
+	TEST_ASSERT_EQUAL(1, disconnects);
+}
+
+static void
+test_tag_uuid() {
+	using libsesame3bt::history_tag_type_t;
+	std::string hex = "00112233445566778899aabbccddeeff";
+	NimBLEAddress addr;
+	libsesame3bt::command_event_t command{addr, 1, Sesame::item_code_t::lock, hex, std::nullopt, 1.0f, 0};
+	// a literal tag of older firmware is not a UUID even if it looks like one
+	TEST_ASSERT_FALSE(command.tag_uuid().has_value());
+	command.trigger_type = history_tag_type_t{};
+	auto uuid = command.tag_uuid();
+	TEST_ASSERT_TRUE(uuid.has_value());
+	TEST_ASSERT_EQUAL(0x00, static_cast<uint8_t>((*uuid)[0]));
+	TEST_ASSERT_EQUAL(0xff, static_cast<uint8_t>((*uuid)[15]));
+	command.tag = "0011";
+	TEST_ASSERT_FALSE(command.tag_uuid().has_value());
+
+	libsesame3bt::server_event_t event{};
+	event.trigger_type = history_tag_type_t{};
+	event.tag_length = static_cast<uint8_t>(hex.size());
+	hex.copy(event.tag_data, hex.size());
+	TEST_ASSERT_TRUE(event.tag_uuid() == uuid);
+}
+
+static void
+test_logged_in_peers_are_copied() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{3};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 2, secret);
+	TEST_ASSERT_EQUAL(2, centrals.size());
+	SesameServer::peer_t peers[3];
+	TEST_ASSERT_EQUAL(1, server.get_logged_in_peers(peers, 1));
+	TEST_ASSERT_EQUAL(2, server.get_logged_in_peers(peers, 3));
+	for (const auto& c : centrals) {
+		TEST_ASSERT_TRUE(peers[0].address == c->get_address() || peers[1].address == c->get_address());
+	}
+
+	// the copy stays valid after the session is gone
+	auto gone = peers[0];
+	server.disconnect(gone.address);
+	link.pump();
+	TEST_ASSERT_FALSE(server.has_session(gone.address));
+	TEST_ASSERT_TRUE(peers[0].address == gone.address);
+	TEST_ASSERT_EQUAL(1, server.get_logged_in_peers(peers, 3));
+	TEST_ASSERT_FALSE(peers[0].address == gone.address);
+}
+
+static void
+test_full_server_stops_advertising() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	server.update();
+	LoopbackCentral second{link, 2};
+	TEST_ASSERT_TRUE(second.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(second.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::not_advertising);
+
+	centrals[0]->disconnect(REASON_REMOTE_TERM);
+	server.update();
+	TEST_ASSERT_TRUE(second.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	TEST_ASSERT_TRUE(second.is_logged_in());
+}
+
+static void
+test_rejected_write_disconnects() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 2, secret);
+	TEST_ASSERT_EQUAL(2, centrals.size());
+	// continuation segment with no frame started
+	static constexpr uint8_t garbage[] = {0x04, 0xde, 0xad, 0xbe, 0xef};
+	centrals[0]->write_raw(garbage, sizeof(garbage));
+	link.pump();
+
+	TEST_ASSERT_FALSE(centrals[0]->is_connected());
+	TEST_ASSERT_TRUE(centrals[1]->is_logged_in());
+	TEST_ASSERT_FALSE(server.has_session(centrals[0]->get_address()));
+	auto stats = get_stats(server);
+	TEST_ASSERT_EQUAL(1, stats.rejected_writes);
+	TEST_ASSERT_EQUAL(1, stats.disconnect_reasons[BLE_ERR_CONN_TERM_LOCAL]);
+	TEST_ASSERT_EQUAL(0, handler.commands);
+}
+
+static void
+test_disconnect_by_address() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 2, secret);
+	TEST_ASSERT_EQUAL(2, centrals.size());
+	TEST_ASSERT_TRUE(server.has_session(centrals[1]->get_address()));
+	server.disconnect(centrals[1]->get_address());
+	link.pump();
+
+	TEST_ASSERT_FALSE(centrals[1]->is_connected());
+	TEST_ASSERT_TRUE(centrals[0]->is_logged_in());
+	TEST_ASSERT_FALSE(server.has_session(centrals[1]->get_address()));
+	TEST_ASSERT_EQUAL(1, server.get_session_count());
+	TEST_ASSERT_EQUAL(1, get_stats(server).disconnect_reasons[BLE_ERR_CONN_TERM_LOCAL]);
+}
+
+/// Retry from update() polling only: the host stand-in, like NimBLE, has no buffer-freed event to retry from.
+static void
+test_notify_retried_after_acl_exhaustion() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	auto& central = *centrals[0];
+	auto received = central.get_received();
+
+	NimBLEHost::set_acl_buffers(0);
+	TEST_ASSERT_TRUE(central.lock("test"));
+	link.pump();
+	TEST_ASSERT_EQUAL(1, handler.commands);
+	TEST_ASSERT_EQUAL(received, central.get_received());
+	TEST_ASSERT_GREATER_THAN(0, server.get_tx_queue_depth(central.get_address()));
+	TEST_ASSERT_TRUE(central.is_connected());
+
+	NimBLEHost::set_acl_buffers(24);
+	server.update();
+	link.pump();
+	TEST_ASSERT_GREATER_THAN(received, central.get_received());
+	TEST_ASSERT_EQUAL(0, server.get_tx_queue_depth(central.get_address()));
+	auto tx = server.get_tx_queue_stats();
+	TEST_ASSERT_GREATER_THAN(0, tx.queued);
+	TEST_ASSERT_EQUAL(tx.queued, tx.retried);
+	TEST_ASSERT_EQUAL(0, tx.dropped);
+	TEST_ASSERT_EQUAL(0, link.framing_errors);
+}
+
+static void
+test_deferred_command() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	libsesame3bt::command_token_t token = 0;
+	Handler handler{link, [&token](const libsesame3bt::command_event_t& event) {
+		                token = event.token;
+		                return Sesame::result_code_t::success;
+	                }};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(server.enable_deferred_commands(1000));
+	TEST_ASSERT_TRUE(start_server(server, secret));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	auto& central = *centrals[0];
+	auto received = central.get_received();
+	TEST_ASSERT_TRUE(central.unlock("test"));
+	link.pump();
+	TEST_ASSERT_TRUE(token != 0);
+	TEST_ASSERT_EQUAL(received, central.get_received());
+
+	TEST_ASSERT_TRUE(server.complete_command(token, Sesame::result_code_t::success));
+	link.pump();
+	TEST_ASSERT_GREATER_THAN(received, central.get_received());
+	TEST_ASSERT_FALSE(server.complete_command(token, Sesame::result_code_t::success));
+}
+
+static Sesame::mecha_status_5_t
+make_status(int16_t position) {
+	Sesame::mecha_status_5_t status{};
+	status.position = position;
+	return status;
+}
+
+static void
+test_status_coalescing() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 2, secret);
+	TEST_ASSERT_EQUAL(2, centrals.size());
+	server.set_status_coalescing(100, 1000);
+	host_clock::set_us(10'000'000);
+	auto received = centrals[0]->get_received();
+
+	// merged within the window
+	for (int16_t i = 1; i <= 3; i++) {
+		TEST_ASSERT_TRUE(server.send_mecha_status(nullptr, make_status(i)));
+	}
+	server.update();
+	link.pump();
+	TEST_ASSERT_EQUAL(received, centrals[0]->get_received());
+	host_clock::set_us(10'100'000);
+	server.update();
+	link.pump();
+	auto stats = server.get_broadcast_stats();
+	TEST_ASSERT_EQUAL(3, stats.posted);
+	TEST_ASSERT_EQUAL(2, stats.coalesced);
+	TEST_ASSERT_EQUAL(2, stats.sent);
+	TEST_ASSERT_GREATER_THAN(received, centrals[0]->get_received());
+
+	// the status the sessions already have is suppressed
+	received = centrals[0]->get_received();
+	server.send_mecha_status(nullptr, make_status(3));
+	host_clock::set_us(10'200'000);
+	server.update();
+	link.pump();
+	stats = server.get_broadcast_stats();
+	TEST_ASSERT_EQUAL(2, stats.suppressed);
+	TEST_ASSERT_EQUAL(2, stats.sent);
+	TEST_ASSERT_EQUAL(received, centrals[0]->get_received());
+
+	// a new status waits for the minimum interval
+	server.send_mecha_status(nullptr, make_status(4));
+	host_clock::set_us(10'300'000);
+	server.update();
+	link.pump();
+	stats = server.get_broadcast_stats();
+	TEST_ASSERT_EQUAL(2, stats.deferred);
+	TEST_ASSERT_EQUAL(2, stats.sent);
+	host_clock::set_us(11'100'000);
+	server.update();
+	link.pump();
+	stats = server.get_broadcast_stats();
+	TEST_ASSERT_EQUAL(4, stats.sent);
+	TEST_ASSERT_GREATER_THAN(received, centrals[0]->get_received());
+	TEST_ASSERT_EQUAL(0, link.framing_errors);
+}
+
+/// A notify the core fails to send keeps the session due: it is sent by a later flush(), not lost.
+static void
+test_failed_broadcast_retried() {
+	SesameServer::session_table_t sessions;
+	for (uint16_t handle : {1, 2}) {
+		sessions.add(handle, NimBLEAddress{0xc0de00000000ULL | handle, BLE_ADDR_RANDOM})->logged_in = true;
+	}
+	libsesame3bt::StatusBroadcaster<LIBSESAME3BT_SERVER_MAX_CONNECTIONS> broadcaster;
+	broadcaster.set_window(0, 0);
+	size_t sent_to[3]{};
+	bool fail_first = true;
+	auto send = [&](uint16_t conn_handle, const Sesame::mecha_status_5_t&) {
+		if (conn_handle == 1 && fail_first) {
+			return false;
+		}
+		++sent_to[conn_handle];
+		return true;
+	};
+
+	broadcaster.post(make_status(1), 0);
+	broadcaster.flush(0, sessions, send);
+	TEST_ASSERT_EQUAL(0, sent_to[1]);
+	TEST_ASSERT_EQUAL(1, sent_to[2]);
+	TEST_ASSERT_EQUAL(1, broadcaster.get_stats().failed);
+
+	fail_first = false;
+	broadcaster.flush(1, sessions, send);
+	TEST_ASSERT_EQUAL(1, sent_to[1]);
+	TEST_ASSERT_EQUAL(1, sent_to[2]);
+	broadcaster.flush(2, sessions, send);
+	TEST_ASSERT_EQUAL(1, sent_to[1]);
+	TEST_ASSERT_EQUAL(2, broadcaster.get_stats().sent);
+}
+
+static void
+test_admission_evicts_idle_session() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	server.enable_admission_control();
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	host_clock::set_us(10'000'000);
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+
+	// too recently active to be evicted: the server stops advertising
+	server.update();
+	LoopbackCentral second{link, 2};
+	TEST_ASSERT_TRUE(second.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(second.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::not_advertising);
+
+	host_clock::set_us(11'000'000);
+	server.update();
+	TEST_ASSERT_TRUE(second.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	TEST_ASSERT_FALSE(centrals[0]->is_connected());
+	TEST_ASSERT_TRUE(second.is_logged_in());
+	TEST_ASSERT_EQUAL(1, get_stats(server).evictions);
+	TEST_ASSERT_EQUAL(1, server.get_session_count());
+}
+
+static void
+test_admission_idle_timeout() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	libsesame3bt::admission_config_t config{{0, 5'000, 0}, 1'000, 0};
+	server.enable_admission_control(config);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	host_clock::set_us(10'000'000);
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 2, secret);
+	TEST_ASSERT_EQUAL(2, centrals.size());
+
+	host_clock::set_us(14'000'000);
+	TEST_ASSERT_TRUE(centrals[1]->lock("test"));
+	link.pump();
+	host_clock::set_us(15'000'000);
+	server.update();
+	link.pump();
+	TEST_ASSERT_FALSE(centrals[0]->is_connected());
+	TEST_ASSERT_TRUE(centrals[1]->is_logged_in());
+	TEST_ASSERT_EQUAL(1, get_stats(server).idle_disconnects);
+}
+
+static void
+test_login_deadline() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{2};
+	Handler handler{link};
+	server.set_handler(&handler);
+	libsesame3bt::admission_config_t config{{0, 0, 0}, 1'000, 2'000};
+	server.enable_admission_control(config);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	host_clock::set_us(10'000'000);
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	// stays in the login handshake
+	LoopbackCentral silent{link, 2};
+	silent.set_passive(true);
+	TEST_ASSERT_TRUE(silent.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(silent.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	TEST_ASSERT_FALSE(silent.is_logged_in());
+
+	host_clock::set_us(11'999'000);
+	server.update();
+	link.pump();
+	TEST_ASSERT_TRUE(silent.is_connected());
+
+	// a new peer evicts the silent one, not the logged-in idle session
+	host_clock::set_us(12'000'000);
+	LoopbackCentral third{link, 3};
+	TEST_ASSERT_TRUE(third.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(third.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	TEST_ASSERT_FALSE(silent.is_connected());
+	TEST_ASSERT_TRUE(centrals[0]->is_logged_in());
+	TEST_ASSERT_TRUE(third.is_logged_in());
+	TEST_ASSERT_EQUAL(1, get_stats(server).evictions);
+
+	// and update() disconnects it without a new peer
+	LoopbackCentral late{link, 4};
+	late.set_passive(true);
+	third.disconnect(REASON_REMOTE_TERM);
+	TEST_ASSERT_TRUE(late.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(late.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	host_clock::set_us(14'000'000);
+	server.update();
+	link.pump();
+	TEST_ASSERT_FALSE(late.is_connected());
+	TEST_ASSERT_TRUE(centrals[0]->is_logged_in());
+	TEST_ASSERT_EQUAL(1, get_stats(server).idle_disconnects);
+}
+
+static void
+test_accept_list() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{3};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	host_clock::set_us(10'000'000);
+	std::vector<std::pair<NimBLEAddress, bool>> changes;
+	TEST_ASSERT_TRUE(server.enable_accept_list([&changes](const NimBLEAddress& addr, bool added) { changes.emplace_back(addr, added); }));
+
+	// no known peer yet: anyone may connect, and is learned on login
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	TEST_ASSERT_EQUAL(1, changes.size());
+	TEST_ASSERT_TRUE(changes[0].first == centrals[0]->get_address() && changes[0].second);
+
+	LoopbackCentral stranger{link, 2};
+	TEST_ASSERT_TRUE(stranger.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(stranger.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::filtered);
+
+	// the enrollment window admits it until it closes
+	server.open_enrollment(1'000);
+	TEST_ASSERT_TRUE(stranger.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	TEST_ASSERT_TRUE(stranger.is_logged_in());
+	TEST_ASSERT_EQUAL(2, changes.size());
+	host_clock::set_us(11'000'000);
+	server.update();
+	LoopbackCentral late{link, 3};
+	TEST_ASSERT_TRUE(late.begin(Sesame::model_t::sesame_5, secret));
+	TEST_ASSERT_TRUE(late.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::filtered);
+
+	NimBLEAddress known[LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE];
+	TEST_ASSERT_EQUAL(2, server.get_known_peers(known, LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE));
+
+	// a known peer reconnects, a forgotten one no longer can
+	stranger.disconnect(REASON_REMOTE_TERM);
+	TEST_ASSERT_TRUE(stranger.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::connected);
+	link.pump();
+	TEST_ASSERT_TRUE(stranger.is_logged_in());
+	stranger.disconnect(REASON_REMOTE_TERM);
+	TEST_ASSERT_TRUE(server.forget_peer(stranger.get_address()));
+	TEST_ASSERT_TRUE(stranger.connect(NimBLEDevice::getAddress()) == NimBLEHost::connect_result_t::filtered);
+	TEST_ASSERT_EQUAL(1, server.get_known_peers(known, LIBSESAME3BT_SERVER_ACCEPT_LIST_SIZE));
+	TEST_ASSERT_EQUAL(2, changes.size());
+}
+
+static void
+test_connection_params_switch() {
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	server.enable_connection_params();
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	host_clock::set_us(10'000'000);
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	auto& central = *centrals[0];
+	const auto& profile = libsesame3bt::default_conn_profile;
+
+	// active after login
+	auto params = server.get_connection_params(central.get_address());
+	TEST_ASSERT_TRUE(params.has_value());
+	TEST_ASSERT_EQUAL(profile.active.max_interval, params->max_interval);
+	TEST_ASSERT_EQUAL(profile.active.latency, params->latency);
+
+	// idle after idle_after_ms without a command
+	host_clock::set_us(10'000'000 + (profile.idle_after_ms - 1) * 1000);
+	server.update();
+	link.pump();
+	TEST_ASSERT_EQUAL(profile.active.max_interval, server.get_connection_params(central.get_address())->max_interval);
+	host_clock::set_us(10'000'000 + profile.idle_after_ms * 1000);
+	server.update();
+	link.pump();
+	params = server.get_connection_params(central.get_address());
+	TEST_ASSERT_EQUAL(profile.idle.max_interval, params->max_interval);
+	TEST_ASSERT_EQUAL(profile.idle.latency, params->latency);
+
+	// active again on the next command
+	TEST_ASSERT_TRUE(central.lock("test"));
+	link.pump();
+	params = server.get_connection_params(central.get_address());
+	TEST_ASSERT_EQUAL(profile.active.max_interval, params->max_interval);
+	TEST_ASSERT_EQUAL(profile.active.latency, params->latency);
+	TEST_ASSERT_EQUAL(1, handler.commands);
+}
+
+static void
+test_snapshot_round_trip() {
+	auto secret = demo_secret();
+	libsesame3bt::server_snapshot_t snapshot;
+	NimBLEAddress address;
+	{
+		Link link;
+		SesameServer server{1};
+		TEST_ASSERT_TRUE(start_server(server, secret));
+		TEST_ASSERT_TRUE(server.make_snapshot(snapshot));
+		address = NimBLEDevice::getAddress();
+	}
+	TEST_ASSERT_TRUE(libsesame3bt::is_valid_snapshot(snapshot));
+	TEST_ASSERT_TRUE(snapshot.registered);
+
+	// corrupted, from another version or with an oversized payload: rejected
+	auto corrupted = snapshot;
+	corrupted.name[0] ^= 1;
+	TEST_ASSERT_FALSE(libsesame3bt::is_valid_snapshot(corrupted));
+	auto other_version = snapshot;
+	other_version.version++;
+	other_version.crc = libsesame3bt::snapshot_crc32(&other_version, offsetof(libsesame3bt::server_snapshot_t, crc));
+	TEST_ASSERT_FALSE(libsesame3bt::is_valid_snapshot(other_version));
+	auto oversized = snapshot;
+	oversized.name_size = libsesame3bt::server_snapshot_t::MAX_PAYLOAD + 1;
+	oversized.crc = libsesame3bt::snapshot_crc32(&oversized, offsetof(libsesame3bt::server_snapshot_t, crc));
+	TEST_ASSERT_FALSE(libsesame3bt::is_valid_snapshot(oversized));
+	{
+		Link link;
+		SesameServer server{1};
+		TEST_ASSERT_FALSE(server.begin_from_snapshot(corrupted));
+	}
+
+	// restores the address, the registration and the advertising: centrals log in as before
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(server.begin_from_snapshot(snapshot));
+	TEST_ASSERT_TRUE(server.get_boot_timing().from_snapshot);
+	TEST_ASSERT_TRUE(server.is_registered());
+	TEST_ASSERT_TRUE(NimBLEDevice::getAddress() == address);
+	auto centrals = login_centrals(link, address, 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	TEST_ASSERT_EQUAL(1, handler.logins);
+
+	libsesame3bt::server_snapshot_t again;
+	TEST_ASSERT_TRUE(server.make_snapshot(again));
+	TEST_ASSERT_EQUAL_MEMORY(&snapshot, &again, sizeof(snapshot));
+}
+
+static void
+test_event_queue() {
+	using libsesame3bt::server_event_t;
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	TEST_ASSERT_TRUE(server.enable_event_queue());
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	server_event_t event;
+	TEST_ASSERT_FALSE(server.wait_event(event, 0));
+
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	auto& central = *centrals[0];
+	for (auto type : {server_event_t::type_t::connect, server_event_t::type_t::subscribe, server_event_t::type_t::login}) {
+		TEST_ASSERT_TRUE(server.wait_event(event, 0));
+		TEST_ASSERT_EQUAL(static_cast<int>(type), static_cast<int>(event.type));
+		TEST_ASSERT_TRUE(event.address == central.get_address());
+	}
+	TEST_ASSERT_FALSE(server.wait_event(event, 0));
+
+	// a waiting task wakes up on the command, answered with success without handler or callback
+	bool woken = false;
+	std::thread app{[&] {
+		woken = server.wait_event(event, 5'000);
+	}};
+	auto received = central.get_received();
+	TEST_ASSERT_TRUE(central.unlock("event"));
+	link.pump();
+	app.join();
+	TEST_ASSERT_TRUE(woken);
+	TEST_ASSERT_EQUAL(static_cast<int>(server_event_t::type_t::command), static_cast<int>(event.type));
+	TEST_ASSERT_EQUAL(static_cast<int>(Sesame::item_code_t::unlock), static_cast<int>(event.cmd));
+	TEST_ASSERT_EQUAL(static_cast<int>(Sesame::result_code_t::success), static_cast<int>(event.result));
+	TEST_ASSERT_EQUAL_STRING("event", std::string{event.tag()}.c_str());
+	TEST_ASSERT_GREATER_THAN(received, central.get_received());
+
+	// a full queue drops and counts the newest events
+	for (size_t i = 0; i < LIBSESAME3BT_SERVER_EVENT_QUEUE_SIZE + 2; i++) {
+		TEST_ASSERT_TRUE(central.lock("overflow"));
+		link.pump();
+	}
+	TEST_ASSERT_EQUAL(2, server.get_dropped_events());
+	size_t events = 0;
+	while (server.wait_event(event, 0)) {
+		++events;
+	}
+	TEST_ASSERT_EQUAL(LIBSESAME3BT_SERVER_EVENT_QUEUE_SIZE, events);
+
+	central.disconnect(REASON_REMOTE_TERM);
+	TEST_ASSERT_TRUE(server.wait_event(event, 0));
+	TEST_ASSERT_EQUAL(static_cast<int>(server_event_t::type_t::disconnect), static_cast<int>(event.type));
+	TEST_ASSERT_EQUAL(REASON_REMOTE_TERM, event.reason);
+}
+
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+static uint32_t
+le(const uint8_t* p, size_t size) {
+	uint32_t v = 0;
+	for (size_t i = size; i-- > 0;) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+/// Records of a dump (docs/trace.md), after checking the header and that the sequence numbers are consecutive.
+static std::vector<libsesame3bt::trace_record_t>
+parse_trace(const uint8_t* dump, size_t size) {
+	std::vector<libsesame3bt::trace_record_t> records;
+	TEST_ASSERT_TRUE(size >= 16);
+	TEST_ASSERT_EQUAL_MEMORY("S3TR", dump, 4);
+	TEST_ASSERT_EQUAL(1, le(dump + 4, 2));
+	TEST_ASSERT_EQUAL(16, le(dump + 6, 2));
+	uint32_t first = le(dump + 8, 4);
+	uint32_t count = le(dump + 12, 4);
+	TEST_ASSERT_EQUAL(16 + count * 16, size);
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t* rec = dump + 16 + i * 16;
+		libsesame3bt::trace_record_t r{le(rec, 4), static_cast<uint16_t>(le(rec + 4, 2)), static_cast<libsesame3bt::trace_type_t>(rec[6]),
+		                               rec[7], le(rec + 8, 4), le(rec + 12, 4)};
+		TEST_ASSERT_EQUAL(first + i, r.seq);
+		records.push_back(r);
+	}
+	return records;
+}
+
+static void
+test_trace_ring_sequencing() {
+	using libsesame3bt::trace_type_t;
+	libsesame3bt::TraceRing<8> ring;
+	std::vector<uint8_t> dump;
+	auto write = [&dump](const uint8_t* data, size_t size) { dump.insert(dump.end(), data, data + size); };
+	TEST_ASSERT_EQUAL(0, ring.dump(write));
+	TEST_ASSERT_EQUAL(0, parse_trace(dump.data(), dump.size()).size());
+
+	for (uint32_t i = 1; i <= 3; i++) {
+		ring.record(i * 10, 1, trace_type_t::rx_write, 0x80, i);
+	}
+	dump.clear();
+	TEST_ASSERT_EQUAL(3, ring.dump(write));
+	auto records = parse_trace(dump.data(), dump.size());
+	TEST_ASSERT_EQUAL(3, records.size());
+	TEST_ASSERT_EQUAL(1, records[0].seq);
+	TEST_ASSERT_EQUAL(20, records[1].time_us);
+	TEST_ASSERT_EQUAL(0x80, records[1].arg);
+	TEST_ASSERT_EQUAL(2, records[1].value);
+
+	// wrapped: the newest N records, oldest first
+	for (uint32_t i = 4; i <= 13; i++) {
+		ring.record(i * 10, 2, trace_type_t::tx_notify, 0, i);
+	}
+	dump.clear();
+	TEST_ASSERT_EQUAL(8, ring.dump(write));
+	records = parse_trace(dump.data(), dump.size());
+	TEST_ASSERT_EQUAL(8, records.size());
+	TEST_ASSERT_EQUAL(6, records.front().seq);
+	TEST_ASSERT_EQUAL(13, records.back().value);
+	TEST_ASSERT_EQUAL(13, ring.recorded());
+
+	// concurrent writers each get their own sequence numbers
+	libsesame3bt::TraceRing<1024> shared;
+	std::thread other{[&shared] {
+		for (uint32_t i = 0; i < 500; i++) {
+			shared.record(i, 2, trace_type_t::tx_notify, 0, i);
+		}
+	}};
+	for (uint32_t i = 0; i < 500; i++) {
+		shared.record(i, 1, trace_type_t::rx_write, 0, i);
+	}
+	other.join();
+	dump.clear();
+	TEST_ASSERT_EQUAL(1000, shared.dump(write));
+	size_t per_handle[3]{};
+	uint32_t last_value[3]{};
+	for (const auto& r : parse_trace(dump.data(), dump.size())) {
+		// each writer's records keep their order
+		TEST_ASSERT_TRUE(per_handle[r.conn_handle] == 0 || r.value == last_value[r.conn_handle] + 1);
+		last_value[r.conn_handle] = r.value;
+		++per_handle[r.conn_handle];
+	}
+	TEST_ASSERT_EQUAL(500, per_handle[1]);
+	TEST_ASSERT_EQUAL(500, per_handle[2]);
+}
+
+static void
+test_server_trace() {
+	using libsesame3bt::trace_type_t;
+	auto secret = demo_secret();
+	Link link;
+	SesameServer server{1};
+	Handler handler{link};
+	server.set_handler(&handler);
+	TEST_ASSERT_TRUE(start_server(server, secret));
+	auto centrals = login_centrals(link, NimBLEDevice::getAddress(), 1, secret);
+	TEST_ASSERT_EQUAL(1, centrals.size());
+	TEST_ASSERT_TRUE(centrals[0]->lock("trace"));
+	link.pump();
+	centrals[0]->disconnect(REASON_REMOTE_TERM);
+
+	std::vector<uint8_t> dump(SesameServer::trace_dump_size());
+	size_t size = server.dump_trace(dump.data(), dump.size());
+	TEST_ASSERT_GREATER_THAN(0, size);
+	TEST_ASSERT_EQUAL(0, server.dump_trace(dump.data(), 8));
+	// the protocol steps of the connection, in order
+	std::vector<trace_type_t> expected{trace_type_t::connect, trace_type_t::subscribe, trace_type_t::login, trace_type_t::command,
+	                                   trace_type_t::disconnect};
+	size_t next = 0;
+	uint32_t time_us = 0;
+	for (const auto& r : parse_trace(dump.data(), size)) {
+		TEST_ASSERT_EQUAL(centrals[0]->get_conn_handle(), r.conn_handle);
+		TEST_ASSERT_TRUE(r.time_us >= time_us);
+		time_us = r.time_us;
+		if (next < expected.size() && r.type == expected[next]) {
+			if (r.type == trace_type_t::subscribe) {
+				TEST_ASSERT_EQUAL(1, r.value);
+			} else if (r.type == trace_type_t::command) {
+				TEST_ASSERT_EQUAL(static_cast<uint8_t>(Sesame::item_code_t::lock), r.arg);
+				TEST_ASSERT_EQUAL(static_cast<uint32_t>(Sesame::result_code_t::success), r.value);
+			} else if (r.type == trace_type_t::disconnect) {
+				TEST_ASSERT_EQUAL(REASON_REMOTE_TERM, r.value);
+			}
+			++next;
+		}
+	}
+	TEST_ASSERT_EQUAL(expected.size(), next);
+}
+#endif
+
+int
+main() {
+	UNITY_BEGIN();
+	RUN_TEST(test_login_and_command);
+	RUN_TEST(test_callbacks);
+	RUN_TEST(test_tag_uuid);
+	RUN_TEST(test_logged_in_peers_are_copied);
+	RUN_TEST(test_full_server_stops_advertising);
+	RUN_TEST(test_rejected_write_disconnects);
+	RUN_TEST(test_disconnect_by_address);
+	RUN_TEST(test_notify_retried_after_acl_exhaustion);
+	RUN_TEST(test_deferred_command);
+	RUN_TEST(test_status_coalescing);
+	RUN_TEST(test_failed_broadcast_retried);
+	RUN_TEST(test_admission_evicts_idle_session);
+	RUN_TEST(test_admission_idle_timeout);
+	RUN_TEST(test_login_deadline);
+	RUN_TEST(test_accept_list);
+	RUN_TEST(test_connection_params_switch);
+	RUN_TEST(test_snapshot_round_trip);
+	RUN_TEST(test_event_queue);
+#if LIBSESAME3BT_SERVER_TRACE_SIZE
+	RUN_TEST(test_trace_ring_sequencing);
+	RUN_TEST(test_server_trace);
+#endif
+	return UNITY_END();
+}
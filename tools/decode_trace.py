@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""Decode a SesameServer protocol trace (docs/trace.md) into a timeline.
+
+Input is either the raw binary written by dump_trace() or a serial log containing hex dumps between
+"TRACE BEGIN" and "TRACE END" lines (the last dump in the log is decoded).
+
+usage: decode_trace.py FILE [--handle N]
+"""
+import argparse
+import struct
+import sys
+
+MAGIC = b"S3TR"
+HEADER = struct.Struct("<4sHHII")
+RECORD = struct.Struct("<IHBBII")
+
+EVENTS = {
+    1: "connect",
+    2: "subscribe",
+    3: "rx_write",
+    4: "rx_rejected",
+    5: "tx_notify",
+    6: "tx_busy",
+    7: "tx_dropped",
+    8: "login",
+    9: "command",
+    10: "disconnect",
+    11: "registration",
+}
+
+# Sesame::item_code_t values seen in commands
+ITEMS = {82: "lock", 83: "unlock"}
+
+# Sesame::result_code_t
+RESULTS = {0: "success", 1: "invalid_format", 2: "not_supported", 3: "storage_fail", 4: "invalid_sig", 5: "not_found",
+           6: "unknown", 7: "busy", 8: "invalid_param"}
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data.startswith(MAGIC):
+        return data
+    text = data.decode("utf-8", errors="replace").splitlines()
+    dump = None
+    current = None
+    for line in text:
+        line = line.strip()
+        if line == "TRACE BEGIN":
+            current = []
+        elif line == "TRACE END":
+            if current is not None:
+                dump = "".join(current)
+            current = None
+        elif current is not None:
+            current.append(line)
+    if dump is None:
+        sys.exit(f"{path}: no binary trace and no TRACE BEGIN/END section")
+    return bytes.fromhex(dump)
+
+
+def details(kind, arg, value):
+    if kind == 2:
+        return "accepted" if value else "rejected"
+    if kind in (3, 4, 5, 6, 7):
+        return f"hdr=0x{arg:02x} size={value}"
+    if kind == 9:
+        return f"{ITEMS.get(arg, arg)} -> {RESULTS.get(value, value)}"
+    if kind == 10:
+        return f"reason=0x{value:x}"
+    return ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("file")
+    parser.add_argument("--handle", type=int, help="show only this connection handle")
+    args = parser.parse_args()
+
+    data = load(args.file)
+    if len(data) < HEADER.size:
+        sys.exit("truncated header")
+    magic, version, record_size, first, count = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit(f"unsupported trace (magic={magic!r} version={version} record size={record_size})")
+    available = (len(data) - HEADER.size) // RECORD.size
+    if available < count:
+        print(f"warning: {count} records announced, {available} present", file=sys.stderr)
+        count = available
+
+    records = []
+    torn = 0
+    for i in range(count):
+        time_us, handle, kind, arg, value, seq = RECORD.unpack_from(data, HEADER.size + i * RECORD.size)
+        if seq == 0:
+            torn += 1
+            continue
+        records.append((seq, time_us, handle, kind, arg, value))
+    if not records:
+        print("no records")
+        return
+
+    print(f"# seq {first}..{first + count - 1}, {len(records)} records, {torn} overwritten during dump")
+    print(f"{'seq':>8} {'ms':>12} {'+ms':>9} {'handle':>6}  event         details")
+    origin = records[0][1]
+    prev = origin
+    for seq, time_us, handle, kind, arg, value in records:
+        # 32 bit microsecond clock, wraps every ~71 minutes
+        rel = (time_us - origin) & 0xFFFFFFFF
+        delta = (time_us - prev) & 0xFFFFFFFF
+        prev = time_us
+        if args.handle is not None and handle != args.handle:
+            continue
+        event = EVENTS.get(kind, f"type{kind}")
+        print(f"{seq:>8} {rel / 1000:>12.3f} {delta / 1000:>9.3f} {handle:>6}  {event:<13} {details(kind, arg, value)}")
+
+
+if __name__ == "__main__":
+    main()